@@ -0,0 +1,77 @@
+#include "CaptureReactor.h"
+#include <QSocketNotifier>
+#include <QDebug>
+#include <cstring>
+#include <cerrno>
+#ifdef Q_OS_LINUX
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#define REACTOR_MAX_EVENTS 64
+
+CaptureReactor::CaptureReactor(QObject * parent) : QObject(parent)
+{
+#ifdef Q_OS_LINUX
+   m_epoll = epoll_create1(EPOLL_CLOEXEC);
+   if (m_epoll < 0) qDebug() << "epoll_create1 failed:" << strerror(errno);
+#endif
+}
+
+CaptureReactor::~CaptureReactor()
+{
+   delete m_notifier;
+#ifdef Q_OS_LINUX
+   if (m_epoll >= 0) ::close(m_epoll);
+#endif
+}
+
+bool CaptureReactor::add(int fd, const std::function<void()> & ready)
+{
+#ifdef Q_OS_LINUX
+   if (m_epoll < 0 || fd < 0) return false;
+   // Made here rather than in the constructor so it belongs to the reactor's thread.
+   if (!m_notifier) {
+      m_notifier = new QSocketNotifier(m_epoll, QSocketNotifier::Read);
+      connect(m_notifier, &QSocketNotifier::activated, this, &CaptureReactor::dispatch);
+   }
+   struct epoll_event event;
+   memset(&event, 0, sizeof(event));
+   event.events = EPOLLIN;
+   event.data.fd = fd;
+   if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+      qDebug() << "Cannot watch camera fd" << fd << strerror(errno);
+      return false;
+   }
+   m_handlers.insert(fd, ready);
+   return true;
+#else
+   Q_UNUSED(fd); Q_UNUSED(ready);
+   return false;
+#endif
+}
+
+void CaptureReactor::remove(int fd)
+{
+#ifdef Q_OS_LINUX
+   if (m_handlers.remove(fd)) epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+#else
+   Q_UNUSED(fd);
+#endif
+}
+
+void CaptureReactor::dispatch()
+{
+#ifdef Q_OS_LINUX
+   // Level triggered, anything not handled now makes the epoll fd readable again.
+   struct epoll_event events[REACTOR_MAX_EVENTS];
+   int count = epoll_wait(m_epoll, events, REACTOR_MAX_EVENTS, 0);
+   for (int i = 0; i < count; ++i) {
+      // A handler may remove itself or another camera, look each one up as it comes.
+      auto it = m_handlers.constFind(events[i].data.fd);
+      if (it == m_handlers.constEnd()) continue;
+      std::function<void()> ready = it.value();
+      ready();
+   }
+#endif
+}
@@ -0,0 +1,33 @@
+#ifndef CAPTUREREACTOR_H
+#define CAPTUREREACTOR_H
+
+#include <QObject>
+#include <QHash>
+#include <functional>
+
+class QSocketNotifier;
+
+// Waits on many camera file descriptors with one epoll set and calls each
+// camera's handler on this object's thread when its fd is readable, so a few
+// threads serve many cameras instead of one thread blocking per camera. The
+// epoll fd itself is watched by the thread's event loop, so the captures that
+// live on the same thread keep getting their queued calls and timers.
+class CaptureReactor : public QObject {
+   Q_OBJECT
+public:
+   explicit CaptureReactor(QObject * parent = nullptr);
+   ~CaptureReactor();
+
+   // Both on the reactor's thread.
+   bool add(int fd, const std::function<void()> & ready);
+   void remove(int fd);
+
+private:
+   void dispatch();
+
+   int m_epoll = -1;
+   QSocketNotifier * m_notifier = nullptr;
+   QHash<int, std::function<void()>> m_handlers;
+};
+
+#endif // CAPTUREREACTOR_H
@@ -0,0 +1,232 @@
+#include "FrameBus.h"
+#include <cstring>
+#include <new>
+// Q_OS_UNIX without Qt, FrameBusClient.pro builds this file on its own.
+#if defined(__unix__) || defined(__APPLE__)
+#define FRAMEBUS_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+size_t pageSize()
+{
+#ifdef FRAMEBUS_POSIX
+   long size = sysconf(_SC_PAGESIZE);
+   return size > 0 ? (size_t) size : 4096;
+#else
+   return 4096;
+#endif
+}
+
+uint64_t roundUp(uint64_t value, uint64_t multiple)
+{
+   return (value + multiple - 1) / multiple * multiple;
+}
+
+uint64_t headerBytes()
+{
+   return roundUp(sizeof(FrameBusHeader), pageSize());
+}
+
+FrameBusSlot * slotAt(const FrameBusHeader * header, uint64_t index)
+{
+   uint8_t * base = (uint8_t *) header + headerBytes();
+   return (FrameBusSlot *) (base + index * header->slotStride);
+}
+
+}
+
+std::string FrameBusReader::segmentName(const std::string & camera)
+{
+   std::string name = FRAMEBUS_NAME_PREFIX;
+   for (char c : camera) name += (c == '/' || c == ' ') ? '_' : c;
+   return name;
+}
+
+FrameBusWriter::~FrameBusWriter()
+{
+   close();
+}
+
+bool FrameBusWriter::create(const std::string & camera, uint64_t maxFrameBytes, uint32_t slotCount)
+{
+   close();
+   if (slotCount == 0 || maxFrameBytes == 0) return false;
+#ifdef FRAMEBUS_POSIX
+   m_name = FrameBusReader::segmentName(camera);
+   uint64_t slotStride = roundUp(FRAMEBUS_SLOT_DATA_OFFSET + maxFrameBytes, pageSize());
+   m_mappedBytes = headerBytes() + slotStride * slotCount;
+
+   // Replace any segment left behind by an earlier run, readers attached to it keep their old mapping.
+   // Only the user running the cameras gets to see them.
+   shm_unlink(m_name.c_str());
+   int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+   if (fd < 0) return false;
+   if (ftruncate(fd, (off_t) m_mappedBytes) != 0) {
+      ::close(fd);
+      shm_unlink(m_name.c_str());
+      return false;
+   }
+   void * mapped = mmap(nullptr, m_mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (mapped == MAP_FAILED) {
+      shm_unlink(m_name.c_str());
+      return false;
+   }
+
+   m_header = new (mapped) FrameBusHeader;
+   m_header->version = FRAMEBUS_VERSION;
+   m_header->slotCount = slotCount;
+   m_header->reserved = 0;
+   m_header->slotStride = slotStride;
+   m_header->maxFrameBytes = slotStride - FRAMEBUS_SLOT_DATA_OFFSET;
+   m_header->latestSequence.store(0, std::memory_order_relaxed);
+   strncpy(m_header->camera, camera.c_str(), sizeof(m_header->camera) - 1);
+   m_header->camera[sizeof(m_header->camera) - 1] = 0;
+   for (uint32_t i = 0; i < slotCount; ++i) {
+      FrameBusSlot * slot = new (slotAt(m_header, i)) FrameBusSlot;
+      slot->lock.store(0, std::memory_order_relaxed);
+   }
+   m_sequence = 0;
+   // Readers check the magic last, so the rest of the header is complete when they see it.
+   std::atomic_thread_fence(std::memory_order_release);
+   m_header->magic = FRAMEBUS_MAGIC;
+   return true;
+#else
+   (void) camera;
+   return false; // No POSIX shared memory, nothing is published.
+#endif
+}
+
+bool FrameBusWriter::publish(const void * data, uint64_t size, uint32_t format, uint32_t width, uint32_t height,
+                             uint32_t stride, int64_t timestampNs)
+{
+   if (!m_header || size > m_header->maxFrameBytes) return false;
+
+   uint64_t sequence = ++m_sequence;
+   FrameBusSlot * slot = slotAt(m_header, sequence % m_header->slotCount);
+
+   slot->lock.store(2 * sequence - 1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+
+   slot->sequence = sequence;
+   slot->timestampNs = timestampNs;
+   slot->format = format;
+   slot->width = width;
+   slot->height = height;
+   slot->stride = stride;
+   slot->size = size;
+   memcpy((uint8_t *) slot + FRAMEBUS_SLOT_DATA_OFFSET, data, size);
+
+   slot->lock.store(2 * sequence, std::memory_order_release);
+   m_header->latestSequence.store(sequence, std::memory_order_release);
+   return true;
+}
+
+void FrameBusWriter::close()
+{
+   if (!m_header) return;
+#ifdef FRAMEBUS_POSIX
+   munmap(m_header, m_mappedBytes);
+   shm_unlink(m_name.c_str());
+#endif
+   m_header = nullptr;
+}
+
+FrameBusReader::~FrameBusReader()
+{
+   detach();
+}
+
+bool FrameBusReader::attach(const std::string & camera)
+{
+   detach();
+#ifdef FRAMEBUS_POSIX
+   int fd = shm_open(segmentName(camera).c_str(), O_RDONLY, 0);
+   if (fd < 0) return false;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < headerBytes()) {
+      ::close(fd);
+      return false;
+   }
+   void * mapped = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (mapped == MAP_FAILED) return false;
+
+   const FrameBusHeader * header = (const FrameBusHeader *) mapped;
+   bool valid = header->magic == FRAMEBUS_MAGIC;
+   std::atomic_thread_fence(std::memory_order_acquire);
+   valid = valid && header->version == FRAMEBUS_VERSION
+        && headerBytes() + header->slotStride * header->slotCount <= (uint64_t) st.st_size;
+   if (!valid) {
+      munmap(mapped, (size_t) st.st_size);
+      return false;
+   }
+   m_header = header;
+   m_mappedBytes = (size_t) st.st_size;
+   return true;
+#else
+   (void) camera;
+   return false;
+#endif
+}
+
+void FrameBusReader::detach()
+{
+   if (!m_header) return;
+#ifdef FRAMEBUS_POSIX
+   munmap((void *) m_header, m_mappedBytes);
+#endif
+   m_header = nullptr;
+}
+
+bool FrameBusReader::latest(FrameView & view, uint64_t afterSequence) const
+{
+   if (!m_header) return false;
+   for (int attempt = 0; attempt < 4; ++attempt) {
+      uint64_t sequence = m_header->latestSequence.load(std::memory_order_acquire);
+      if (sequence == 0 || sequence <= afterSequence) return false;
+
+      const FrameBusSlot * slot = slotAt(m_header, sequence % m_header->slotCount);
+      uint64_t lock = slot->lock.load(std::memory_order_acquire);
+      if (lock != 2 * sequence) continue; // Lapped by the writer, try the newer one.
+
+      view.sequence = slot->sequence;
+      view.timestampNs = slot->timestampNs;
+      view.format = slot->format;
+      view.width = slot->width;
+      view.height = slot->height;
+      view.stride = slot->stride;
+      view.size = slot->size;
+      view.data = (const uint8_t *) slot + FRAMEBUS_SLOT_DATA_OFFSET;
+      view.slot = slot;
+      if (view.size <= m_header->maxFrameBytes && stillValid(view)) return true;
+   }
+   return false;
+}
+
+bool FrameBusReader::stillValid(const FrameView & view) const
+{
+   if (!view.slot) return false;
+   std::atomic_thread_fence(std::memory_order_acquire);
+   return view.slot->lock.load(std::memory_order_relaxed) == 2 * view.sequence;
+}
+
+bool FrameBusReader::copyLatest(std::vector<uint8_t> & pixels, FrameView & view, uint64_t afterSequence) const
+{
+   for (int attempt = 0; attempt < 4; ++attempt) {
+      if (!latest(view, afterSequence)) return false;
+      pixels.assign(view.data, view.data + view.size);
+      if (stillValid(view)) {
+         view.data = pixels.data();
+         view.slot = nullptr;
+         return true;
+      }
+   }
+   return false;
+}
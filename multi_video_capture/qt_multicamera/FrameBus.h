@@ -0,0 +1,116 @@
+#ifndef FRAMEBUS_H
+#define FRAMEBUS_H
+
+// Shared memory ring that a stream publishes its frames into, so other local
+// processes can use live frames without opening the cameras themselves.
+//
+// Layout of the segment "/qt_multicamera.<camera>":
+//   FrameBusHeader, padded to a page
+//   slotCount x (FrameBusSlot header, padded to 64 bytes, then the pixels), each slot page aligned
+//
+// There is one writer and any number of readers. Readers never block the
+// writer: each slot carries a sequence lock (odd while being written), and a
+// reader checks it again after using the pixels to know they were not
+// overwritten meanwhile. Plain C++ and POSIX only, so consumers do not need Qt
+// or OpenCV; build FrameBusClient.pro to get a static library. Elsewhere
+// create() and attach() always fail. The segment is readable by its owner only.
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#define FRAMEBUS_MAGIC 0x53554246u /* "FBUS" */
+#define FRAMEBUS_VERSION 1u
+#define FRAMEBUS_NAME_PREFIX "/qt_multicamera."
+#define FRAMEBUS_DEFAULT_SLOTS 4
+
+// Pixel formats, as fourcc codes.
+#define FRAMEBUS_FORMAT_BGR24 0x33524742u /* "BGR3", packed 8 bit BGR */
+#define FRAMEBUS_FORMAT_MJPEG 0x47504A4Du /* "MJPG", one complete JPEG image */
+
+struct FrameBusHeader {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t slotCount;
+   uint32_t reserved;
+   uint64_t slotStride;                  // Bytes from one slot to the next
+   uint64_t maxFrameBytes;               // Payload capacity of each slot
+   std::atomic<uint64_t> latestSequence; // Sequence of the newest complete frame, 0 before the first
+   char camera[64];
+};
+
+struct FrameBusSlot {
+   std::atomic<uint64_t> lock;           // 2 * sequence when complete, odd while being written
+   uint64_t sequence;
+   int64_t timestampNs;                  // Wall clock time the frame was captured, in ms resolution
+   uint32_t format;
+   uint32_t width;
+   uint32_t height;
+   uint32_t stride;                      // Bytes per row, 0 for compressed formats
+   uint64_t size;                        // Payload bytes
+};
+
+#define FRAMEBUS_SLOT_DATA_OFFSET 64
+
+// A frame still living in shared memory. Only valid while FrameBusReader::stillValid() says so.
+struct FrameView {
+   const uint8_t * data = nullptr;
+   uint64_t size = 0;
+   uint64_t sequence = 0;
+   int64_t timestampNs = 0;
+   uint32_t format = 0, width = 0, height = 0, stride = 0;
+   const FrameBusSlot * slot = nullptr;
+};
+
+class FrameBusWriter {
+public:
+   FrameBusWriter() {}
+   ~FrameBusWriter();
+   FrameBusWriter(const FrameBusWriter &) = delete;
+   FrameBusWriter & operator=(const FrameBusWriter &) = delete;
+
+   // Creates (or replaces) the segment for the camera.
+   bool create(const std::string & camera, uint64_t maxFrameBytes, uint32_t slotCount = FRAMEBUS_DEFAULT_SLOTS);
+   bool isOpen() const { return m_header != nullptr; }
+   uint64_t maxFrameBytes() const { return m_header ? m_header->maxFrameBytes : 0; }
+
+   // Copies the frame into the next slot. Frames larger than the slots are dropped.
+   bool publish(const void * data, uint64_t size, uint32_t format, uint32_t width, uint32_t height,
+                uint32_t stride, int64_t timestampNs);
+   void close();
+
+private:
+   std::string m_name;
+   FrameBusHeader * m_header = nullptr;
+   size_t m_mappedBytes = 0;
+   uint64_t m_sequence = 0;
+};
+
+class FrameBusReader {
+public:
+   FrameBusReader() {}
+   ~FrameBusReader();
+   FrameBusReader(const FrameBusReader &) = delete;
+   FrameBusReader & operator=(const FrameBusReader &) = delete;
+
+   static std::string segmentName(const std::string & camera);
+
+   bool attach(const std::string & camera);
+   bool isAttached() const { return m_header != nullptr; }
+   void detach();
+
+   // Newest complete frame, false if there is none or it is newer than afterSequence.
+   bool latest(FrameView & view, uint64_t afterSequence = 0) const;
+   // True if the frame's pixels were not overwritten since latest() returned it.
+   bool stillValid(const FrameView & view) const;
+   // Convenience for consumers that want their own copy.
+   bool copyLatest(std::vector<uint8_t> & pixels, FrameView & view, uint64_t afterSequence = 0) const;
+
+private:
+   const FrameBusHeader * m_header = nullptr;
+   size_t m_mappedBytes = 0;
+};
+
+#endif // FRAMEBUS_H
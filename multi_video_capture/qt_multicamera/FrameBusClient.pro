@@ -0,0 +1,8 @@
+# Static library for processes that want to read frames published on the frame bus.
+# Only needs a C++ compiler and POSIX shared memory, no Qt or OpenCV.
+TEMPLATE = lib
+CONFIG += staticlib c++14
+CONFIG -= qt
+TARGET = framebus
+SOURCES = FrameBus.cpp
+HEADERS = FrameBus.h
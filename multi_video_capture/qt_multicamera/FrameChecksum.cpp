@@ -0,0 +1,62 @@
+#include "FrameChecksum.h"
+#include <cstring>
+
+namespace {
+
+// Fletcher style sums in four independent lanes, which compilers turn into vector adds.
+struct Sums {
+   quint64 a[4] = { 0, 0, 0, 0 };
+   quint64 b[4] = { 0, 0, 0, 0 };
+
+   void add(const uchar * data, size_t size) {
+      size_t words = size / 8;
+      size_t i = 0;
+      for (; i + 4 <= words; i += 4) {
+         quint64 w[4];
+         memcpy(w, data + i * 8, sizeof(w));
+         for (int lane = 0; lane < 4; ++lane) {
+            a[lane] += w[lane];
+            b[lane] += a[lane];
+         }
+      }
+      // Whole words left over from the groups of four, then the bytes past the last whole word.
+      for (int lane = 0; i < words; ++i, ++lane) {
+         quint64 w;
+         memcpy(&w, data + i * 8, sizeof(w));
+         a[lane] += w;
+         b[lane] += a[lane];
+      }
+      quint64 tail = 0;
+      for (size_t byte = words * 8; byte < size; ++byte) tail = (tail << 8) | data[byte];
+      a[0] += tail + size;
+      b[0] += a[0];
+   }
+
+   quint64 result() const {
+      quint64 h = 0;
+      for (int lane = 0; lane < 4; ++lane) h = (h ^ a[lane]) * 0x100000001b3ull ^ b[lane];
+      return h;
+   }
+};
+
+}
+
+quint64 FrameChecksum::ofBytes(const uchar * data, size_t size)
+{
+   Sums sums;
+   sums.add(data, size);
+   return sums.result();
+}
+
+quint64 FrameChecksum::ofFrame(const cv::Mat & frame)
+{
+   if (frame.empty()) return 0;
+   Sums sums;
+   if (frame.isContinuous()) {
+      sums.add(frame.ptr(), frame.total() * frame.elemSize());
+   } else {
+      size_t rowBytes = frame.cols * frame.elemSize();
+      for (int row = 0; row < frame.rows; ++row) sums.add(frame.ptr(row), rowBytes);
+   }
+   return sums.result() ^ ((quint64) frame.cols << 32 | (quint64) frame.rows);
+}
@@ -0,0 +1,17 @@
+#ifndef FRAMECHECKSUM_H
+#define FRAMECHECKSUM_H
+
+#include <QtGlobal>
+#include <opencv2/core.hpp>
+
+// Cheap checksums for spotting a frame identical to the one before, e.g. from
+// an IP camera repeating frames to fill its stream rate. Not cryptographic,
+// and not meant to find similar frames, only the same bytes again.
+namespace FrameChecksum {
+   // Over every byte, for compressed frames where any change moves most of the bytes.
+   quint64 ofBytes(const uchar * data, size_t size);
+   // Over every pixel of a decoded frame, continuous or not.
+   quint64 ofFrame(const cv::Mat & frame);
+}
+
+#endif // FRAMECHECKSUM_H
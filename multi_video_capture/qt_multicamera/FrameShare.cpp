@@ -0,0 +1,75 @@
+#include "FrameShare.h"
+#include "MemoryBudget.h"
+#include <opencv2/imgproc.hpp>
+
+FrameShare::FrameShare(const QString & owner, Policy policy, QObject * parent) : QObject(parent), m_owner(owner), m_policy(policy)
+{
+}
+
+FrameShare::~FrameShare()
+{
+   drop();
+}
+
+void FrameShare::setWanted(bool wanted)
+{
+   m_wanted.storeRelease(wanted ? 1 : 0);
+   if (!wanted) drop();
+}
+
+void FrameShare::drop()
+{
+   QMutexLocker lock(&m_mutex);
+   m_waiting = SharedFrame();
+   m_haveWaiting = false;
+   MemoryBudget::release(m_owner, MemoryBudget::Share, m_reserved);
+   m_reserved = 0;
+}
+
+bool FrameShare::take(SharedFrame & frame)
+{
+   QMutexLocker lock(&m_mutex);
+   if (!m_haveWaiting) return false;
+   frame = m_waiting;
+   m_waiting = SharedFrame();
+   m_haveWaiting = false;
+   // The consumer accounts for what it keeps.
+   MemoryBudget::release(m_owner, MemoryBudget::Share, m_reserved);
+   m_reserved = 0;
+   return true;
+}
+
+void FrameShare::offer(const cv::Mat & frame, qint64 msCaptureTime, const QSize & fullSize)
+{
+   if (!wanted() || frame.empty()) return;
+   if (m_policy == Sample) {
+      QMutexLocker lock(&m_mutex);
+      if (m_haveWaiting) return;
+   }
+   int maxWidth = m_maxWidth.loadAcquire();
+   cv::Size size = frame.size();
+   if (maxWidth > 0 && size.width > maxWidth) size = cv::Size(maxWidth, qMax(1, frame.rows * maxWidth / frame.cols));
+   qint64 bytes = (qint64) size.area() * (qint64) frame.elemSize();
+   if (!MemoryBudget::reserve(m_owner, MemoryBudget::Share, bytes)) return;
+
+   SharedFrame shared;
+   if (size == frame.size()) shared.frame = frame.clone();
+   else cv::resize(frame, shared.frame, size, 0, 0, cv::INTER_AREA);
+   shared.msCaptureTime = msCaptureTime;
+   shared.fullSize = fullSize;
+   bool wasWaiting;
+   {
+      QMutexLocker lock(&m_mutex);
+      if (!wanted()) {
+         MemoryBudget::release(m_owner, MemoryBudget::Share, bytes);
+         return;
+      }
+      wasWaiting = m_haveWaiting;
+      // The frame not taken yet is stale now.
+      MemoryBudget::release(m_owner, MemoryBudget::Share, m_reserved);
+      m_waiting = shared;
+      m_haveWaiting = true;
+      m_reserved = bytes;
+   }
+   if (!wasWaiting) emit offered();
+}
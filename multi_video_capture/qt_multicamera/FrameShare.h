@@ -0,0 +1,56 @@
+#ifndef FRAMESHARE_H
+#define FRAMESHARE_H
+
+#include <QObject>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QSize>
+#include <QString>
+#include <opencv2/core.hpp>
+
+struct SharedFrame {
+   cv::Mat frame;             // A copy, capture never writes to it again
+   qint64 msCaptureTime = 0;
+   QSize fullSize;            // As the source delivers it, before any preview scaling
+};
+
+// Hands a stream's frames to a consumer on another thread (the preview server,
+// the mosaic recorder). The capture thread copies a frame only while the consumer
+// says it wants them, and at most one copy waits to be taken: a newer frame
+// replaces it rather than queue up behind it, or with Sample the waiting one is
+// kept so frames are copied no faster than the consumer takes them. The waiting
+// copy is accounted in the memory budget and not made when it would not fit.
+class FrameShare : public QObject {
+   Q_OBJECT
+public:
+   enum Policy { Newest, Sample };
+
+   explicit FrameShare(const QString & owner, Policy policy = Newest, QObject * parent = nullptr);
+   ~FrameShare();
+
+   // Consumer side. Not wanting frames also drops the one waiting.
+   void setWanted(bool wanted);
+   // Wider frames are shrunk to this width instead of copied, 0 copies them as they are.
+   void setMaxWidth(int width) { m_maxWidth.storeRelease(qMax(0, width)); }
+   bool take(SharedFrame & frame);
+   // A frame is waiting where none was, emitted on the capture thread.
+   Q_SIGNAL void offered();
+
+   // Capture side, wanted() is a cheap check for every frame.
+   bool wanted() const { return m_wanted.loadAcquire() != 0; }
+   void offer(const cv::Mat & frame, qint64 msCaptureTime, const QSize & fullSize);
+
+private:
+   void drop();
+
+   QString m_owner;
+   Policy m_policy;
+   QAtomicInt m_wanted;
+   QAtomicInt m_maxWidth;
+   QMutex m_mutex;             // Guards everything below
+   SharedFrame m_waiting;
+   bool m_haveWaiting = false;
+   qint64 m_reserved = 0;      // Bytes of m_waiting taken from the memory budget
+};
+
+#endif // FRAMESHARE_H
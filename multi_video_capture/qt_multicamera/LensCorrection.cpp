@@ -0,0 +1,144 @@
+#include "LensCorrection.h"
+#include "FrameChecksum.h"
+#include "TraceRecorder.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+
+LensCorrection::LensCorrection(const QString & owner, MemoryBudget::Stage stage) : m_held(owner, stage)
+{
+}
+
+bool LensCorrection::load(const QString & calibrationPath)
+{
+   QFile file(calibrationPath);
+   if (!file.open(QIODevice::ReadOnly)) {
+      qDebug() << "Cannot read calibration" << calibrationPath << ", not undistorting.";
+      return false;
+   }
+   QByteArray bytes = file.readAll();
+   m_checksum = FrameChecksum::ofBytes((const uchar *) bytes.constData(), (size_t) bytes.size());
+   m_name = QFileInfo(calibrationPath).completeBaseName();
+
+   try {
+      cv::FileStorage storage(bytes.toStdString(), cv::FileStorage::READ | cv::FileStorage::MEMORY);
+      storage["camera_matrix"] >> m_cameraMatrix;
+      storage["distortion_coefficients"] >> m_distortion;
+      m_calibrationSize = cv::Size((int) storage["image_width"], (int) storage["image_height"]);
+   } catch (const cv::Exception & e) {
+      qDebug() << "Cannot parse calibration" << calibrationPath << ":" << e.what();
+      return false;
+   }
+   if (m_cameraMatrix.size() != cv::Size(3, 3) || m_distortion.empty() || m_calibrationSize.area() <= 0) {
+      qDebug() << "Calibration" << calibrationPath << "needs camera_matrix, distortion_coefficients, image_width and image_height.";
+      return false;
+   }
+   m_cameraMatrix.convertTo(m_cameraMatrix, CV_64F);
+   m_distortion.convertTo(m_distortion, CV_64F);
+   return true;
+}
+
+void LensCorrection::prepare(const cv::Size & size)
+{
+   tablesFor(size);
+}
+
+LensCorrection::Tables LensCorrection::tablesFor(const cv::Size & size)
+{
+   QMutexLocker lock(&m_mutex);
+   for (int i = 0; i < m_tables.size(); ++i) {
+      if (m_tables.at(i).size != size) continue;
+      if (i) m_tables.move(i, 0);
+      return m_tables.first();
+   }
+
+   Tables tables;
+   tables.size = size;
+   if (!readCache(tables)) {
+      make(tables);
+      if (!m_cacheDirectory.isEmpty()) writeCache(tables);
+   }
+   m_tables.prepend(tables);
+   while (m_tables.size() > LENS_CACHED_SIZES) m_tables.removeLast();
+   qint64 bytes = 0;
+   foreach (const Tables & held, m_tables) bytes += (qint64) (held.xy.total() * held.xy.elemSize() + held.fraction.total() * held.fraction.elemSize());
+   m_held.set(bytes);
+   return tables;
+}
+
+// The calibration scaled to size, the optical centre staying at the same place in the picture.
+void LensCorrection::make(Tables & tables) const
+{
+   TRACE_SCOPE("lens tables");
+   QElapsedTimer elapsed;
+   elapsed.start();
+   double sx = (double) tables.size.width / m_calibrationSize.width, sy = (double) tables.size.height / m_calibrationSize.height;
+   cv::Mat camera = m_cameraMatrix.clone();
+   camera.at<double>(0, 0) *= sx;
+   camera.at<double>(0, 2) *= sx;
+   camera.at<double>(1, 1) *= sy;
+   camera.at<double>(1, 2) *= sy;
+   cv::initUndistortRectifyMap(camera, m_distortion, cv::Mat(), camera, tables.size, CV_16SC2, tables.xy, tables.fraction);
+   qDebug() << "Made lens tables" << m_name << tables.size.width << "x" << tables.size.height << "in" << elapsed.elapsed() << "ms";
+}
+
+QString LensCorrection::cachePath(const cv::Size & size) const
+{
+   return m_cacheDirectory + "/" + m_name + QString(" %1x%2.").arg(size.width).arg(size.height) + LENS_MAP_EXTENSION;
+}
+
+bool LensCorrection::readCache(Tables & tables) const
+{
+   if (m_cacheDirectory.isEmpty()) return false;
+   QFile file(cachePath(tables.size));
+   if (!file.open(QIODevice::ReadOnly)) return false;
+   LensMapHeader header = {};
+   if (file.read((char *) &header, sizeof(header)) != sizeof(header) || header.magic != LENS_MAP_MAGIC
+         || header.version != LENS_MAP_VERSION || header.calibrationChecksum != m_checksum
+         || (int) header.width != tables.size.width || (int) header.height != tables.size.height)
+      return false;
+   cv::Mat xy(tables.size, CV_16SC2), fraction(tables.size, CV_16UC1);
+   qint64 xyBytes = (qint64) (xy.total() * xy.elemSize()), fractionBytes = (qint64) (fraction.total() * fraction.elemSize());
+   if (file.read((char *) xy.data, xyBytes) != xyBytes || file.read((char *) fraction.data, fractionBytes) != fractionBytes)
+      return false;
+   tables.xy = xy;
+   tables.fraction = fraction;
+   return true;
+}
+
+void LensCorrection::writeCache(const Tables & tables) const
+{
+   QDir().mkpath(m_cacheDirectory);
+   QSaveFile file(cachePath(tables.size));
+   if (!file.open(QIODevice::WriteOnly)) return;
+   LensMapHeader header = {};
+   header.magic = LENS_MAP_MAGIC;
+   header.version = LENS_MAP_VERSION;
+   header.width = (quint32) tables.size.width;
+   header.height = (quint32) tables.size.height;
+   header.calibrationChecksum = m_checksum;
+   file.write((const char *) &header, sizeof(header));
+   file.write((const char *) tables.xy.data, (qint64) (tables.xy.total() * tables.xy.elemSize()));
+   file.write((const char *) tables.fraction.data, (qint64) (tables.fraction.total() * tables.fraction.elemSize()));
+   if (!file.commit()) qDebug() << "Failed to store lens tables" << file.fileName();
+}
+
+void LensCorrection::apply(const cv::Mat & src, cv::Mat & dst)
+{
+   if (src.empty()) return;
+   TRACE_SCOPE("undistort");
+   Tables tables = tablesFor(src.size());
+   dst.create(src.size(), src.type());
+   // Every strip reads wherever its table points in src, and writes only its own rows of dst.
+   int strips = qMax(1, src.rows / LENS_STRIP_ROWS);
+   cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range & range) {
+      int first = range.start * src.rows / strips, last = range.end * src.rows / strips;
+      cv::Mat rows = dst.rowRange(first, last);
+      cv::remap(src, rows, tables.xy.rowRange(first, last), tables.fraction.rowRange(first, last), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+   }, strips);
+}
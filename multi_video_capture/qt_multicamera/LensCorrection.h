@@ -0,0 +1,72 @@
+#ifndef LENSCORRECTION_H
+#define LENSCORRECTION_H
+
+#include <QString>
+#include <QMutex>
+#include <QList>
+#include <opencv2/core.hpp>
+#include "MemoryBudget.h"
+
+// Remap tables are kept on disk as a header followed by the CV_16SC2 and the
+// CV_16UC1 map, row by row, in host (little endian) byte order. A table made
+// from a calibration file that has since changed is made again.
+#define LENS_MAP_MAGIC 0x4c434d51u       // "QMCL"
+#define LENS_MAP_VERSION 1
+#define LENS_MAP_EXTENSION "map"
+// Sizes whose tables are kept in memory, e.g. the tile and the tile in focus.
+#define LENS_CACHED_SIZES 3
+// Frames are remapped in strips of about this many rows, one per worker.
+#define LENS_STRIP_ROWS 64
+
+struct LensMapHeader {
+   quint32 magic;
+   quint32 version;
+   quint32 width, height;
+   quint64 calibrationChecksum;   // FrameChecksum::ofBytes() of the calibration file
+   quint32 reserved[2];
+};
+
+static_assert(sizeof(LensMapHeader) == 32, "LensMapHeader layout is part of the file format");
+
+// Undistorts a camera's frames with the pinhole model from an OpenCV calibration
+// file (camera_matrix, distortion_coefficients, image_width, image_height as
+// written by OpenCV's calibration sample). The calibration is scaled to
+// whatever size a frame comes in, so a preview decoded or scaled down to its
+// tile is corrected at that size rather than in full and scaled afterwards.
+// Tables are made once per size in fixed point, which cv::remap() interpolates
+// with integer arithmetic, and the remap is split into strips over OpenCV's
+// worker threads. Safe to use from any thread.
+class LensCorrection {
+public:
+   LensCorrection(const QString & owner, MemoryBudget::Stage stage);
+
+   bool load(const QString & calibrationPath);
+   // Tables made from now on are also stored there, and read back instead of made next time.
+   void setCacheDirectory(const QString & directory) { m_cacheDirectory = directory; }
+
+   // Makes (or reads) the tables for frames of size now, rather than with the first apply().
+   void prepare(const cv::Size & size);
+   // dst must not share its data with src.
+   void apply(const cv::Mat & src, cv::Mat & dst);
+
+private:
+   struct Tables { cv::Size size; cv::Mat xy, fraction; };
+
+   Tables tablesFor(const cv::Size & size);
+   void make(Tables & tables) const;
+   QString cachePath(const cv::Size & size) const;
+   bool readCache(Tables & tables) const;
+   void writeCache(const Tables & tables) const;
+
+   cv::Mat m_cameraMatrix, m_distortion;
+   cv::Size m_calibrationSize;
+   QString m_name;                  // Of the calibration file, names the tables on disk
+   quint64 m_checksum = 0;
+   QString m_cacheDirectory;
+
+   QMutex m_mutex;                  // Guards everything below
+   QList<Tables> m_tables;          // Most recently used first
+   MemoryBudget::Holding m_held;
+};
+
+#endif // LENSCORRECTION_H
@@ -0,0 +1,112 @@
+#include "MemoryBudget.h"
+#include <QMutex>
+#include <QMap>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace {
+
+struct Account {
+   qint64 bytes[MemoryBudget::StageCount];
+   quint64 refused = 0;
+   Account() { memset(bytes, 0, sizeof(bytes)); }
+};
+
+QMutex g_mutex;                  // Guards g_accounts
+QMap<QString, Account> g_accounts;
+std::atomic<qint64> g_used{0};
+std::atomic<qint64> g_limit{0};
+
+void adjust(const QString & owner, MemoryBudget::Stage stage, qint64 delta)
+{
+   QMutexLocker lock(&g_mutex);
+   g_accounts[owner].bytes[stage] += delta;
+   g_used += delta;
+}
+
+}
+
+void MemoryBudget::setLimit(qint64 bytes)
+{
+   g_limit = qMax<qint64>(0, bytes);
+}
+
+qint64 MemoryBudget::limit()
+{
+   return g_limit;
+}
+
+qint64 MemoryBudget::used()
+{
+   return g_used;
+}
+
+bool MemoryBudget::fits(qint64 bytes)
+{
+   qint64 limit = g_limit;
+   return limit == 0 || g_used + bytes <= limit;
+}
+
+bool MemoryBudget::reserve(const QString & owner, Stage stage, qint64 bytes)
+{
+   QMutexLocker lock(&g_mutex);
+   Account & account = g_accounts[owner];
+   qint64 limit = g_limit;
+   if (limit > 0 && g_used + bytes > limit) {
+      account.refused++;
+      return false;
+   }
+   account.bytes[stage] += bytes;
+   g_used += bytes;
+   return true;
+}
+
+void MemoryBudget::release(const QString & owner, Stage stage, qint64 bytes)
+{
+   adjust(owner, stage, -bytes);
+}
+
+const char * MemoryBudget::stageName(Stage stage)
+{
+   static const char * names[StageCount] = { "capture", "network", "convert", "view", "snapshot", "storage", "frame bus", "shared" };
+   return (stage >= 0 && stage < StageCount) ? names[stage] : "unknown";
+}
+
+QList<MemoryBudget::Usage> MemoryBudget::usage()
+{
+   QList<Usage> all;
+   {
+      QMutexLocker lock(&g_mutex);
+      for (auto it = g_accounts.constBegin(); it != g_accounts.constEnd(); ++it) {
+         Usage usage;
+         usage.owner = it.key();
+         usage.total = 0;
+         usage.refused = it.value().refused;
+         for (int stage = 0; stage < StageCount; ++stage) {
+            usage.bytes[stage] = it.value().bytes[stage];
+            usage.total += usage.bytes[stage];
+         }
+         if (usage.total || usage.refused) all.append(usage);
+      }
+   }
+   std::sort(all.begin(), all.end(), [](const Usage & a, const Usage & b) { return a.total > b.total; });
+   return all;
+}
+
+void MemoryBudget::Holding::setOwner(const QString & owner, Stage stage)
+{
+   if (owner == m_owner && stage == m_stage) return;
+   qint64 bytes = m_bytes;
+   set(0);
+   m_owner = owner;
+   m_stage = stage;
+   set(bytes);
+}
+
+void MemoryBudget::Holding::set(qint64 bytes)
+{
+   if (bytes == m_bytes) return;
+   adjust(m_owner, m_stage, bytes - m_bytes);
+   m_bytes = bytes;
+}
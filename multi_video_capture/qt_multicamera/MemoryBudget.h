@@ -0,0 +1,57 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QList>
+#include <QString>
+
+// One memory limit for the whole process (memory_budget_mb). Everything that
+// buffers frames accounts for them here by stream (owner) and stage. What a
+// component already holds is only counted, but anything that would grow a
+// backlog (storage queue, snapshots, jitter buffers, the frame bus) asks
+// first and drops or waits when the budget is spent, so adding cameras makes
+// frames drop instead of the process running out of memory.
+class MemoryBudget {
+public:
+   enum Stage { Capture, Network, Convert, View, Snapshot, Storage, FrameBus, Share, StageCount };
+
+   struct Usage {
+      QString owner;
+      qint64 bytes[StageCount];
+      qint64 total;
+      quint64 refused;           // Reservations turned down since the start
+   };
+
+   // 0 is no limit.
+   static void setLimit(qint64 bytes);
+   static qint64 limit();
+   static qint64 used();
+   // True if bytes more would still be within the limit.
+   static bool fits(qint64 bytes);
+
+   // Takes bytes from the budget if they fit, false (and counted as refused) if not.
+   static bool reserve(const QString & owner, Stage stage, qint64 bytes);
+   static void release(const QString & owner, Stage stage, qint64 bytes);
+
+   static const char * stageName(Stage stage);
+   // Every owner holding anything, largest first.
+   static QList<Usage> usage();
+
+   // Memory a component holds steadily, e.g. its current frame, updated as it
+   // changes. Used from one thread, it only takes the lock when the size changes.
+   class Holding {
+   public:
+      Holding() {}
+      Holding(const QString & owner, Stage stage) : m_owner(owner), m_stage(stage) {}
+      ~Holding() { set(0); }
+      void setOwner(const QString & owner, Stage stage);
+      void set(qint64 bytes);
+      qint64 bytes() const { return m_bytes; }
+   private:
+      Q_DISABLE_COPY(Holding)
+      QString m_owner;
+      Stage m_stage = Capture;
+      qint64 m_bytes = 0;
+   };
+};
+
+#endif // MEMORYBUDGET_H
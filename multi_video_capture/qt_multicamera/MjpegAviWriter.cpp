@@ -0,0 +1,147 @@
+#include "MjpegAviWriter.h"
+#include "TraceRecorder.h"
+#include <QtEndian>
+#include <QDebug>
+
+#define AVIF_HASINDEX 0x00000010
+#define AVIIF_KEYFRAME 0x00000010
+
+bool MjpegAviWriter::open(const QString & fileName, int width, int height, int framesPerSecond)
+{
+   close();
+   m_fileName = fileName;
+   m_handle = m_storage->open(fileName);
+   if (m_handle < 0) return false;
+   m_chunk.clear();
+   m_written = 0;
+   m_dropped = 0;
+   m_width = width; m_height = height; m_fps = qMax(1, framesPerSecond);
+   m_offsets.clear(); m_sizes.clear();
+   m_moviBytes = 0;
+
+   writeFourCC("RIFF"); m_riffSizePos = pos(); writeU32(0); writeFourCC("AVI ");
+
+   writeFourCC("LIST"); writeU32(4 + 8 + 56 + 12 + 8 + 56 + 8 + 40); writeFourCC("hdrl");
+
+   // MainAVIHeader
+   writeFourCC("avih"); writeU32(56);
+   writeU32(1000000 / m_fps);                  // dwMicroSecPerFrame
+   writeU32(0);                                // dwMaxBytesPerSec
+   writeU32(0);                                // dwPaddingGranularity
+   writeU32(AVIF_HASINDEX);                    // dwFlags
+   m_totalFramesPos = pos(); writeU32(0); // dwTotalFrames
+   writeU32(0);                                // dwInitialFrames
+   writeU32(1);                                // dwStreams
+   writeU32(0);                                // dwSuggestedBufferSize
+   writeU32(m_width); writeU32(m_height);
+   writeU32(0); writeU32(0); writeU32(0); writeU32(0);
+
+   writeFourCC("LIST"); writeU32(4 + 8 + 56 + 8 + 40); writeFourCC("strl");
+
+   // AVIStreamHeader
+   writeFourCC("strh"); writeU32(56);
+   writeFourCC("vids"); writeFourCC("MJPG");
+   writeU32(0);                                // dwFlags
+   writeU16(0); writeU16(0);                   // wPriority, wLanguage
+   writeU32(0);                                // dwInitialFrames
+   writeU32(1); writeU32(m_fps);               // dwScale, dwRate
+   writeU32(0);                                // dwStart
+   m_lengthPos = pos(); writeU32(0);    // dwLength
+   writeU32(0);                                // dwSuggestedBufferSize
+   writeU32(0xFFFFFFFF);                       // dwQuality
+   writeU32(0);                                // dwSampleSize
+   writeU16(0); writeU16(0); writeU16(m_width); writeU16(m_height); // rcFrame
+
+   // BITMAPINFOHEADER
+   writeFourCC("strf"); writeU32(40);
+   writeU32(40); writeU32(m_width); writeU32(m_height);
+   writeU16(1); writeU16(24);
+   writeFourCC("MJPG");
+   writeU32(m_width * m_height * 3);
+   writeU32(0); writeU32(0); writeU32(0); writeU32(0);
+
+   writeFourCC("LIST"); m_moviSizePos = pos(); writeU32(0);
+   m_moviPos = pos(); writeFourCC("movi");
+   m_storage->append(m_handle, m_chunk, true);
+   m_written += m_chunk.size();
+   m_chunk.clear();
+   if (!m_index.open(fileName, width, height, m_fps)) qDebug() << "No index for" << fileName;
+   return true;
+}
+
+bool MjpegAviWriter::writeJpeg(const uchar * data, int size, qint64 msTimestamp, quint32 flags)
+{
+   TRACE_SCOPE("write frame");
+   if (!isOpened() || size <= 0) return false;
+   qint64 offset = pos() - m_moviPos;
+   qint64 dataPos = pos() + 8;
+
+   m_chunk.reserve(8 + size + 1);
+   writeFourCC("00dc"); writeU32(size);
+   m_chunk.append((const char *) data, size);
+   if (size & 1) m_chunk.append('\0'); // Chunks are word aligned
+
+   // A refused frame leaves the file as it was, the index only lists what was written.
+   bool ok = m_storage->append(m_handle, m_chunk);
+   if (ok) {
+      m_offsets.append((quint32) offset);
+      m_sizes.append((quint32) size);
+      m_written += m_chunk.size();
+      m_moviBytes += m_chunk.size();
+      m_index.append(msTimestamp, dataPos, (quint32) size, flags | RECORDING_INDEX_KEYFRAME);
+   } else {
+      m_dropped++;
+   }
+   m_chunk.clear();
+   return ok;
+}
+
+void MjpegAviWriter::close()
+{
+   if (!isOpened()) return;
+
+   qint64 moviEnd = pos();
+   writeFourCC("idx1"); writeU32(m_offsets.size() * 16);
+   for (int i = 0; i < m_offsets.size(); ++i) {
+      writeFourCC("00dc"); writeU32(AVIIF_KEYFRAME); writeU32(m_offsets.at(i)); writeU32(m_sizes.at(i));
+   }
+   qint64 end = pos();
+   m_storage->append(m_handle, m_chunk, true);
+   m_written += m_chunk.size();
+   m_chunk.clear();
+
+   patchU32(m_riffSizePos, (quint32)(end - 8));
+   patchU32(m_moviSizePos, (quint32)(moviEnd - m_moviPos));
+   patchU32(m_totalFramesPos, m_offsets.size());
+   patchU32(m_lengthPos, m_offsets.size());
+   m_storage->close(m_handle);
+   m_handle = -1;
+   m_index.close();
+   if (m_dropped) qDebug() << m_fileName << "dropped" << m_dropped << "frames, storage could not keep up.";
+}
+
+void MjpegAviWriter::writeFourCC(const char * fourcc)
+{
+   m_chunk.append(fourcc, 4);
+}
+
+void MjpegAviWriter::writeU32(quint32 value)
+{
+   uchar bytes[4];
+   qToLittleEndian(value, bytes);
+   m_chunk.append((const char *) bytes, 4);
+}
+
+void MjpegAviWriter::writeU16(quint16 value)
+{
+   uchar bytes[2];
+   qToLittleEndian(value, bytes);
+   m_chunk.append((const char *) bytes, 2);
+}
+
+void MjpegAviWriter::patchU32(qint64 position, quint32 value)
+{
+   uchar bytes[4];
+   qToLittleEndian(value, bytes);
+   m_storage->writeAt(m_handle, position, QByteArray((const char *) bytes, 4));
+}
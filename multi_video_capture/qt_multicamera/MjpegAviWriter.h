@@ -0,0 +1,55 @@
+#ifndef MJPEGAVIWRITER_H
+#define MJPEGAVIWRITER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include "StorageWriter.h"
+#include "RecordingIndex.h"
+
+// AVI 1.0 files are limited to a signed 32 bit size, roll over well before that.
+#define MJPEG_AVI_MAX_MOVI_BYTES ((qint64)1024*1024*1024)
+
+// Writes already encoded JPEG frames into an MJPEG AVI file as they are, so a
+// camera's compressed frames can be recorded without a decode/encode round trip.
+// The bytes go out through the StorageWriter, one write per frame, and every
+// frame written is listed in the recording's sidecar index.
+class MjpegAviWriter {
+public:
+   explicit MjpegAviWriter(StorageWriter * storage) : m_storage(storage), m_index(storage) {}
+   ~MjpegAviWriter() { close(); }
+
+   bool open(const QString & fileName, int width, int height, int framesPerSecond);
+   bool isOpened() const { return m_handle >= 0; }
+   // True once the file is large enough that the caller should start a new one.
+   bool isFull() const { return m_moviBytes >= MJPEG_AVI_MAX_MOVI_BYTES; }
+   // False if the frame was not written, e.g. because the storage queue is full.
+   // msTimestamp and the RECORDING_INDEX_ flags go into the sidecar index.
+   bool writeJpeg(const uchar * data, int size, qint64 msTimestamp, quint32 flags = 0);
+   void close();
+
+   QString fileName() const { return m_fileName; }
+   int frameCount() const { return m_offsets.size(); }
+   quint64 droppedFrames() const { return m_dropped; }
+
+private:
+   void writeFourCC(const char * fourcc);
+   void writeU32(quint32 value);
+   void writeU16(quint16 value);
+   void patchU32(qint64 position, quint32 value);
+   qint64 pos() const { return m_written + m_chunk.size(); }
+
+   StorageWriter * m_storage;
+   RecordingIndexWriter m_index;
+   int m_handle = -1;
+   QString m_fileName;
+   QByteArray m_chunk;                    // Bytes not yet handed to the storage writer
+   qint64 m_written = 0;                  // Bytes already handed over
+   quint64 m_dropped = 0;
+   int m_width = 0, m_height = 0, m_fps = 0;
+   qint64 m_riffSizePos = 0, m_totalFramesPos = 0, m_lengthPos = 0, m_moviSizePos = 0, m_moviPos = 0;
+   qint64 m_moviBytes = 0;
+   QVector<quint32> m_offsets, m_sizes;   // For the idx1 index, offsets relative to the 'movi' tag
+};
+
+#endif // MJPEGAVIWRITER_H
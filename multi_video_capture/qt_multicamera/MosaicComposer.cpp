@@ -0,0 +1,38 @@
+#include "MosaicComposer.h"
+#include <cmath>
+
+int MosaicComposer::columnsFor(int count)
+{
+   if (count <= 0) return 1;
+
+   // Calculate the size of the grid required to display evenly
+   float root = std::sqrt((float) count);
+   int gridSizeY = count / (int) root;
+   int gridSizeX = count / gridSizeY;
+   gridSizeX += count % (gridSizeX * gridSizeY);
+   return gridSizeX;
+}
+
+const cv::Mat & MosaicComposer::compose(const std::vector<cv::Mat> & frames, const std::vector<std::string> & labels,
+                                        cv::Size tileSize)
+{
+   int count = (int) frames.size();
+   int columns = columnsFor(count);
+   int rows = (count + columns - 1) / columns;
+   m_canvas.create(std::max(1, rows) * tileSize.height, columns * tileSize.width, CV_8UC3);
+   m_canvas.setTo(cv::Scalar::all(0));
+
+   for (int i = 0; i < count; ++i) {
+      cv::Rect tile((i % columns) * tileSize.width, (i / columns) * tileSize.height, tileSize.width, tileSize.height);
+      cv::Mat target = m_canvas(tile);
+      if (!frames[i].empty() && frames[i].type() == CV_8UC3)
+         cv::resize(frames[i], target, tileSize, 0, 0, cv::INTER_AREA);
+
+      if (i < (int) labels.size() && !labels[i].empty()) {
+         cv::Point origin(tile.x + 6, tile.y + tile.height - 8);
+         cv::putText(m_canvas, labels[i], origin + cv::Point(1, 1), cv::FONT_HERSHEY_SIMPLEX, 0.45, cv::Scalar::all(0), 2);
+         cv::putText(m_canvas, labels[i], origin, cv::FONT_HERSHEY_SIMPLEX, 0.45, cv::Scalar::all(255), 1);
+      }
+   }
+   return m_canvas;
+}
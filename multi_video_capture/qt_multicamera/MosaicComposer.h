@@ -0,0 +1,24 @@
+#ifndef MOSAICCOMPOSER_H
+#define MOSAICCOMPOSER_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Draws several frames into one image laid out like the viewer's grid.
+class MosaicComposer {
+public:
+   // Number of columns the grid uses for count streams.
+   static int columnsFor(int count);
+
+   // Frames go left to right, top to bottom, each scaled to tileSize with its label
+   // drawn in the bottom left corner. Empty frames leave a black tile. The returned
+   // image is reused by the next call.
+   const cv::Mat & compose(const std::vector<cv::Mat> & frames, const std::vector<std::string> & labels,
+                           cv::Size tileSize);
+
+private:
+   cv::Mat m_canvas;
+};
+
+#endif // MOSAICCOMPOSER_H
@@ -0,0 +1,144 @@
+#include "MosaicRecorder.h"
+#include "TraceRecorder.h"
+#include <QDateTime>
+#include <QDir>
+#include <QDebug>
+
+#define MOSAIC_DEFAULT_TILE_WIDTH 320
+
+MosaicRecorder::MosaicRecorder(StorageWriter * storage, const QString & directory, QObject * parent)
+    : QObject(parent), m_storage(storage), m_directory(directory), m_timer(new QTimer(this))
+{
+   m_timer->setTimerType(Qt::PreciseTimer);
+   connect(m_timer, &QTimer::timeout, this, &MosaicRecorder::recordFrame);
+   setFramesPerSecond(DEFAULT_MOSAIC_RECORD_FPS);
+}
+
+void MosaicRecorder::setFramesPerSecond(int framesPerSecond)
+{
+   m_timer->setInterval(1000 / qBound(1, framesPerSecond, 1000));
+}
+
+void MosaicRecorder::setStreams(const QStringList & cameras)
+{
+   m_order = cameras;
+   foreach (const QString & camera, m_latest.keys()) {
+      if (cameras.contains(camera)) continue;
+      if (m_latest[camera].share) m_latest[camera].share->setWanted(false);
+      m_latest.remove(camera);
+   }
+   // The layout changed, so does the picture size, start a new file.
+   if (m_writer) {
+      closeFile();
+      if (!openFile()) m_timer->stop();
+      updateShares();
+   }
+}
+
+void MosaicRecorder::addShare(const QString & camera, const QSharedPointer<FrameShare> & share)
+{
+   Latest & latest = m_latest[camera];
+   if (latest.share) latest.share->setWanted(false);
+   latest.share = share;
+   latest.held.reset(new MemoryBudget::Holding(camera, MemoryBudget::Share));
+   updateShares();
+}
+
+// Frames are only copied while a file is open, at most the tile width wide.
+void MosaicRecorder::updateShares()
+{
+   for (auto it = m_latest.begin(); it != m_latest.end(); ++it) {
+      if (!it->share) continue;
+      it->share->setMaxWidth(m_tileSize.width);
+      it->share->setWanted(m_writer != nullptr);
+      if (!m_writer) {
+         it->frame.release();
+         it->msTimestamp = 0;
+         it->held->set(0);
+      }
+   }
+}
+
+void MosaicRecorder::start()
+{
+   if (m_writer) return;
+   if (!openFile()) return;
+   updateShares();
+   m_timer->start();
+}
+
+void MosaicRecorder::stop()
+{
+   m_timer->stop();
+   closeFile();
+   updateShares();
+}
+
+void MosaicRecorder::closeFile()
+{
+   if (!m_writer) return;
+   qDebug() << "Mosaic recording" << m_writer->fileName() << "has" << m_writer->frameCount() << "frames.";
+   m_writer->close();
+   m_writer.reset();
+}
+
+bool MosaicRecorder::openFile()
+{
+   // The tile size is fixed for the file, a video cannot change size part way.
+   cv::Size tile(MOSAIC_DEFAULT_TILE_WIDTH, MOSAIC_DEFAULT_TILE_WIDTH * 3 / 4);
+   if (m_tileWidth > 0) tile = cv::Size(m_tileWidth, m_tileWidth * 3 / 4);
+   else if (!m_gridTileSize.isEmpty()) tile = cv::Size(m_gridTileSize.width(), m_gridTileSize.height());
+   // Even sizes keep the JPEG's chroma subsampling, and so every decoder, happy.
+   m_tileSize = cv::Size(qMax(16, tile.width & ~1), qMax(16, tile.height & ~1));
+
+   int count = qMax(1, m_order.size());
+   int columns = MosaicComposer::columnsFor(count);
+   int rows = (count + columns - 1) / columns;
+
+   QDir().mkpath(m_directory);
+   QString fileName = m_directory + "/" + MOSAIC_RECORDING_NAME " " + QDateTime::currentDateTime().toString("ddMMyyyy_HHmmss") + ".AVI";
+   m_writer.reset(new MjpegAviWriter(m_storage));
+   if (!m_writer->open(fileName, columns * m_tileSize.width, rows * m_tileSize.height, 1000 / qMax(1, m_timer->interval()))) {
+      qDebug() << "Failed to start mosaic recording" << fileName;
+      m_writer.reset();
+      return false;
+   }
+   qDebug() << "Recording the mosaic to" << fileName;
+   return true;
+}
+
+void MosaicRecorder::recordFrame()
+{
+   if (!m_writer) return;
+   TRACE_SCOPE("mosaic frame");
+   if (m_writer->isFull()) {
+      closeFile();
+      bool opened = openFile();
+      updateShares();
+      if (!opened) {
+         m_timer->stop();
+         return;
+      }
+   }
+
+   std::vector<cv::Mat> frames;
+   std::vector<std::string> labels;
+   foreach (const QString & camera, m_order) {
+      Latest & latest = m_latest[camera];
+      SharedFrame shared;
+      if (latest.share && latest.share->take(shared)) {
+         latest.frame = shared.frame;
+         latest.msTimestamp = shared.msCaptureTime;
+         latest.held->set((qint64) (latest.frame.total() * latest.frame.elemSize()));
+      }
+      frames.push_back(latest.frame);
+      QString label = camera;
+      if (latest.msTimestamp) label += " " + QDateTime::fromMSecsSinceEpoch(latest.msTimestamp).toString("dd/MM/yyyy HH:mm:ss");
+      labels.push_back(label.toStdString());
+   }
+
+   const cv::Mat & mosaic = m_mosaic.compose(frames, labels, m_tileSize);
+   std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, m_quality };
+   if (cv::imencode(".jpg", mosaic, m_encodeBuffer, params))
+      m_writer->writeJpeg(m_encodeBuffer.data(), (int) m_encodeBuffer.size(), QDateTime::currentMSecsSinceEpoch());
+}
@@ -0,0 +1,71 @@
+#ifndef MOSAICRECORDER_H
+#define MOSAICRECORDER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSize>
+#include <QTimer>
+#include <QStringList>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <opencv2/opencv.hpp>
+#include "MosaicComposer.h"
+#include "MjpegAviWriter.h"
+#include "StorageWriter.h"
+#include "FrameShare.h"
+#include "MemoryBudget.h"
+
+#define DEFAULT_MOSAIC_RECORD_FPS 5
+#define DEFAULT_MOSAIC_RECORD_QUALITY 80
+#define MOSAIC_RECORDING_NAME "mosaic"
+
+// Records what the grid shows as one video: at a fixed rate the latest frame of
+// every stream is drawn into its tile, labelled with the camera name and the
+// time of that frame, and the whole image is encoded once. One encoder and one
+// file for an overview archive instead of one per camera. Cameras hand over a
+// frame shrunk to the tile width, one per mosaic frame, and only while recording.
+class MosaicRecorder : public QObject {
+   Q_OBJECT
+public:
+   MosaicRecorder(StorageWriter * storage, const QString & directory, QObject * parent = nullptr);
+
+   void setFramesPerSecond(int framesPerSecond);
+   void setQuality(int quality) { m_quality = qBound(1, quality, 100); }
+   // 0 records the tiles at the size they are on screen.
+   void setTileWidth(int width) { m_tileWidth = qMax(0, width); }
+
+   Q_SLOT void setStreams(const QStringList & cameras);
+   // Where camera's frames come from, a Sample share. Called on the recorder's thread.
+   void addShare(const QString & camera, const QSharedPointer<FrameShare> & share);
+   Q_SLOT void setGridTileSize(const QSize & size) { m_gridTileSize = size; }
+   Q_SLOT void start();
+   Q_SLOT void stop();
+
+private:
+   struct Latest {
+      cv::Mat frame;
+      qint64 msTimestamp = 0;
+      QSharedPointer<FrameShare> share;
+      QSharedPointer<MemoryBudget::Holding> held;   // frame
+   };
+
+   bool openFile();
+   void closeFile();
+   void recordFrame();
+   void updateShares();
+
+   StorageWriter * m_storage;
+   QString m_directory;
+   QTimer * m_timer;
+   int m_quality = DEFAULT_MOSAIC_RECORD_QUALITY;
+   int m_tileWidth = 0;
+   QSize m_gridTileSize;
+   cv::Size m_tileSize;          // Fixed for the length of a file
+   QStringList m_order;
+   QHash<QString, Latest> m_latest;
+   MosaicComposer m_mosaic;
+   std::vector<uchar> m_encodeBuffer;
+   QScopedPointer<MjpegAviWriter> m_writer;
+};
+
+#endif // MOSAICRECORDER_H
@@ -0,0 +1,176 @@
+#include "NetworkSource.h"
+#include "ThreadPlacement.h"
+#include <QDebug>
+#include <QtGlobal>
+#include <QUrl>
+
+#define MS_RECONNECT_INTERVAL 1000
+#define MS_NETWORK_IO_TIMEOUT 5000
+
+// FFmpeg buffers generously by default which is where most of the lag on IP cameras comes from.
+#define FFMPEG_LOW_DELAY_OPTIONS "rtsp_transport;tcp|fflags;nobuffer|flags;low_delay|max_delay;0"
+
+NetworkSource::NetworkSource(const QString & url, int targetLatencyMs, int capacity)
+    : m_url(url), m_name(QUrl(url).toString(QUrl::RemoveUserInfo)),
+      m_msTargetLatency(qMax(0, targetLatencyMs)), m_capacity(qMax(1, capacity))
+{
+   m_clock.start();
+}
+
+NetworkSource::~NetworkSource()
+{
+   requestInterruption();
+   wait();
+   qDebug() << __FUNCTION__ << m_name << "received" << m_stats.received << "delivered" << m_stats.delivered
+            << "late" << m_stats.late << "lost" << m_stats.lost;
+}
+
+bool NetworkSource::isNetworkUrl(const QString & url)
+{
+   return url.startsWith("rtsp://", Qt::CaseInsensitive) || url.startsWith("rtsps://", Qt::CaseInsensitive)
+       || url.startsWith("http://", Qt::CaseInsensitive) || url.startsWith("https://", Qt::CaseInsensitive);
+}
+
+bool NetworkSource::isOpened() const
+{
+   QMutexLocker lock(&m_mutex);
+   return m_opened;
+}
+
+JitterStats NetworkSource::stats() const
+{
+   QMutexLocker lock(&m_mutex);
+   JitterStats stats = m_stats;
+   stats.depth = m_buffer.size();
+   return stats;
+}
+
+bool NetworkSource::takeFrame(cv::Mat & frame, qint64 & msTimestamp, quint64 & sequence, int msTimeout)
+{
+   QElapsedTimer waited;
+   waited.start();
+   QMutexLocker lock(&m_mutex);
+   forever {
+      qint64 now = m_clock.elapsed();
+
+      // Newest frame that has been held for the target latency wins.
+      int due = -1;
+      for (int i = 0; i < m_buffer.size(); ++i) {
+         if (now - m_buffer.at(i).msArrival < m_msTargetLatency) break;
+         due = i;
+      }
+
+      if (due >= 0) {
+         m_stats.late += due;
+         for (int i = 0; i < due; ++i) m_buffer.removeFirst();
+         Entry entry = m_buffer.takeFirst();
+         updateHeld();
+         frame = entry.frame;
+         msTimestamp = entry.msArrival;
+         sequence = entry.sequence;
+         m_stats.delivered++;
+         return true;
+      }
+
+      qint64 msWait = msTimeout - waited.elapsed();
+      if (!m_buffer.isEmpty())
+         msWait = qMin(msWait, m_msTargetLatency - (now - m_buffer.first().msArrival));
+      if (waited.elapsed() >= msTimeout) return false;
+      m_frameArrived.wait(&m_mutex, (unsigned long) qMax<qint64>(1, msWait));
+   }
+}
+
+bool NetworkSource::open(cv::VideoCapture & capture)
+{
+   // OpenCV takes FFmpeg options from the environment only, read as a capture opens. So the low
+   // delay options are set just for the length of this open, unless the user set their own, and
+   // network sources open one at a time. Files and webcams opened meanwhile on other threads
+   // could still see them.
+   static QMutex optionsMutex;
+   QMutexLocker optionsLock(&optionsMutex);
+   bool lowDelay = !qEnvironmentVariableIsSet("OPENCV_FFMPEG_CAPTURE_OPTIONS");
+   if (lowDelay) qputenv("OPENCV_FFMPEG_CAPTURE_OPTIONS", FFMPEG_LOW_DELAY_OPTIONS);
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 6)
+   // Bounded I/O so a dead camera cannot hang the thread (and so shutdown) forever.
+   capture.open(m_url.toStdString(), cv::CAP_FFMPEG,
+                { cv::CAP_PROP_OPEN_TIMEOUT_MSEC, MS_NETWORK_IO_TIMEOUT, cv::CAP_PROP_READ_TIMEOUT_MSEC, MS_NETWORK_IO_TIMEOUT });
+#else
+   capture.open(m_url.toStdString(), cv::CAP_FFMPEG);
+#endif
+   if (!capture.isOpened()) capture.open(m_url.toStdString(), cv::CAP_ANY);
+   if (lowDelay) qunsetenv("OPENCV_FFMPEG_CAPTURE_OPTIONS");
+   optionsLock.unlock();
+   if (!capture.isOpened()) return false;
+
+   capture.set(cv::CAP_PROP_BUFFERSIZE, 1);
+   qDebug() << "Opened network stream" << m_name;
+
+   QMutexLocker lock(&m_mutex);
+   m_opened = true;
+   return true;
+}
+
+void NetworkSource::push(cv::Mat & frame)
+{
+   QMutexLocker lock(&m_mutex);
+   m_stats.received++;
+   // Over the memory budget the buffer shrinks, down to just the newest frame.
+   qint64 bytes = (qint64) (frame.total() * frame.elemSize());
+   while (!m_buffer.isEmpty() && (m_buffer.size() >= m_capacity || !MemoryBudget::fits(bytes))) {
+      m_buffer.removeFirst();
+      m_stats.lost++;
+      updateHeld();
+   }
+   Entry entry;
+   entry.frame = frame;
+   entry.msArrival = m_clock.elapsed();
+   entry.sequence = m_nextSequence++;
+   m_buffer.append(entry);
+   updateHeld();
+   m_frameArrived.wakeAll();
+}
+
+// Called with m_mutex held.
+void NetworkSource::updateHeld()
+{
+   qint64 bytes = 0;
+   foreach (const Entry & entry, m_buffer) bytes += (qint64) (entry.frame.total() * entry.frame.elemSize());
+   m_held.set(bytes);
+}
+
+void NetworkSource::run()
+{
+   ThreadPlacement::enter(ThreadPlacement::Capture, m_name);
+   cv::VideoCapture capture;
+   double msLastPosition = -1;
+   while (!isInterruptionRequested()) {
+      if (!capture.isOpened() && !open(capture)) {
+         msleep(MS_RECONNECT_INTERVAL);
+         continue;
+      }
+
+      // A fresh Mat each time, the previous one may still be in the buffer or in the pipeline.
+      cv::Mat frame;
+      if (!capture.read(frame) || frame.empty()) {
+         qDebug() << "Lost network stream" << m_name << ", reconnecting.";
+         capture.release();
+         msLastPosition = -1;
+         QMutexLocker lock(&m_mutex);
+         m_opened = false;
+         m_stats.lost++;
+         m_stats.reconnects++;
+         continue;
+      }
+      // Backends that know the stream's timestamps report them, a repeat is the same frame sent again.
+      double msPosition = capture.get(cv::CAP_PROP_POS_MSEC);
+      if (m_skipDuplicates && msPosition > 0 && msPosition == msLastPosition) {
+         QMutexLocker lock(&m_mutex);
+         m_stats.received++;
+         m_stats.duplicates++;
+         continue;
+      }
+      msLastPosition = msPosition;
+      push(frame);
+   }
+   ThreadPlacement::leave();
+}
@@ -0,0 +1,74 @@
+#ifndef NETWORKSOURCE_H
+#define NETWORKSOURCE_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QString>
+#include <QList>
+#include <opencv2/opencv.hpp>
+#include "MemoryBudget.h"
+
+#define DEFAULT_NETWORK_LATENCY_MS 0
+#define DEFAULT_NETWORK_JITTER_FRAMES 4
+
+// Counters for a network stream, all since the source was opened.
+struct JitterStats {
+   quint64 received = 0;   // Frames read from the backend
+   quint64 delivered = 0;  // Frames handed on to the pipeline
+   quint64 late = 0;       // Frames skipped because a newer one was already due
+   quint64 lost = 0;       // Frames pushed out of a full buffer, or failed reads
+   quint64 reconnects = 0;
+   quint64 duplicates = 0; // Frames the backend stamped with the same time as the one before
+   int depth = 0;          // Frames currently held in the buffer
+};
+
+// Reads an RTSP/HTTP stream on its own thread as fast as the backend delivers
+// so frames never pile up inside FFmpeg, and holds them in a small bounded
+// jitter buffer. The consumer always gets the newest frame that has been held
+// for the target latency; anything older is skipped rather than played late.
+class NetworkSource : public QThread {
+public:
+   NetworkSource(const QString & url, int targetLatencyMs = DEFAULT_NETWORK_LATENCY_MS,
+                 int capacity = DEFAULT_NETWORK_JITTER_FRAMES);
+   ~NetworkSource();
+
+   static bool isNetworkUrl(const QString & url);
+   // The stream the buffered frames are accounted to in the memory budget, before start().
+   void setBudgetOwner(const QString & owner) { m_held.setOwner(owner, MemoryBudget::Network); }
+   // Drop frames the backend gives the same presentation time as the previous one, before start().
+   void setSkipDuplicates(bool skip) { m_skipDuplicates = skip; }
+
+   bool isOpened() const;
+   // Blocks up to msTimeout for a frame to become due. Returns false on timeout.
+   bool takeFrame(cv::Mat & frame, qint64 & msTimestamp, quint64 & sequence, int msTimeout);
+   JitterStats stats() const;
+
+protected:
+   void run() override;
+
+private:
+   struct Entry { cv::Mat frame; qint64 msArrival; quint64 sequence; };
+
+   bool open(cv::VideoCapture & capture);
+   void push(cv::Mat & frame);
+   void updateHeld();
+
+   QString m_url;
+   QString m_name;             // m_url without user and password, for the thread name and logs
+   int m_msTargetLatency;
+   int m_capacity;
+   QElapsedTimer m_clock;
+
+   mutable QMutex m_mutex;
+   QWaitCondition m_frameArrived;
+   QList<Entry> m_buffer;      // Oldest first
+   MemoryBudget::Holding m_held;
+   quint64 m_nextSequence = 0;
+   bool m_opened = false;
+   bool m_skipDuplicates = true;
+   JitterStats m_stats;
+};
+
+#endif // NETWORKSOURCE_H
@@ -0,0 +1,84 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <opencv2/opencv.hpp>
+#include "NetworkSource.h"
+
+#define CHECK_FRAMES 90
+#define CHECK_FPS 30
+#define MS_TAKE_TIMEOUT 5000
+
+// NetworkSource reads whatever FFmpeg opens, a local file is read as fast as it decodes,
+// which is a camera far faster than any consumer and shows the buffer at its limits.
+class NetworkSourceCheck : public QObject {
+   Q_OBJECT
+   QTemporaryDir m_dir;
+   QString m_file;
+
+private slots:
+   void initTestCase()
+   {
+      QVERIFY(m_dir.isValid());
+      m_file = m_dir.filePath("check.avi");
+      cv::VideoWriter writer(m_file.toStdString(), cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), CHECK_FPS, cv::Size(320, 240));
+      QVERIFY(writer.isOpened());
+      for (int i = 0; i < CHECK_FRAMES; ++i) writer.write(cv::Mat(240, 320, CV_8UC3, cv::Scalar::all(i * 255 / CHECK_FRAMES)));
+   }
+
+   // No frame comes out before it was held for the target latency, and they come out in order.
+   void holdsFramesForTheTargetLatency()
+   {
+      const int msLatency = 200;
+      NetworkSource source(m_file, msLatency, 4);
+      QElapsedTimer clock;
+      clock.start();
+      source.start();
+
+      cv::Mat frame;
+      qint64 msTimestamp = 0, msPrevious = -1;
+      quint64 sequence = 0;
+      QVERIFY(source.takeFrame(frame, msTimestamp, sequence, MS_TAKE_TIMEOUT));
+      QVERIFY(clock.elapsed() >= msLatency);
+      QVERIFY(!frame.empty());
+      for (int i = 0; i < 10; ++i) {
+         quint64 previous = sequence;
+         msPrevious = msTimestamp;
+         QVERIFY(source.takeFrame(frame, msTimestamp, sequence, MS_TAKE_TIMEOUT));
+         QVERIFY(sequence > previous);
+         QVERIFY(msTimestamp >= msPrevious);
+      }
+      QVERIFY(source.stats().depth <= 4);
+   }
+
+   // A consumer slower than the source skips to the newest frames instead of falling behind,
+   // and the buffer never holds more than its capacity.
+   void slowConsumerSkipsFrames()
+   {
+      const int capacity = 2;
+      NetworkSource source(m_file, 0, capacity);
+      source.start();
+
+      cv::Mat frame;
+      qint64 msTimestamp = 0;
+      quint64 sequence = 0, previous = 0;
+      bool skipped = false;
+      for (int i = 0; i < 10; ++i) {
+         QVERIFY(source.takeFrame(frame, msTimestamp, sequence, MS_TAKE_TIMEOUT));
+         if (i > 0) {
+            QVERIFY(sequence > previous);
+            skipped = skipped || sequence > previous + 1;
+         }
+         previous = sequence;
+         QVERIFY(source.stats().depth <= capacity);
+         QThread::msleep(50);
+      }
+
+      JitterStats stats = source.stats();
+      QCOMPARE(stats.delivered, (quint64) 10);
+      QVERIFY(skipped);
+      QVERIFY(stats.lost + stats.late > 0);
+      QVERIFY(stats.received >= stats.delivered + stats.late);
+   }
+};
+
+QTEST_GUILESS_MAIN(NetworkSourceCheck)
+#include "NetworkSourceCheck.moc"
@@ -0,0 +1,31 @@
+# Checks NetworkSource's pacing and frame dropping by feeding it a local video file,
+# which FFmpeg reads the same way it reads a stream. Run with: qmake NetworkSourceCheck.pro && make check
+QT = core gui testlib
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+DEFINES += \
+  QT_DEPRECATED_WARNINGS \
+  QT_DISABLE_DEPRECATED_BEFORE=0x060000 \
+  QT_RESTRICTED_CAST_FROM_ASCII
+TEMPLATE = app
+TARGET = networksourcecheck
+SOURCES = NetworkSourceCheck.cpp \
+    NetworkSource.cpp \
+    MemoryBudget.cpp \
+    ThreadPlacement.cpp \
+    TraceRecorder.cpp
+HEADERS = NetworkSource.h \
+    MemoryBudget.h \
+    ThreadPlacement.h \
+    TraceRecorder.h \
+    QtCompat.h
+
+linux {
+INCLUDEPATH += /usr/local/include/opencv4
+LIBS += -lopencv_core -lopencv_imgproc -lopencv_videoio
+}
+
+macx {
+  INCLUDEPATH += /opt/local/include
+  LIBS += -L /opt/local/lib -lopencv_core -lopencv_imgproc -lopencv_videoio
+}
@@ -0,0 +1,39 @@
+#ifndef NODEPROTOCOL_H
+#define NODEPROTOCOL_H
+
+#include <QtGlobal>
+
+// Cluster mode: a capture node (any instance with http_port set) streams a
+// camera's preview to a viewer over TCP. The viewer sends
+//    GET /node/<camera>?w=<width>&q=<quality> HTTP/1.0\r\n\r\n
+// and after an HTTP/1.0 200 header gets frames, each a NodeFrameHeader followed
+// by jpegSize bytes of JPEG and statsSize bytes of UTF-8 source stats, all in
+// host (little endian) byte order. The viewer may send text commands, one per
+// line, at any time after that. Recording and snapshots happen on the node at
+// full resolution; the viewer only asks for them.
+#define NODE_FRAME_MAGIC 0x464d4351u   // "QMCF"
+#define NODE_CONTENT_TYPE "application/x-qmc-node"
+#define NODE_URL_SCHEME "node"
+#define NODE_FLAG_RECORDING 0x1u       // The node is recording this camera
+
+#define NODE_COMMAND_RECORD "record"
+#define NODE_COMMAND_STOP "stop"
+#define NODE_COMMAND_SNAPSHOT "snapshot"
+#define NODE_COMMAND_WIDTH "width"     // "width <pixels>", 0 sends frames as captured
+
+struct NodeFrameHeader {
+   quint32 magic;
+   quint32 headerSize;         // sizeof(NodeFrameHeader), the payload starts after headerSize bytes
+   quint32 jpegSize;
+   quint32 statsSize;
+   quint32 width, height;      // Of the JPEG
+   quint32 fullWidth, fullHeight; // Of the frame as captured, and as recorded on the node
+   quint32 flags;
+   quint32 skipped;            // Frames the node skipped for this viewer so far, it was not keeping up
+   quint64 sequence;           // Of the camera on the node, gaps are frames this viewer did not get
+   qint64 msTimestamp;         // When the node had the frame, milliseconds since the epoch
+};
+
+static_assert(sizeof(NodeFrameHeader) == 56, "NodeFrameHeader layout is part of the protocol");
+
+#endif // NODEPROTOCOL_H
@@ -0,0 +1,177 @@
+#include "NodeSource.h"
+#include "ThreadPlacement.h"
+#include <QTcpSocket>
+#include <QUrlQuery>
+#include <QDebug>
+#include <cstring>
+
+#define MS_RECONNECT_INTERVAL 1000
+#define MS_NODE_IO_TIMEOUT 5000
+// Nodes send nothing while their camera repeats a frame, only a silence this long is a dead connection.
+#define MS_NODE_IDLE_TIMEOUT 30000
+// Short so commands and width changes go out promptly and interruption is noticed.
+#define MS_NODE_POLL_INTERVAL 100
+#define DEFAULT_NODE_PORT 8080
+// Anything bigger is not a frame of ours, the connection is dropped.
+#define MAX_NODE_FRAME_BYTES (64 * 1024 * 1024)
+
+NodeSource::NodeSource(const QString & url) : m_url(url)
+{
+   m_camera = m_url.path().mid(1);
+   // For the log, which the token has no business in.
+   m_name = m_url.toString(QUrl::RemoveQuery);
+   m_fixedWidth = QUrlQuery(m_url).hasQueryItem("w");
+}
+
+NodeSource::~NodeSource()
+{
+   requestInterruption();
+   wait();
+   qDebug() << __FUNCTION__ << m_name << "received" << m_stats.received << "late" << m_stats.late
+            << "missed" << m_stats.missed << "reconnects" << m_stats.reconnects;
+}
+
+bool NodeSource::isNodeUrl(const QString & url)
+{
+   return url.startsWith(NODE_URL_SCHEME "://", Qt::CaseInsensitive);
+}
+
+NodeStats NodeSource::stats() const
+{
+   QMutexLocker lock(&m_mutex);
+   return m_stats;
+}
+
+bool NodeSource::takeFrame(NodeFrame & frame, int msTimeout)
+{
+   QMutexLocker lock(&m_mutex);
+   if (!m_haveFrame) m_frameArrived.wait(&m_mutex, (unsigned long) qMax(1, msTimeout));
+   if (!m_haveFrame) return false;
+   frame = m_frame;
+   m_frame = NodeFrame();
+   m_haveFrame = false;
+   return true;
+}
+
+void NodeSource::sendCommand(const QByteArray & command)
+{
+   QMutexLocker lock(&m_mutex);
+   m_commands.append(command);
+}
+
+void NodeSource::setPreviewWidth(int width)
+{
+   QMutexLocker lock(&m_mutex);
+   m_previewWidth = qMax(0, width);
+}
+
+// Takes every complete frame off the front of buffer, false if the stream is not ours.
+bool NodeSource::readFrames(QByteArray & buffer)
+{
+   while (buffer.size() >= (int) sizeof(NodeFrameHeader)) {
+      NodeFrameHeader header;
+      memcpy(&header, buffer.constData(), sizeof(header));
+      qint64 total = (qint64) header.headerSize + header.jpegSize + header.statsSize;
+      if (header.magic != NODE_FRAME_MAGIC || header.headerSize < sizeof(header) || total > MAX_NODE_FRAME_BYTES) {
+         qWarning() << "Bad frame from node" << m_name << ", reconnecting.";
+         return false;
+      }
+      if (buffer.size() < total) return true;
+
+      NodeFrame frame;
+      frame.header = header;
+      frame.jpeg = buffer.mid(header.headerSize, header.jpegSize);
+      frame.stats = QString::fromUtf8(buffer.constData() + header.headerSize + header.jpegSize, header.statsSize);
+      buffer.remove(0, (int) total);
+
+      QMutexLocker lock(&m_mutex);
+      m_stats.received++;
+      if (m_lastSequence && header.sequence > m_lastSequence + 1) m_stats.missed += header.sequence - m_lastSequence - 1;
+      m_lastSequence = header.sequence;
+      if (m_haveFrame) m_stats.late++;
+      m_frame = frame;
+      m_haveFrame = true;
+      m_frameArrived.wakeAll();
+   }
+   return true;
+}
+
+void NodeSource::run()
+{
+   ThreadPlacement::enter(ThreadPlacement::Capture, m_name);
+   // Created here so it belongs to this thread, it is only ever used blocking.
+   QTcpSocket socket;
+   while (!isInterruptionRequested()) {
+      socket.connectToHost(m_url.host(), (quint16) m_url.port(DEFAULT_NODE_PORT));
+      if (!socket.waitForConnected(MS_NODE_IO_TIMEOUT)) {
+         socket.abort();
+         msleep(MS_RECONNECT_INTERVAL);
+         continue;
+      }
+
+      int width;
+      {
+         QMutexLocker lock(&m_mutex);
+         width = m_previewWidth;
+      }
+      QUrlQuery query(m_url);
+      if (!m_fixedWidth && width > 0) query.addQueryItem("w", QString::number(width));
+      QByteArray path = "/node/" + QUrl::toPercentEncoding(m_camera);
+      if (!query.isEmpty()) path += "?" + query.toString(QUrl::FullyEncoded).toLatin1();
+      socket.write("GET " + path + " HTTP/1.0\r\n\r\n");
+
+      QByteArray buffer;
+      bool subscribed = false;
+      QElapsedTimer quiet;
+      quiet.start();
+      while (!isInterruptionRequested() && socket.state() == QAbstractSocket::ConnectedState) {
+         QByteArrayList commands;
+         int previewWidth;
+         {
+            QMutexLocker lock(&m_mutex);
+            if (subscribed) commands.swap(m_commands);
+            previewWidth = m_previewWidth;
+         }
+         if (subscribed && !m_fixedWidth && previewWidth != width) {
+            width = previewWidth;
+            commands.append(NODE_COMMAND_WIDTH " " + QByteArray::number(width));
+         }
+         foreach (const QByteArray & command, commands) socket.write(command + "\n");
+         if (!commands.isEmpty()) socket.flush();
+
+         if (!socket.waitForReadyRead(MS_NODE_POLL_INTERVAL)) {
+            if (quiet.elapsed() > (subscribed ? MS_NODE_IDLE_TIMEOUT : MS_NODE_IO_TIMEOUT)) break;
+            continue;
+         }
+         quiet.restart();
+         buffer += socket.readAll();
+         if (!subscribed) {
+            int end = buffer.indexOf("\r\n\r\n");
+            if (end < 0) continue;
+            QByteArray statusLine = buffer.left(buffer.indexOf("\r\n"));
+            if (!statusLine.contains(" 200 ")) {
+               qWarning() << "Node" << m_name << "refused the stream:" << statusLine;
+               break;
+            }
+            buffer.remove(0, end + 4);
+            subscribed = true;
+            qDebug() << "Subscribed to node" << m_name;
+            QMutexLocker lock(&m_mutex);
+            m_stats.connected = true;
+         }
+         if (!readFrames(buffer)) break;
+      }
+
+      socket.abort();
+      if (isInterruptionRequested()) break;
+      qDebug() << "Lost node" << m_name << ", reconnecting.";
+      {
+         QMutexLocker lock(&m_mutex);
+         m_stats.connected = false;
+         m_stats.reconnects++;
+         m_lastSequence = 0;
+      }
+      msleep(MS_RECONNECT_INTERVAL);
+   }
+   ThreadPlacement::leave();
+}
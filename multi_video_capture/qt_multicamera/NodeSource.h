@@ -0,0 +1,68 @@
+#ifndef NODESOURCE_H
+#define NODESOURCE_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QByteArrayList>
+#include <QString>
+#include <QUrl>
+#include <QElapsedTimer>
+#include "NodeProtocol.h"
+
+// Counters for a node stream, all since the source was created.
+struct NodeStats {
+   quint64 received = 0;   // Frames read from the node
+   quint64 late = 0;       // Frames replaced by a newer one before they were taken
+   quint64 missed = 0;     // Frames the node had but did not send, from gaps in its sequence
+   quint64 reconnects = 0;
+   bool connected = false;
+};
+
+struct NodeFrame {
+   NodeFrameHeader header;
+   QByteArray jpeg;
+   QString stats;          // The node's source stats for the camera
+};
+
+// A camera of another instance, node://<host>:<port>/<camera>?token=<token>[&w=<width>&q=<quality>],
+// read on its own thread from the node's preview server (see NodeProtocol.h).
+// The token is the node's http_token, which it requires before serving frames or taking commands.
+// Only the newest frame is held; the node already skips frames for a viewer that
+// falls behind. Without w the frames follow setPreviewWidth(), i.e. the tile.
+class NodeSource : public QThread {
+public:
+   explicit NodeSource(const QString & url);
+   ~NodeSource();
+
+   static bool isNodeUrl(const QString & url);
+
+   // Blocks up to msTimeout for a frame. Returns false on timeout.
+   bool takeFrame(NodeFrame & frame, int msTimeout);
+   // Queues a command for the node (NODE_COMMAND_RECORD, ...), sent as soon as connected.
+   void sendCommand(const QByteArray & command);
+   void setPreviewWidth(int width);
+   NodeStats stats() const;
+
+protected:
+   void run() override;
+
+private:
+   bool readFrames(QByteArray & buffer);
+
+   QUrl m_url;
+   QString m_name;
+   QString m_camera;
+   bool m_fixedWidth = false;   // Asked for in the URL, tile sizes are then ignored
+
+   mutable QMutex m_mutex;      // Guards everything below
+   QWaitCondition m_frameArrived;
+   NodeFrame m_frame;
+   bool m_haveFrame = false;
+   QByteArrayList m_commands;
+   int m_previewWidth = 0;
+   quint64 m_lastSequence = 0;
+   NodeStats m_stats;
+};
+
+#endif // NODESOURCE_H
@@ -0,0 +1,100 @@
+#include "OverlayLayers.h"
+#include "QtCompat.h"
+#include <QPainter>
+#include <QFontMetrics>
+
+// Gap between the text and the edge of the tile.
+#define OVERLAY_MARGIN 10
+
+OverlayLayers::OverlayLayers(const QFont & font) : m_font(font)
+{
+   QFontMetrics metrics(m_font);
+   m_lineHeight = metrics.height() + 1;
+   m_ascent = metrics.ascent();
+}
+
+void OverlayLayers::setLayer(int id, Anchor anchor, int line, const QColor & color)
+{
+   Layer & layer = m_layers[id];
+   layer.anchor = anchor;
+   layer.line = line;
+   layer.color = color;
+   render(layer);
+   m_composed = false;
+}
+
+void OverlayLayers::setText(int id, const QString & text)
+{
+   Layer & layer = m_layers[id];
+   if (layer.text == text) return;
+   layer.text = text;
+   render(layer);
+   m_composed = false;
+}
+
+void OverlayLayers::setSize(const QSize & size, qreal devicePixelRatio)
+{
+   if (size == m_size && devicePixelRatio == m_devicePixelRatio) return;
+   bool rerender = devicePixelRatio != m_devicePixelRatio;
+   m_size = size;
+   m_devicePixelRatio = devicePixelRatio;
+   if (rerender) for (Layer & layer : m_layers) render(layer);
+   m_composed = false;
+}
+
+void OverlayLayers::render(Layer & layer)
+{
+   if (layer.text.isEmpty()) {
+      layer.pixmap = QPixmap();
+      return;
+   }
+   QFontMetrics metrics(m_font);
+   QSize size(textAdvance(metrics, layer.text) + 1, m_lineHeight);
+   layer.pixmap = QPixmap(size * m_devicePixelRatio);
+   layer.pixmap.setDevicePixelRatio(m_devicePixelRatio);
+   layer.pixmap.fill(Qt::transparent);
+   QPainter painter(&layer.pixmap);
+   painter.setFont(m_font);
+   painter.setPen(layer.color);
+   painter.drawText(0, m_ascent, layer.text);
+}
+
+QPoint OverlayLayers::position(const Layer & layer) const
+{
+   // Text baselines sit where the tiles always drew them, line * line height from the edge.
+   int width = layer.pixmap.isNull() ? 0 : qRound(layer.pixmap.width() / m_devicePixelRatio);
+   switch (layer.anchor) {
+   case TopRight: return QPoint(m_size.width() - OVERLAY_MARGIN - width, m_lineHeight * layer.line - m_ascent);
+   case BottomLeft: return QPoint(OVERLAY_MARGIN, m_size.height() - m_lineHeight * layer.line - m_ascent);
+   case TopLeft: break;
+   }
+   return QPoint(OVERLAY_MARGIN, m_lineHeight * layer.line - m_ascent);
+}
+
+void OverlayLayers::compose()
+{
+   m_composed = true;
+   m_compositeRect = QRect();
+   for (const Layer & layer : m_layers) {
+      if (layer.pixmap.isNull()) continue;
+      m_compositeRect |= QRect(position(layer), layer.pixmap.size() / m_devicePixelRatio);
+   }
+   m_compositeRect &= QRect(QPoint(0, 0), m_size);
+   if (m_compositeRect.isEmpty()) {
+      m_composite = QPixmap();
+      return;
+   }
+   // Only the box around the layers, most of the tile has no overlay.
+   m_composite = QPixmap(m_compositeRect.size() * m_devicePixelRatio);
+   m_composite.setDevicePixelRatio(m_devicePixelRatio);
+   m_composite.fill(Qt::transparent);
+   QPainter painter(&m_composite);
+   for (const Layer & layer : m_layers)
+      if (!layer.pixmap.isNull()) painter.drawPixmap(position(layer) - m_compositeRect.topLeft(), layer.pixmap);
+}
+
+void OverlayLayers::paint(QPainter & painter)
+{
+   if (!m_composed) compose();
+   if (!m_composite.isNull()) painter.drawPixmap(m_compositeRect.topLeft(), m_composite);
+}
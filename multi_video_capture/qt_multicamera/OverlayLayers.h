@@ -0,0 +1,55 @@
+#ifndef OVERLAYLAYERS_H
+#define OVERLAYLAYERS_H
+
+#include <QFont>
+#include <QColor>
+#include <QPixmap>
+#include <QString>
+#include <QMap>
+#include <QRect>
+
+class QPainter;
+
+// Text drawn over a tile (camera name, frame rate, recording, ...). Each layer
+// is rendered once into a transparent pixmap of its own and only again when its
+// text changes; the visible layers are then combined into one pixmap, so each
+// paint of the tile costs a single blit however many overlays there are.
+class OverlayLayers {
+public:
+   enum Anchor { TopLeft, TopRight, BottomLeft };
+
+   explicit OverlayLayers(const QFont & font = QFont());
+
+   // line counts down from the top, or up from the bottom for BottomLeft, starting at 1.
+   void setLayer(int id, Anchor anchor, int line, const QColor & color = Qt::white);
+   // Only re-rendered when the text is different, empty hides the layer.
+   void setText(int id, const QString & text);
+   void setSize(const QSize & size, qreal devicePixelRatio = 1);
+
+   void paint(QPainter & painter);
+
+private:
+   struct Layer {
+      Anchor anchor = TopLeft;
+      int line = 1;
+      QColor color = Qt::white;
+      QString text;
+      QPixmap pixmap;
+   };
+
+   void render(Layer & layer);
+   QPoint position(const Layer & layer) const;
+   void compose();
+
+   QFont m_font;
+   int m_lineHeight;
+   int m_ascent;
+   QSize m_size;
+   qreal m_devicePixelRatio = 1;
+   QMap<int, Layer> m_layers;
+   QPixmap m_composite;
+   QRect m_compositeRect;       // Where m_composite goes on the tile
+   bool m_composed = false;
+};
+
+#endif // OVERLAYLAYERS_H
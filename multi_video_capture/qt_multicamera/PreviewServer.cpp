@@ -0,0 +1,448 @@
+#include "PreviewServer.h"
+#include "QtCompat.h"
+#include <QHostAddress>
+#include <QUrl>
+#include <QUrlQuery>
+#include <QDebug>
+
+#define MOSAIC_STREAM "*mosaic*"
+#define MULTIPART_BOUNDARY "qtmulticameraframe"
+#define MAX_REQUEST_BYTES 8192
+#define MAX_PREVIEW_WIDTH 8192
+// A client with more than this still queued is too slow for the next frame, it gets a later one.
+#define SLOW_CLIENT_BACKLOG_BYTES (512 * 1024)
+// A still keeps its camera's frames coming this long, the index page asks for one every second.
+#define MS_STILL_INTEREST 3000
+// How long a still waits for a fresh frame before it gets what there is.
+#define MS_STILL_WAIT 1000
+
+PreviewServer::PreviewServer(QObject * parent) : QTcpServer(parent), m_mosaicTimer(new QTimer(this))
+{
+   connect(m_mosaicTimer, &QTimer::timeout, this, &PreviewServer::composeMosaic);
+   setMosaic(DEFAULT_HTTP_MOSAIC_FPS, DEFAULT_HTTP_MOSAIC_TILE_WIDTH);
+   m_clock.start();
+}
+
+PreviewServer::~PreviewServer()
+{
+   close();
+   qDeleteAll(m_clients.keys());
+}
+
+void PreviewServer::setMosaic(int framesPerSecond, int tileWidth)
+{
+   m_mosaicTimer->setInterval(1000 / qMax(1, framesPerSecond));
+   m_mosaicTileWidth = qBound(16, tileWidth, MAX_PREVIEW_WIDTH);
+}
+
+void PreviewServer::listenOn(const QString & address, int port)
+{
+   QHostAddress host = address.isEmpty() ? QHostAddress(QHostAddress::LocalHost) : QHostAddress(address);
+   if (listen(host, (quint16) port)) qDebug() << "Preview server listening on" << host.toString() << port;
+   else qDebug() << "Preview server failed to listen on" << host.toString() << port << errorString();
+}
+
+void PreviewServer::setStreams(const QStringList & cameras)
+{
+   m_order = cameras;
+   foreach (const QString & camera, m_streams.keys()) {
+      if (camera == MOSAIC_STREAM || cameras.contains(camera)) continue;
+      if (m_streams[camera].share) m_streams[camera].share->setWanted(false);
+      m_streams.remove(camera);
+   }
+
+   for (auto it = m_clients.begin(); it != m_clients.end(); ++it)
+      if ((it->streaming || it->waitingStill) && it->stream != MOSAIC_STREAM && !cameras.contains(it->stream)) it.key()->disconnectFromHost();
+   updateWanted();
+}
+
+void PreviewServer::addShare(const QString & camera, const QSharedPointer<FrameShare> & share)
+{
+   Stream & stream = m_streams[camera];
+   if (stream.share) stream.share->setWanted(false);
+   stream.share = share;
+   stream.held.reset(new MemoryBudget::Holding(camera, MemoryBudget::Share));
+   connect(share.data(), &FrameShare::offered, this, [this, camera]() { frameOffered(camera); });
+   updateWanted();
+}
+
+// Copies are asked of a camera only while a client can use them.
+void PreviewServer::updateWanted()
+{
+   qint64 now = m_clock.elapsed(), nextExpiry = 0;
+   bool mosaic = mosaicWanted() || m_streams.value(MOSAIC_STREAM).msStillWanted > now;
+   for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+      if (!it->share) continue;
+      bool wanted = mosaic || it->msStillWanted > now;
+      for (auto client = m_clients.constBegin(); !wanted && client != m_clients.constEnd(); ++client)
+         wanted = client->streaming && client->stream == it.key();
+      it->share->setWanted(wanted);
+      if (it->msStillWanted > now && (!nextExpiry || it->msStillWanted < nextExpiry)) nextExpiry = it->msStillWanted;
+      if (!wanted) {
+         // Stale as soon as nobody looks, a later still waits for a fresh frame anyway.
+         it->frame.release();
+         it->encoded.clear();
+         it->held->set(0);
+      }
+   }
+   if (m_streams.value(MOSAIC_STREAM).msStillWanted > now) {
+      qint64 expiry = m_streams.value(MOSAIC_STREAM).msStillWanted;
+      if (!nextExpiry || expiry < nextExpiry) nextExpiry = expiry;
+   }
+   if (nextExpiry) QTimer::singleShot((int) (nextExpiry - now + 1), this, SLOT(updateWanted()));
+}
+
+void PreviewServer::frameOffered(const QString & camera)
+{
+   auto it = m_streams.find(camera);
+   if (it == m_streams.end() || !it->share || !m_order.contains(camera)) return;
+   SharedFrame shared;
+   if (!it->share->take(shared)) return;
+   Stream & stream = it.value();
+   stream.frame = shared.frame;
+   stream.fullSize = shared.fullSize;
+   stream.sequence++;
+   stream.msTimestamp = shared.msCaptureTime;
+   stream.held->set((qint64) (stream.frame.total() * stream.frame.elemSize()));
+   deliver(camera);
+
+   // Answering closes the connection, which may take the client out of m_clients straight away.
+   QList<QTcpSocket *> answered;
+   for (auto client = m_clients.constBegin(); client != m_clients.constEnd(); ++client)
+      if (client->waitingStill && client->stream == camera && stream.sequence > client->stillAfter) answered.append(client.key());
+   foreach (QTcpSocket * socket, answered)
+      if (m_clients.contains(socket)) sendStill(socket, m_clients[socket]);
+}
+
+void PreviewServer::setSourceStats(const QString & camera, const QString & stats)
+{
+   if (m_order.contains(camera)) m_streams[camera].stats = stats.toUtf8();
+}
+
+void PreviewServer::setRecording(const QString & camera, bool recording)
+{
+   if (m_order.contains(camera)) m_streams[camera].recording = recording;
+}
+
+const PreviewServer::Encoded & PreviewServer::encode(Stream & stream, const Variant & variant)
+{
+   Encoded & encoded = stream.encoded[variant];
+   if (encoded.sequence == stream.sequence || stream.frame.empty()) return encoded;
+
+   const cv::Mat * source = &stream.frame;
+   int width = variant.first;
+   if (width > 0 && width < stream.frame.cols) {
+      int height = qMax(1, stream.frame.rows * width / stream.frame.cols);
+      cv::resize(stream.frame, m_scaled, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+      source = &m_scaled;
+   }
+   std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, variant.second };
+   if (cv::imencode(".jpg", *source, m_encodeBuffer, params)) {
+      encoded.jpeg = QByteArray((const char *) m_encodeBuffer.data(), (int) m_encodeBuffer.size());
+      encoded.sequence = stream.sequence;
+      encoded.width = source->cols;
+      encoded.height = source->rows;
+   }
+   return encoded;
+}
+
+void PreviewServer::deliver(const QString & camera)
+{
+   Stream & stream = m_streams[camera];
+   for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
+      Client & client = it.value();
+      if (!client.streaming || client.stream != camera) continue;
+
+      QTcpSocket * socket = it.key();
+      if (socket->bytesToWrite() > SLOW_CLIENT_BACKLOG_BYTES) {
+         client.skipped++;
+         continue;
+      }
+      // Shared, not copied, between every client watching this variant.
+      const Encoded & encoded = encode(stream, client.variant);
+      if (encoded.jpeg.isEmpty()) continue;
+      if (client.node) {
+         sendNodeFrame(socket, client, stream, encoded);
+         client.sent++;
+         continue;
+      }
+      socket->write("--" MULTIPART_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: "
+                    + QByteArray::number(encoded.jpeg.size()) + "\r\n\r\n");
+      socket->write(encoded.jpeg);
+      socket->write("\r\n");
+      client.sent++;
+   }
+}
+
+void PreviewServer::composeMosaic()
+{
+   std::vector<cv::Mat> frames;
+   std::vector<std::string> labels;
+   cv::Size tileSize(m_mosaicTileWidth, m_mosaicTileWidth * 3 / 4);
+   bool haveAspect = false;
+   foreach (const QString & camera, m_order) {
+      auto it = m_streams.constFind(camera);
+      cv::Mat frame = (it != m_streams.constEnd()) ? it->frame : cv::Mat();
+      if (!haveAspect && !frame.empty()) {
+         tileSize.height = qMax(1, m_mosaicTileWidth * frame.rows / frame.cols);
+         haveAspect = true;
+      }
+      frames.push_back(frame);
+      labels.push_back(camera.toStdString());
+   }
+
+   Stream & mosaic = m_streams[MOSAIC_STREAM];
+   mosaic.frame = m_mosaic.compose(frames, labels, tileSize);
+   mosaic.sequence++;
+   deliver(MOSAIC_STREAM);
+}
+
+bool PreviewServer::mosaicWanted() const
+{
+   for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it)
+      if (it->streaming && it->stream == MOSAIC_STREAM) return true;
+   return false;
+}
+
+void PreviewServer::incomingConnection(qintptr socketDescriptor)
+{
+   QTcpSocket * socket = new QTcpSocket(this);
+   if (!socket->setSocketDescriptor(socketDescriptor)) {
+      delete socket;
+      return;
+   }
+   m_clients.insert(socket, Client());
+   connect(socket, &QTcpSocket::readyRead, this, &PreviewServer::readRequest);
+   connect(socket, &QTcpSocket::disconnected, this, &PreviewServer::clientGone);
+}
+
+void PreviewServer::readRequest()
+{
+   QTcpSocket * socket = qobject_cast<QTcpSocket *>(sender());
+   if (!socket || !m_clients.contains(socket)) return;
+   Client & client = m_clients[socket];
+   if (client.waitingStill) {
+      socket->readAll();
+      return;
+   }
+   if (client.streaming) {
+      if (client.node) {
+         client.request += socket->readAll();
+         handleCommands(socket, client);
+      } else {
+         socket->readAll(); // Nothing more is expected from a streaming client.
+      }
+      return;
+   }
+
+   client.request += socket->readAll();
+   if (client.request.size() > MAX_REQUEST_BYTES) sendError(socket, 400, "Bad Request");
+   else if (client.request.contains("\r\n\r\n")) handleRequest(socket, client);
+}
+
+void PreviewServer::clientGone()
+{
+   QTcpSocket * socket = qobject_cast<QTcpSocket *>(sender());
+   if (!socket) return;
+   Client client = m_clients.take(socket);
+   if (client.streaming)
+      qDebug() << "Preview client left" << client.stream << "sent" << client.sent << "skipped" << client.skipped;
+   socket->deleteLater();
+   if (!mosaicWanted()) m_mosaicTimer->stop();
+   if (client.streaming) updateWanted();
+}
+
+void PreviewServer::handleRequest(QTcpSocket * socket, Client & client)
+{
+   QList<QByteArray> requestLine = client.request.left(client.request.indexOf("\r\n")).split(' ');
+   if (requestLine.size() < 2 || requestLine.at(0) != "GET") {
+      sendError(socket, 405, "Method Not Allowed");
+      return;
+   }
+
+   QUrl url(QString::fromLatin1(requestLine.at(1)));
+   QUrlQuery query(url);
+   QString path = url.path();
+   bool ok;
+   int width = query.queryItemValue("w").toInt(&ok);
+   if (!ok) width = 0;
+   int quality = query.queryItemValue("q").toInt(&ok);
+   if (!ok) quality = m_quality;
+   Variant variant(qBound(0, width, MAX_PREVIEW_WIDTH), qBound(1, quality, 100));
+
+   if (path == "/" || path == "/index.html") {
+      sendIndex(socket);
+      return;
+   }
+
+   if ((path == "/node" || path.startsWith("/node/")) && !authorized(query)) {
+      qWarning() << "Refused viewer" << socket->peerAddress().toString() << (m_token.isEmpty() ? ", no http_token is set." : ", wrong token.");
+      sendError(socket, 403, "Forbidden");
+      return;
+   }
+   if (path == "/node" || path == "/node/") {
+      sendCameraList(socket);
+      return;
+   }
+
+   QString camera;
+   bool streaming = false;
+   bool node = false;
+   if (path.startsWith("/node/")) {
+      camera = path.mid(6);
+      streaming = node = true;
+   } else if (path == "/mosaic.mjpg" || path == "/mosaic.jpg") {
+      camera = MOSAIC_STREAM;
+      streaming = path.endsWith(".mjpg");
+   } else if (path.startsWith("/stream/") && path.endsWith(".mjpg")) {
+      camera = path.mid(8, path.size() - 8 - 5);
+      streaming = true;
+   } else if (path.startsWith("/still/") && path.endsWith(".jpg")) {
+      camera = path.mid(7, path.size() - 7 - 4);
+   }
+   if (camera.isEmpty() || (camera != MOSAIC_STREAM && !m_order.contains(camera))) {
+      sendError(socket, 404, "Not Found");
+      return;
+   }
+
+   if (node) {
+      socket->write("HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nConnection: close\r\nContent-Type: " NODE_CONTENT_TYPE "\r\n\r\n");
+      qDebug() << "Viewer" << socket->peerAddress().toString() << "subscribed to" << camera;
+   } else if (streaming) {
+      socket->write("HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nConnection: close\r\n"
+                    "Content-Type: multipart/x-mixed-replace; boundary=" MULTIPART_BOUNDARY "\r\n\r\n");
+   }
+   if (streaming) {
+      client.streaming = true;
+      client.node = node;
+      client.stream = camera;
+      client.variant = variant;
+      client.request.clear();
+      if (camera == MOSAIC_STREAM && !m_mosaicTimer->isActive()) m_mosaicTimer->start();
+      updateWanted();
+      return;
+   }
+
+   // A still is answered at once while frames are coming anyway, otherwise the camera (or every
+   // camera, for the mosaic) is asked for them and the still waits for a fresh one.
+   Stream & stream = m_streams[camera];
+   qint64 now = m_clock.elapsed();
+   bool flowing = camera == MOSAIC_STREAM ? (m_mosaicTimer->isActive() || stream.msStillWanted > now)
+                                          : (stream.share && stream.share->wanted() && !stream.frame.empty());
+   stream.msStillWanted = now + MS_STILL_INTEREST;
+   client.stream = camera;
+   client.variant = variant;
+   client.request.clear();
+   if (flowing) {
+      sendStill(socket, client);
+      return;
+   }
+   client.waitingStill = true;
+   client.stillAfter = stream.sequence;
+   updateWanted();
+   QTimer::singleShot(MS_STILL_WAIT, socket, [this, socket]() {
+      auto it = m_clients.find(socket);
+      if (it != m_clients.end() && it->waitingStill) sendStill(socket, it.value());
+   });
+}
+
+void PreviewServer::sendStill(QTcpSocket * socket, Client & client)
+{
+   client.waitingStill = false;
+   if (client.stream == MOSAIC_STREAM && !m_mosaicTimer->isActive()) composeMosaic();
+   const Encoded & encoded = encode(m_streams[client.stream], client.variant);
+   if (encoded.jpeg.isEmpty()) {
+      sendError(socket, 503, "No Frame Yet");
+      return;
+   }
+   socket->write("HTTP/1.0 200 OK\r\nContent-Type: image/jpeg\r\nCache-Control: no-cache\r\nConnection: close\r\n"
+                 "Content-Length: " + QByteArray::number(encoded.jpeg.size()) + "\r\n\r\n");
+   socket->write(encoded.jpeg);
+   socket->disconnectFromHost();
+}
+
+bool PreviewServer::authorized(const QUrlQuery & query) const
+{
+   if (m_token.isEmpty()) return false;
+   // Compared in full whatever differs, so the time taken does not give the token away.
+   QByteArray given = query.queryItemValue("token", QUrl::FullyDecoded).toUtf8(), expected = m_token.toUtf8();
+   int differences = given.size() ^ expected.size();
+   for (int i = 0; i < expected.size(); ++i) differences |= expected.at(i) ^ (i < given.size() ? given.at(i) : 0);
+   return differences == 0;
+}
+
+void PreviewServer::sendIndex(QTcpSocket * socket)
+{
+   QByteArray html = "<html><head><title>Multiple Video Streaming Viewer</title></head><body>\n"
+                     "<h3>Multiple Video Streaming Viewer</h3>\n"
+                     "<p><a href=\"/mosaic.mjpg\">mosaic</a> (<a href=\"/mosaic.jpg\">still</a>)</p>\n";
+   foreach (const QString & camera, m_order) {
+      QByteArray name = camera.toHtmlEscaped().toUtf8();
+      QByteArray path = QUrl::toPercentEncoding(camera);
+      html += "<div style=\"display:inline-block;margin:4px\"><img class=\"still\" width=\"320\" src=\"/still/" + path
+            + ".jpg?w=320\"><br>" + name + " <a href=\"/stream/" + path + ".mjpg\">live</a></div>\n";
+   }
+   // Stills refresh once a second, for browsers (or links) where a live stream is too much.
+   html += "<script>setInterval(function(){var s=document.getElementsByClassName('still');"
+           "for(var i=0;i<s.length;i++)s[i].src=s[i].src.split('&t=')[0]+'&t='+Date.now();},1000);</script>\n"
+           "</body></html>\n";
+   socket->write("HTTP/1.0 200 OK\r\nContent-Type: text/html; charset=utf-8\r\nConnection: close\r\n"
+                 "Content-Length: " + QByteArray::number(html.size()) + "\r\n\r\n");
+   socket->write(html);
+   socket->disconnectFromHost();
+}
+
+void PreviewServer::sendError(QTcpSocket * socket, int code, const QByteArray & reason)
+{
+   QByteArray body = QByteArray::number(code) + " " + reason + "\n";
+   socket->write("HTTP/1.0 " + QByteArray::number(code) + " " + reason + "\r\nContent-Type: text/plain\r\nConnection: close\r\n"
+                 "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body);
+   socket->disconnectFromHost();
+}
+
+void PreviewServer::handleCommands(QTcpSocket * socket, Client & client)
+{
+   if (client.request.size() > MAX_REQUEST_BYTES) {
+      socket->disconnectFromHost();
+      return;
+   }
+   int end;
+   while ((end = client.request.indexOf('\n')) >= 0) {
+      QString line = QString::fromUtf8(client.request.left(end)).trimmed();
+      client.request.remove(0, end + 1);
+      QStringList words = line.split(' ', SKIP_EMPTY_PARTS);
+      if (words.isEmpty()) continue;
+      if (words.at(0) == NODE_COMMAND_WIDTH && words.size() > 1) client.variant.first = qBound(0, words.at(1).toInt(), MAX_PREVIEW_WIDTH);
+      else if (words.at(0) == NODE_COMMAND_RECORD || words.at(0) == NODE_COMMAND_STOP || words.at(0) == NODE_COMMAND_SNAPSHOT)
+         emit commandReceived(client.stream, words.at(0));
+      else qDebug() << "Ignoring unknown command from viewer" << socket->peerAddress().toString() << line;
+   }
+}
+
+void PreviewServer::sendNodeFrame(QTcpSocket * socket, const Client & client, const Stream & stream, const Encoded & encoded)
+{
+   NodeFrameHeader header = {};
+   header.magic = NODE_FRAME_MAGIC;
+   header.headerSize = sizeof(header);
+   header.jpegSize = (quint32) encoded.jpeg.size();
+   header.statsSize = (quint32) stream.stats.size();
+   header.width = (quint32) encoded.width;
+   header.height = (quint32) encoded.height;
+   header.fullWidth = (quint32) (stream.fullSize.isEmpty() ? stream.frame.cols : stream.fullSize.width());
+   header.fullHeight = (quint32) (stream.fullSize.isEmpty() ? stream.frame.rows : stream.fullSize.height());
+   header.flags = stream.recording ? NODE_FLAG_RECORDING : 0;
+   header.skipped = (quint32) client.skipped;
+   header.sequence = stream.sequence;
+   header.msTimestamp = stream.msTimestamp;
+   socket->write((const char *) &header, sizeof(header));
+   socket->write(encoded.jpeg);
+   socket->write(stream.stats);
+}
+
+void PreviewServer::sendCameraList(QTcpSocket * socket)
+{
+   QByteArray body = m_order.join("\n").toUtf8() + "\n";
+   socket->write("HTTP/1.0 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\nConnection: close\r\n"
+                 "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body);
+   socket->disconnectFromHost();
+}
@@ -0,0 +1,121 @@
+#ifndef PREVIEWSERVER_H
+#define PREVIEWSERVER_H
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QSize>
+#include <QUrlQuery>
+#include <opencv2/opencv.hpp>
+#include "MosaicComposer.h"
+#include "NodeProtocol.h"
+#include "FrameShare.h"
+#include "MemoryBudget.h"
+
+#define DEFAULT_HTTP_JPEG_QUALITY 70
+#define DEFAULT_HTTP_MOSAIC_FPS 5
+#define DEFAULT_HTTP_MOSAIC_TILE_WIDTH 320
+
+// Small HTTP server so streams can be watched from a browser:
+//   /                         index page
+//   /stream/<camera>.mjpg     MJPEG stream          (?w=<width>&q=<quality>)
+//   /still/<camera>.jpg       latest frame as JPEG  (?w=<width>&q=<quality>)
+//   /mosaic.mjpg, /mosaic.jpg all streams in one image
+//   /node/<camera>            frames with metadata for a viewer, see NodeProtocol.h   (?token=<token>)
+//   /node/                    the cameras, one per line                             (?token=<token>)
+// /node/ takes commands, so it is only served with a token set and given.
+// Each frame is encoded at most once per width/quality however many clients
+// watch it, the encoded bytes are shared between them. A client that has not
+// taken the previous frame yet skips frames instead of building a backlog.
+// Frames are only copied from a camera while a client watches it (or the
+// mosaic), or for a few seconds after a still of it was asked for.
+class PreviewServer : public QTcpServer {
+   Q_OBJECT
+public:
+   explicit PreviewServer(QObject * parent = nullptr);
+   ~PreviewServer();
+
+   void setQuality(int quality) { m_quality = quality; }
+   void setMosaic(int framesPerSecond, int tileWidth);
+   // Viewers must send it to use /node/, without one /node/ is refused.
+   void setToken(const QString & token) { m_token = token; }
+
+   // An empty address is the loopback interface only.
+   Q_SLOT void listenOn(const QString & address, int port);
+   Q_SLOT void setStreams(const QStringList & cameras);
+   // Where camera's frames come from, called on the server's thread. Replaces an earlier share.
+   void addShare(const QString & camera, const QSharedPointer<FrameShare> & share);
+   // Metadata sent along with the frames to viewers.
+   Q_SLOT void setSourceStats(const QString & camera, const QString & stats);
+   Q_SLOT void setRecording(const QString & camera, bool recording);
+
+   // A viewer asked for NODE_COMMAND_RECORD, NODE_COMMAND_STOP or NODE_COMMAND_SNAPSHOT on camera.
+   Q_SIGNAL void commandReceived(const QString & camera, const QString & command);
+
+protected:
+   void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+   typedef QPair<int, int> Variant; // Width (0 is as captured), JPEG quality
+   struct Encoded { QByteArray jpeg; quint64 sequence = 0; int width = 0, height = 0; };
+   struct Stream {
+      cv::Mat frame;
+      QSize fullSize;            // Before the preview was scaled down
+      quint64 sequence = 0;
+      qint64 msTimestamp = 0;
+      QByteArray stats;          // UTF-8
+      bool recording = false;
+      QMap<Variant, Encoded> encoded;
+      QSharedPointer<FrameShare> share;
+      QSharedPointer<MemoryBudget::Holding> held;   // frame
+      qint64 msStillWanted = 0;  // Frames are wanted until then for stills, on m_clock
+   };
+   struct Client {
+      QByteArray request;
+      QString stream;
+      Variant variant;
+      bool streaming = false;
+      bool node = false;         // Frames as in NodeProtocol.h rather than multipart JPEG
+      bool waitingStill = false; // For a frame newer than stillAfter, or MS_STILL_WAIT
+      quint64 stillAfter = 0;
+      quint64 sent = 0, skipped = 0;
+   };
+
+   Q_SLOT void readRequest();
+   Q_SLOT void clientGone();
+   Q_SLOT void composeMosaic();
+   Q_SLOT void updateWanted();
+
+   const Encoded & encode(Stream & stream, const Variant & variant);
+   void frameOffered(const QString & camera);
+   void deliver(const QString & camera);
+   void sendStill(QTcpSocket * socket, Client & client);
+   void handleRequest(QTcpSocket * socket, Client & client);
+   void handleCommands(QTcpSocket * socket, Client & client);
+   void sendNodeFrame(QTcpSocket * socket, const Client & client, const Stream & stream, const Encoded & encoded);
+   void sendCameraList(QTcpSocket * socket);
+   void sendIndex(QTcpSocket * socket);
+   void sendError(QTcpSocket * socket, int code, const QByteArray & reason);
+   bool mosaicWanted() const;
+   bool authorized(const QUrlQuery & query) const;
+
+   QHash<QString, Stream> m_streams;   // Also holds the mosaic
+   QStringList m_order;
+   QHash<QTcpSocket *, Client> m_clients;
+   QTimer * m_mosaicTimer;
+   MosaicComposer m_mosaic;
+   int m_mosaicTileWidth = DEFAULT_HTTP_MOSAIC_TILE_WIDTH;
+   int m_quality = DEFAULT_HTTP_JPEG_QUALITY;
+   QString m_token;
+   QElapsedTimer m_clock;
+   std::vector<uchar> m_encodeBuffer;
+   cv::Mat m_scaled;
+};
+
+#endif // PREVIEWSERVER_H
@@ -0,0 +1,40 @@
+#ifndef QTCOMPAT_H
+#define QTCOMPAT_H
+
+#include <QtGlobal>
+#include <QFontMetrics>
+#include <QString>
+#include <QWheelEvent>
+
+// Calls spelled differently across the Qt 5 versions this builds with. demo.pro
+// compiles out everything deprecated, so the older spelling is only used where
+// the newer one does not exist yet.
+
+// Width of text set in a line, horizontalAdvance() from Qt 5.11.
+inline int textAdvance(const QFontMetrics & metrics, const QString & text)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+   return metrics.horizontalAdvance(text);
+#else
+   return metrics.width(text);
+#endif
+}
+
+// Where the cursor was, position() from Qt 5.14.
+inline QPointF wheelPosition(const QWheelEvent * event)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+   return event->position();
+#else
+   return event->posF();
+#endif
+}
+
+// For QString::split(), the flag moved to the Qt namespace in Qt 5.14.
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+#define SKIP_EMPTY_PARTS Qt::SkipEmptyParts
+#else
+#define SKIP_EMPTY_PARTS QString::SkipEmptyParts
+#endif
+
+#endif // QTCOMPAT_H
@@ -0,0 +1,143 @@
+#include "RawFrameFile.h"
+#include "TraceRecorder.h"
+#include <QDebug>
+#include <cstring>
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#endif
+
+static qint64 pageAligned(qint64 bytes)
+{
+   return (bytes + RAW_FRAME_PAGE - 1) / RAW_FRAME_PAGE * RAW_FRAME_PAGE;
+}
+
+bool RawFrameWriter::open(const QString & fileName)
+{
+   close();
+   m_fileName = fileName;
+   m_handle = m_storage->open(fileName);
+   if (m_handle < 0) return false;
+   m_frames = 0;
+   m_dropped = 0;
+
+   QByteArray page(RAW_FRAME_PAGE, '\0');
+   RawFrameFileHeader * header = (RawFrameFileHeader *) page.data();
+   header->magic = RAW_FRAME_FILE_MAGIC;
+   header->version = RAW_FRAME_VERSION;
+   header->pageSize = RAW_FRAME_PAGE;
+   header->frameHeaderSize = sizeof(RawFrameHeader);
+   m_storage->append(m_handle, page, true);
+   return true;
+}
+
+bool RawFrameWriter::writeFrame(int format, int width, int height, int stride, const uchar * data, int size, qint64 msTimestamp)
+{
+   TRACE_SCOPE("write raw frame");
+   if (!isOpened() || size <= 0) return false;
+   qint64 recordSize = RAW_FRAME_PAGE + pageAligned(size);
+   // Padding is zeroed so the same frames always give the same file.
+   QByteArray record((int) recordSize, '\0');
+   RawFrameHeader * header = (RawFrameHeader *) record.data();
+   header->magic = RAW_FRAME_MAGIC;
+   header->format = (quint32) format;
+   header->width = (quint32) width;
+   header->height = (quint32) height;
+   header->stride = (quint32) stride;
+   header->size = (quint32) size;
+   header->sequence = m_frames;
+   header->msTimestamp = msTimestamp;
+   header->recordSize = recordSize;
+   memcpy(record.data() + RAW_FRAME_PAGE, data, (size_t) size);
+
+   if (!m_storage->append(m_handle, record)) {
+      m_dropped++;
+      return false;
+   }
+   m_frames++;
+   return true;
+}
+
+void RawFrameWriter::close()
+{
+   if (!isOpened()) return;
+   m_storage->close(m_handle);
+   m_handle = -1;
+   if (m_dropped) qDebug() << m_fileName << "dropped" << m_dropped << "frames, storage could not keep up.";
+}
+
+bool RawFrameReader::isRawUrl(const QString & url)
+{
+   return url.startsWith(RAW_FRAME_URL_PREFIX) || url.endsWith("." RAW_FRAME_EXTENSION, Qt::CaseInsensitive);
+}
+
+QString RawFrameReader::pathFromUrl(const QString & url)
+{
+   return url.startsWith(RAW_FRAME_URL_PREFIX) ? url.mid(QString(RAW_FRAME_URL_PREFIX).size()) : url;
+}
+
+bool RawFrameReader::open(const QString & path)
+{
+   close();
+   m_file.setFileName(path);
+   if (!m_file.open(QIODevice::ReadOnly)) return false;
+   qint64 size = m_file.size();
+   if (size < RAW_FRAME_PAGE) {
+      close();
+      return false;
+   }
+   m_map = m_file.map(0, size);
+   if (!m_map) {
+      close();
+      return false;
+   }
+   const RawFrameFileHeader * header = (const RawFrameFileHeader *) m_map;
+   if (header->magic != RAW_FRAME_FILE_MAGIC || header->version != RAW_FRAME_VERSION
+       || header->pageSize != RAW_FRAME_PAGE || header->frameHeaderSize != sizeof(RawFrameHeader)) {
+      qDebug() << path << "is not a raw frame file this version understands.";
+      close();
+      return false;
+   }
+#ifdef Q_OS_LINUX
+   // Replay reads front to back, let the kernel read ahead hard and drop pages behind.
+   madvise((void *) m_map, (size_t) size, MADV_SEQUENTIAL);
+#endif
+
+   // Walk the frame headers once, a frame that does not fit is where the file was cut short.
+   for (qint64 offset = RAW_FRAME_PAGE; offset + RAW_FRAME_PAGE <= size; ) {
+      const RawFrameHeader * frame = (const RawFrameHeader *) (m_map + offset);
+      if (frame->magic != RAW_FRAME_MAGIC || frame->recordSize < RAW_FRAME_PAGE + (qint64) frame->size
+          || offset + frame->recordSize > size) break;
+      // Replay trusts every frame it is given, anything else ends the file here too.
+      if (!payloadValid(*frame)) {
+         qDebug() << path << "has a frame in an unknown format or with pixels outside it, replaying the" << m_offsets.size() << "before it.";
+         break;
+      }
+      m_offsets.append(offset);
+      offset += frame->recordSize;
+   }
+   return true;
+}
+
+bool RawFrameReader::payloadValid(const RawFrameHeader & frame)
+{
+   if (frame.format == RAW_FRAME_FORMAT_MJPEG) return frame.size > 0;
+   if (frame.format != RAW_FRAME_FORMAT_BGR24 || frame.width == 0 || frame.height == 0) return false;
+   quint64 rowBytes = (quint64) frame.width * 3;
+   return frame.stride >= rowBytes && (quint64) frame.stride * (frame.height - 1) + rowBytes <= frame.size;
+}
+
+void RawFrameReader::close()
+{
+   if (m_map) m_file.unmap((uchar *) m_map);
+   m_map = nullptr;
+   m_file.close();
+   m_offsets.clear();
+}
+
+RawFrame RawFrameReader::at(int i) const
+{
+   RawFrame frame;
+   frame.header = (const RawFrameHeader *) (m_map + m_offsets.at(i));
+   frame.data = m_map + m_offsets.at(i) + RAW_FRAME_PAGE;
+   return frame;
+}
@@ -0,0 +1,102 @@
+#ifndef RAWFRAMEFILE_H
+#define RAWFRAMEFILE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QFile>
+#include "StorageWriter.h"
+
+// Frames exactly as a stream delivered them (packed BGR, or the camera's JPEG
+// untouched), so a problem seen live can be replayed on a machine without the
+// cameras with the same bytes and the same timing. The file is a one page
+// header, then for each frame a one page frame header followed by the payload,
+// which starts on a page boundary and is padded to one. Host (little endian)
+// byte order, so frames are used straight from a mapping of the file.
+#define RAW_FRAME_EXTENSION "raw"
+#define RAW_FRAME_URL_PREFIX "raw:"
+#define RAW_FRAME_PAGE 4096
+#define RAW_FRAME_FILE_MAGIC 0x52434d51u   // "QMCR"
+#define RAW_FRAME_MAGIC 0x46434d51u        // "QMCF"
+#define RAW_FRAME_VERSION 1
+#define RAW_FRAME_FORMAT_BGR24 1
+#define RAW_FRAME_FORMAT_MJPEG 2
+
+struct RawFrameFileHeader {
+   quint32 magic;
+   quint32 version;
+   quint32 pageSize;
+   quint32 frameHeaderSize;
+   quint32 reserved[4];
+};
+
+struct RawFrameHeader {
+   quint32 magic;
+   quint32 format;
+   quint32 width, height;
+   quint32 stride;        // Bytes per row, 0 for MJPEG
+   quint32 size;          // Payload bytes
+   quint64 sequence;      // Frame number within the file
+   qint64 msTimestamp;    // Capture time, milliseconds since the epoch
+   qint64 recordSize;     // This header's page and the padded payload, i.e. where the next frame starts
+   quint32 reserved[4];
+};
+
+static_assert(sizeof(RawFrameFileHeader) == 32, "RawFrameFileHeader layout is part of the file format");
+static_assert(sizeof(RawFrameHeader) == 64, "RawFrameHeader layout is part of the file format");
+
+// Appends frames through the StorageWriter, one write per frame.
+class RawFrameWriter {
+public:
+   explicit RawFrameWriter(StorageWriter * storage) : m_storage(storage) {}
+   ~RawFrameWriter() { close(); }
+
+   bool open(const QString & fileName);
+   bool isOpened() const { return m_handle >= 0; }
+   // False if the frame was not written, e.g. because the storage queue is full.
+   bool writeFrame(int format, int width, int height, int stride, const uchar * data, int size, qint64 msTimestamp);
+   void close();
+
+   QString fileName() const { return m_fileName; }
+   quint64 frameCount() const { return m_frames; }
+   quint64 droppedFrames() const { return m_dropped; }
+
+private:
+   StorageWriter * m_storage;
+   int m_handle = -1;
+   QString m_fileName;
+   quint64 m_frames = 0;
+   quint64 m_dropped = 0;
+};
+
+struct RawFrame {
+   const RawFrameHeader * header = nullptr;
+   const uchar * data = nullptr;
+};
+
+// Read side, maps the file. A file cut short (or still being written) has the
+// frames that were complete when it was opened. Every frame handed out is in a
+// known format with all of its pixels inside its payload.
+class RawFrameReader {
+public:
+   ~RawFrameReader() { close(); }
+
+   // "raw:<path>", or any path ending in .raw.
+   static bool isRawUrl(const QString & url);
+   static QString pathFromUrl(const QString & url);
+
+   bool open(const QString & path);
+   void close();
+
+   int count() const { return m_offsets.size(); }
+   RawFrame at(int i) const;
+
+private:
+   static bool payloadValid(const RawFrameHeader & frame);
+
+   QFile m_file;
+   const uchar * m_map = nullptr;
+   QVector<qint64> m_offsets;
+};
+
+#endif // RAWFRAMEFILE_H
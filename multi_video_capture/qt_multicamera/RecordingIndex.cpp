@@ -0,0 +1,118 @@
+#include "RecordingIndex.h"
+#include <QDebug>
+
+// Entries are handed to the storage writer in groups of this many.
+#define RECORDING_INDEX_FLUSH_ENTRIES 32
+
+bool RecordingIndexWriter::open(const QString & recording, int width, int height, int framesPerSecond)
+{
+   close();
+   m_handle = m_storage->open(pathFor(recording), STANDARD_MB);
+   if (m_handle < 0) return false;
+   m_frames = 0;
+
+   RecordingIndexHeader header = {};
+   header.magic = RECORDING_INDEX_MAGIC;
+   header.version = RECORDING_INDEX_VERSION;
+   header.entrySize = sizeof(RecordingIndexEntry);
+   header.width = (quint32) width;
+   header.height = (quint32) height;
+   header.framesPerSecond = (quint32) framesPerSecond;
+   m_pending = QByteArray((const char *) &header, sizeof(header));
+   flush();
+   return true;
+}
+
+void RecordingIndexWriter::append(qint64 msTimestamp, qint64 offset, quint32 size, quint32 flags)
+{
+   if (!isOpened()) return;
+   RecordingIndexEntry entry = {};
+   entry.frame = m_frames++;
+   entry.flags = flags;
+   entry.msTimestamp = msTimestamp;
+   entry.offset = offset;
+   entry.size = size;
+   m_pending.append((const char *) &entry, sizeof(entry));
+   if (m_pending.size() >= RECORDING_INDEX_FLUSH_ENTRIES * (int) sizeof(entry)) flush();
+}
+
+void RecordingIndexWriter::close()
+{
+   if (!isOpened()) return;
+   flush();
+   m_storage->close(m_handle);
+   m_handle = -1;
+}
+
+void RecordingIndexWriter::flush()
+{
+   if (m_pending.isEmpty()) return;
+   // Always taken, the index has to match the frames the recording accepted.
+   m_storage->append(m_handle, m_pending, true);
+   m_pending.clear();
+}
+
+bool RecordingIndex::open(const QString & recording)
+{
+   close();
+   m_recording = recording;
+   m_file.setFileName(RecordingIndexWriter::pathFor(recording));
+   if (!m_file.open(QIODevice::ReadOnly)) return false;
+
+   qint64 size = m_file.size();
+   if (size < (qint64) sizeof(RecordingIndexHeader)) {
+      close();
+      return false;
+   }
+   uchar * map = m_file.map(0, size);
+   if (!map) {
+      close();
+      return false;
+   }
+   m_header = (const RecordingIndexHeader *) map;
+   if (m_header->magic != RECORDING_INDEX_MAGIC || m_header->version != RECORDING_INDEX_VERSION
+       || m_header->entrySize != sizeof(RecordingIndexEntry)) {
+      qDebug() << m_file.fileName() << "is not a recording index this version understands.";
+      close();
+      return false;
+   }
+   m_entries = (const RecordingIndexEntry *) (map + sizeof(RecordingIndexHeader));
+   int count = (int) ((size - sizeof(RecordingIndexHeader)) / sizeof(RecordingIndexEntry));
+   // An index still being written, or cut short by a crash, can end in space that was never
+   // written. The entries end at the first one that is empty or goes back in time.
+   m_count = 0;
+   while (m_count < count) {
+      const RecordingIndexEntry & entry = m_entries[m_count];
+      if (entry.msTimestamp <= 0 || entry.size == 0) break;
+      if (m_count && entry.msTimestamp < m_entries[m_count - 1].msTimestamp) break;
+      m_count++;
+   }
+   return true;
+}
+
+void RecordingIndex::close()
+{
+   m_header = nullptr;
+   m_entries = nullptr;
+   m_count = 0;
+   m_file.close(); // Also unmaps
+}
+
+int RecordingIndex::frameAt(qint64 msTimestamp) const
+{
+   // Timestamps only ever go up, so binary search for the first one past msTimestamp.
+   int low = 0, high = m_count;
+   while (low < high) {
+      int middle = (low + high) / 2;
+      if (m_entries[middle].msTimestamp <= msTimestamp) low = middle + 1;
+      else high = middle;
+   }
+   return low - 1;
+}
+
+int RecordingIndex::nextMotion(int from, int direction) const
+{
+   for (int i = from + direction; i >= 0 && i < m_count; i += direction)
+      if (m_entries[i].flags & RECORDING_INDEX_MOTION) return i;
+   return -1;
+}
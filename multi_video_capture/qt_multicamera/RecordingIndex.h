@@ -0,0 +1,90 @@
+#ifndef RECORDINGINDEX_H
+#define RECORDINGINDEX_H
+
+#include <QByteArray>
+#include <QString>
+#include <QFile>
+#include "StorageWriter.h"
+
+// Every recording gets a sidecar index next to it (<recording>.idx) so it can be
+// seeked by wall clock time without reading the video. The file is a header
+// followed by fixed size entries, one per recorded frame in capture order, in
+// host (little endian) byte order so it can be used straight from a mapping.
+#define RECORDING_INDEX_EXTENSION ".idx"
+#define RECORDING_INDEX_MAGIC 0x49434d51u  // "QMCI"
+#define RECORDING_INDEX_VERSION 1
+#define RECORDING_INDEX_KEYFRAME 0x1u      // Decodable on its own, every MJPEG frame is
+#define RECORDING_INDEX_MOTION 0x2u        // Noticeably different from the frame before
+
+struct RecordingIndexHeader {
+   quint32 magic;
+   quint32 version;
+   quint32 entrySize;
+   quint32 width, height, framesPerSecond;
+   quint32 reserved[2];
+};
+
+struct RecordingIndexEntry {
+   quint32 frame;
+   quint32 flags;
+   qint64 msTimestamp;   // Capture time, milliseconds since the epoch
+   qint64 offset;        // Of the JPEG data in the recording
+   quint32 size;
+   quint32 reserved;
+};
+
+static_assert(sizeof(RecordingIndexHeader) == 32, "RecordingIndexHeader layout is part of the file format");
+static_assert(sizeof(RecordingIndexEntry) == 32, "RecordingIndexEntry layout is part of the file format");
+
+// Appends entries through the StorageWriter, a few at a time.
+class RecordingIndexWriter {
+public:
+   explicit RecordingIndexWriter(StorageWriter * storage) : m_storage(storage) {}
+   ~RecordingIndexWriter() { close(); }
+
+   static QString pathFor(const QString & recording) { return recording + RECORDING_INDEX_EXTENSION; }
+
+   bool open(const QString & recording, int width, int height, int framesPerSecond);
+   bool isOpened() const { return m_handle >= 0; }
+   void append(qint64 msTimestamp, qint64 offset, quint32 size, quint32 flags);
+   void close();
+
+private:
+   void flush();
+
+   StorageWriter * m_storage;
+   int m_handle = -1;
+   quint32 m_frames = 0;
+   QByteArray m_pending;
+};
+
+// Read side, maps the index rather than reading it. An index still being
+// written can be opened, it shows the frames written when it was opened.
+class RecordingIndex {
+public:
+   ~RecordingIndex() { close(); }
+
+   bool open(const QString & recording);
+   void close();
+
+   QString recording() const { return m_recording; }
+   const RecordingIndexHeader & header() const { return *m_header; }
+   int count() const { return m_count; }
+   const RecordingIndexEntry & at(int i) const { return m_entries[i]; }
+   qint64 msFirst() const { return m_count ? m_entries[0].msTimestamp : 0; }
+   qint64 msLast() const { return m_count ? m_entries[m_count - 1].msTimestamp : 0; }
+
+   // The frame showing at msTimestamp, i.e. the last one captured at or before it. -1 if none.
+   int frameAt(qint64 msTimestamp) const;
+   // The next frame after (direction 1) or before (-1) from flagged as motion. -1 if none.
+   int nextMotion(int from, int direction) const;
+
+private:
+   QString m_recording;
+   QFile m_file;
+   const RecordingIndexHeader * m_header = nullptr;
+   const RecordingIndexEntry * m_entries = nullptr;
+   int m_count = 0;
+};
+
+#endif // RECORDINGINDEX_H
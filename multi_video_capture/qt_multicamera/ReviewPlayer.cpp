@@ -0,0 +1,286 @@
+#include "ReviewPlayer.h"
+#include "QtCompat.h"
+#include <QtWidgets>
+#include <QDebug>
+#include <algorithm>
+
+#define REVIEW_TICK_MS 40
+// A camera shows nothing once its last frame is older than this, e.g. recording was stopped.
+#define REVIEW_MAX_FRAME_AGE_MS 2000
+#define REVIEW_SMALL_STEP_MS 1000
+#define REVIEW_LARGE_STEP_MS 60000
+
+// Shows the composed frame as large as fits, keeping its aspect.
+class ReviewCanvas : public QWidget {
+public:
+   explicit ReviewCanvas(QWidget * parent) : QWidget(parent) {
+      setAttribute(Qt::WA_OpaquePaintEvent);
+      setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
+      setMinimumSize(160, 120);
+   }
+   QImage image;
+protected:
+   void paintEvent(QPaintEvent *) override {
+      QPainter p(this);
+      p.fillRect(rect(), Qt::black);
+      if (image.isNull()) return;
+      QSize size = image.size().scaled(this->size(), Qt::KeepAspectRatio);
+      p.drawImage(QRect(QPoint((width() - size.width()) / 2, (height() - size.height()) / 2), size), image);
+   }
+};
+
+// Recordings are named "<camera> <ddMMyyyy_HHmmss>.AVI".
+static QString cameraOf(const QString & recording)
+{
+   QString name = QFileInfo(recording).completeBaseName();
+   int space = name.lastIndexOf(' ');
+   return space > 0 ? name.left(space) : name;
+}
+
+// The first frame of a run of motion frames.
+static bool startsMotion(const RecordingIndex & index, int i)
+{
+   return (index.at(i).flags & RECORDING_INDEX_MOTION) && (i == 0 || !(index.at(i - 1).flags & RECORDING_INDEX_MOTION));
+}
+
+QStringList ReviewPlayer::findRecordings(const QStringList & paths)
+{
+   QStringList recordings;
+   foreach (const QString & path, paths) {
+      QFileInfo info(path);
+      QStringList candidates;
+      if (info.isDir()) {
+         foreach (const QFileInfo & file, QDir(path).entryInfoList(QStringList() << "*.AVI" << "*.avi", QDir::Files, QDir::Name))
+            candidates.append(file.filePath());
+      } else {
+         candidates.append(path);
+      }
+      foreach (const QString & candidate, candidates) {
+         if (QFile::exists(RecordingIndexWriter::pathFor(candidate))) recordings.append(candidate);
+         else qDebug() << candidate << "has no index, skipped.";
+      }
+   }
+   return recordings;
+}
+
+ReviewPlayer::ReviewPlayer(const QStringList & recordings, QWidget * parent)
+    : QWidget(parent), m_canvas(new ReviewCanvas(this)), m_slider(new QSlider(Qt::Horizontal, this)),
+      m_time(new QLabel(this)), m_play(new QPushButton("Play", this)), m_speed(new QComboBox(this)),
+      m_playTimer(new QTimer(this))
+{
+   foreach (const QString & recording, recordings) {
+      Segment * segment = new Segment;
+      segment->video.setFileName(recording);
+      if (!segment->index.open(recording) || segment->index.count() == 0 || !segment->video.open(QIODevice::ReadOnly)) {
+         qDebug() << "Could not open" << recording << "for review.";
+         delete segment;
+         continue;
+      }
+      segment->mapped = segment->video.size();
+      segment->data = segment->video.map(0, segment->mapped);
+      if (!segment->data) {
+         qDebug() << "Could not map" << recording;
+         delete segment;
+         continue;
+      }
+
+      QString camera = cameraOf(recording);
+      Track * track = nullptr;
+      foreach (Track * candidate, m_tracks) if (candidate->camera == camera) track = candidate;
+      if (!track) {
+         track = new Track;
+         track->camera = camera;
+         m_tracks.append(track);
+      }
+      track->segments.append(segment);
+   }
+
+   bool first = true;
+   foreach (Track * track, m_tracks) {
+      std::sort(track->segments.begin(), track->segments.end(),
+                [](const Segment * a, const Segment * b) { return a->index.msFirst() < b->index.msFirst(); });
+      foreach (const Segment * segment, track->segments) {
+         m_msStart = first ? segment->index.msFirst() : qMin(m_msStart, segment->index.msFirst());
+         m_msEnd = first ? segment->index.msLast() : qMax(m_msEnd, segment->index.msLast());
+         first = false;
+      }
+   }
+
+   setWindowTitle(QString("Review - %1 cameras").arg(m_tracks.size()));
+   QPushButton * previousMotion = new QPushButton("<< Motion", this);
+   QPushButton * nextMotion = new QPushButton("Motion >>", this);
+   m_play->setCheckable(true);
+   foreach (int speed, QList<int>({1, 2, 4, 8, 16, 64}))
+      m_speed->addItem(QString("%1x").arg(speed), speed);
+   m_slider->setRange(0, (int) qMin<qint64>(m_msEnd - m_msStart, INT_MAX));
+   m_time->setMinimumWidth(textAdvance(m_time->fontMetrics(), "00/00/0000 00:00:00.000"));
+
+   QHBoxLayout * controls = new QHBoxLayout;
+   controls->addWidget(m_play);
+   controls->addWidget(previousMotion);
+   controls->addWidget(m_slider, 1);
+   controls->addWidget(nextMotion);
+   controls->addWidget(m_time);
+   controls->addWidget(m_speed);
+   QVBoxLayout * layout = new QVBoxLayout(this);
+   layout->addWidget(m_canvas, 1);
+   layout->addLayout(controls);
+
+   connect(m_slider, &QSlider::valueChanged, this, [this](int value) { seek(m_msStart + value); });
+   connect(m_play, &QPushButton::toggled, this, &ReviewPlayer::setPlaying);
+   connect(previousMotion, &QPushButton::clicked, this, [this]() { seekMotion(-1); });
+   connect(nextMotion, &QPushButton::clicked, this, [this]() { seekMotion(1); });
+   connect(m_playTimer, &QTimer::timeout, this, &ReviewPlayer::advance);
+   m_playTimer->setInterval(REVIEW_TICK_MS);
+   setFocusPolicy(Qt::StrongFocus);
+
+   seek(m_msStart);
+}
+
+ReviewPlayer::~ReviewPlayer()
+{
+   foreach (Track * track, m_tracks) qDeleteAll(track->segments);
+   qDeleteAll(m_tracks);
+}
+
+void ReviewPlayer::seek(qint64 msTimestamp)
+{
+   m_msPosition = qBound(m_msStart, msTimestamp, m_msEnd);
+
+   foreach (Track * track, m_tracks) {
+      const Segment * segment = segmentAt(*track, m_msPosition);
+      int frame = segment ? segment->index.frameAt(m_msPosition) : -1;
+      if (frame >= 0 && m_msPosition - segment->index.at(frame).msTimestamp > REVIEW_MAX_FRAME_AGE_MS) frame = -1;
+      if (frame < 0) segment = nullptr;
+      if (segment == track->shownSegment && frame == track->shownFrame && !track->frame.empty()) continue;
+
+      track->shownSegment = segment;
+      track->shownFrame = frame;
+      track->frame.release();
+      if (!segment) continue;
+      const RecordingIndexEntry & entry = segment->index.at(frame);
+      if (entry.offset + entry.size > segment->mapped) continue; // Written after the recording was opened.
+      cv::Mat jpeg(1, (int) entry.size, CV_8UC1, (void *) (segment->data + entry.offset));
+      cv::imdecode(jpeg, decodeFlagsFor(segment->index.header()), &track->frame);
+   }
+
+   QSignalBlocker block(m_slider);
+   m_slider->setValue((int) qMin<qint64>(m_msPosition - m_msStart, INT_MAX));
+   m_time->setText(QDateTime::fromMSecsSinceEpoch(m_msPosition).toString("dd/MM/yyyy HH:mm:ss.zzz"));
+   render();
+}
+
+void ReviewPlayer::setPlaying(bool playing)
+{
+   if (m_play->isChecked() != playing) m_play->setChecked(playing); // Comes back here through toggled.
+   m_play->setText(playing ? "Pause" : "Play");
+   if (playing) {
+      if (m_msPosition >= m_msEnd) seek(m_msStart);
+      m_sinceAdvance.start();
+      m_playTimer->start();
+   } else {
+      m_playTimer->stop();
+   }
+}
+
+void ReviewPlayer::advance()
+{
+   qint64 msTimestamp = m_msPosition + (qint64) (m_sinceAdvance.restart() * m_speed->currentData().toInt());
+   seek(msTimestamp);
+   if (msTimestamp >= m_msEnd) setPlaying(false);
+}
+
+void ReviewPlayer::seekMotion(int direction)
+{
+   bool found = false;
+   qint64 best = 0;
+   foreach (const Track * track, m_tracks) {
+      foreach (const Segment * segment, track->segments) {
+         const RecordingIndex & index = segment->index;
+         int i = index.frameAt(m_msPosition);
+         do i = index.nextMotion(i, direction); while (i >= 0 && !startsMotion(index, i));
+         if (i < 0) continue;
+         qint64 msMotion = index.at(i).msTimestamp;
+         if (direction > 0 ? msMotion <= m_msPosition : msMotion >= m_msPosition) continue;
+         if (!found || (direction > 0 ? msMotion < best : msMotion > best)) best = msMotion;
+         found = true;
+      }
+   }
+   if (found) seek(best);
+}
+
+const ReviewPlayer::Segment * ReviewPlayer::segmentAt(const Track & track, qint64 msTimestamp) const
+{
+   const Segment * found = nullptr;
+   foreach (const Segment * segment, track.segments)
+      if (segment->index.msFirst() <= msTimestamp) found = segment;
+   return found;
+}
+
+cv::Size ReviewPlayer::tileSize() const
+{
+   int count = qMax(1, m_tracks.size());
+   int columns = MosaicComposer::columnsFor(count);
+   int rows = (count + columns - 1) / columns;
+   cv::Size tile(qMax(16, m_canvas->width() / columns), qMax(16, m_canvas->height() / rows));
+
+   // Keep the cameras' aspect, going by the first one.
+   if (!m_tracks.isEmpty() && !m_tracks.first()->segments.isEmpty()) {
+      const RecordingIndexHeader & header = m_tracks.first()->segments.first()->index.header();
+      if (header.width && header.height) {
+         int height = (int) ((qint64) tile.width * header.height / header.width);
+         if (height <= tile.height) tile.height = qMax(16, height);
+         else tile.width = qMax(16, (int) ((qint64) tile.height * header.width / header.height));
+      }
+   }
+   return tile;
+}
+
+int ReviewPlayer::decodeFlagsFor(const RecordingIndexHeader & header) const
+{
+   // Decode no larger than the tile using the JPEG decoder's DCT scaling, as the live view does.
+   cv::Size tile = tileSize();
+   static const int reduced[][2] = { {8, cv::IMREAD_REDUCED_COLOR_8}, {4, cv::IMREAD_REDUCED_COLOR_4}, {2, cv::IMREAD_REDUCED_COLOR_2} };
+   for (const auto & r : reduced)
+      if ((int) header.width / r[0] >= tile.width && (int) header.height / r[0] >= tile.height) return r[1];
+   return cv::IMREAD_COLOR;
+}
+
+void ReviewPlayer::render()
+{
+   std::vector<cv::Mat> frames;
+   std::vector<std::string> labels;
+   foreach (const Track * track, m_tracks) {
+      frames.push_back(track->frame);
+      QString label = track->camera;
+      if (track->shownSegment)
+         label += " " + QDateTime::fromMSecsSinceEpoch(track->shownSegment->index.at(track->shownFrame).msTimestamp).toString("HH:mm:ss.zzz");
+      labels.push_back(label.toStdString());
+   }
+   const cv::Mat & mosaic = m_mosaic.compose(frames, labels, tileSize());
+   cv::cvtColor(mosaic, m_rgb, cv::COLOR_BGR2RGB);
+   m_canvas->image = QImage(m_rgb.data, m_rgb.cols, m_rgb.rows, (int) m_rgb.step, QImage::Format_RGB888).copy();
+   m_canvas->update();
+}
+
+void ReviewPlayer::keyPressEvent(QKeyEvent * event)
+{
+   qint64 step = (event->modifiers() & Qt::ShiftModifier) ? REVIEW_LARGE_STEP_MS : REVIEW_SMALL_STEP_MS;
+   switch (event->key()) {
+   case Qt::Key_Space: setPlaying(!m_playTimer->isActive()); break;
+   case Qt::Key_Left: seek(m_msPosition - step); break;
+   case Qt::Key_Right: seek(m_msPosition + step); break;
+   case Qt::Key_Home: seek(m_msStart); break;
+   case Qt::Key_End: seek(m_msEnd); break;
+   case Qt::Key_M: seekMotion((event->modifiers() & Qt::ShiftModifier) ? -1 : 1); break;
+   default: QWidget::keyPressEvent(event);
+   }
+}
+
+void ReviewPlayer::resizeEvent(QResizeEvent * event)
+{
+   QWidget::resizeEvent(event);
+   // The decode scale depends on the tile size, so decode again.
+   foreach (Track * track, m_tracks) track->frame.release();
+   seek(m_msPosition);
+}
@@ -0,0 +1,77 @@
+#ifndef REVIEWPLAYER_H
+#define REVIEWPLAYER_H
+
+#include <QWidget>
+#include <QList>
+#include <QFile>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <opencv2/opencv.hpp>
+#include "RecordingIndex.h"
+#include "MosaicComposer.h"
+
+class QSlider;
+class QLabel;
+class QPushButton;
+class QComboBox;
+class QTimer;
+class ReviewCanvas;
+
+// Plays back recordings side by side, lined up by the wall clock time they were
+// captured. Recordings of the same camera (e.g. after a roll over) share a tile.
+// Seeking looks the frame up in each recording's index and decodes just that
+// JPEG from the mapped recording, so scrubbing hours of video is immediate.
+class ReviewPlayer : public QWidget {
+   Q_OBJECT
+public:
+   explicit ReviewPlayer(const QStringList & recordings, QWidget * parent = nullptr);
+   ~ReviewPlayer();
+
+   // Recordings with an index, given directly or found in the given directories.
+   static QStringList findRecordings(const QStringList & paths);
+
+   Q_SLOT void seek(qint64 msTimestamp);
+   Q_SLOT void setPlaying(bool playing);
+   // Jumps to the nearest motion in any recording, forwards (1) or backwards (-1).
+   Q_SLOT void seekMotion(int direction);
+
+protected:
+   void keyPressEvent(QKeyEvent * event) override;
+   void resizeEvent(QResizeEvent * event) override;
+
+private:
+   struct Segment {
+      RecordingIndex index;
+      QFile video;
+      const uchar * data = nullptr;
+      qint64 mapped = 0;
+   };
+   struct Track {
+      QString camera;
+      QList<Segment *> segments;   // In time order
+      const Segment * shownSegment = nullptr;
+      int shownFrame = -1;
+      cv::Mat frame;
+   };
+
+   void advance();
+   void render();
+   const Segment * segmentAt(const Track & track, qint64 msTimestamp) const;
+   int decodeFlagsFor(const RecordingIndexHeader & header) const;
+   cv::Size tileSize() const;
+
+   QList<Track *> m_tracks;
+   qint64 m_msStart = 0, m_msEnd = 0, m_msPosition = 0;
+   MosaicComposer m_mosaic;
+   cv::Mat m_rgb;
+
+   ReviewCanvas * m_canvas;
+   QSlider * m_slider;
+   QLabel * m_time;
+   QPushButton * m_play;
+   QComboBox * m_speed;
+   QTimer * m_playTimer;
+   QElapsedTimer m_sinceAdvance;
+};
+
+#endif // REVIEWPLAYER_H
@@ -0,0 +1,171 @@
+#include "SnapshotStore.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <opencv2/imgproc.hpp>
+#include <cstring>
+
+SnapshotStore::SnapshotStore(const QString & directory) : m_directory(directory)
+{
+}
+
+SnapshotStore::Mode SnapshotStore::modeFromString(const QString & mode)
+{
+   if (mode.compare("keep", Qt::CaseInsensitive) == 0) return Keep;
+   if (mode.compare("skip", Qt::CaseInsensitive) == 0) return Skip;
+   return Link;
+}
+
+void SnapshotStore::setDuplicates(Mode mode, int distance)
+{
+   m_mode = mode;
+   m_distance = qMin(distance, SNAPSHOT_MAX_DISTANCE);
+}
+
+quint64 SnapshotStore::perceptualHash(const cv::Mat & frame)
+{
+   if (frame.empty()) return 0;
+   cv::Mat thumbnail;
+   // Shrunk first, converting the whole frame to grey would cost more than the rest together.
+   cv::resize(frame, thumbnail, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+   if (thumbnail.channels() == 3) cv::cvtColor(thumbnail, thumbnail, cv::COLOR_BGR2GRAY);
+   quint64 hash = 0;
+   for (int y = 0; y < 8; ++y) {
+      const uchar * row = thumbnail.ptr(y);
+      for (int x = 0; x < 8; ++x) hash = (hash << 1) | (row[x] < row[x + 1] ? 1 : 0);
+   }
+   return hash;
+}
+
+int SnapshotStore::distance(quint64 a, quint64 b)
+{
+   quint64 bits = a ^ b;
+   int count = 0;
+   for (; bits; bits &= bits - 1) count++;
+   return count;
+}
+
+static quint16 band(quint64 hash, int b)
+{
+   return (quint16) (hash >> (16 * b));
+}
+
+// Called with m_mutex held.
+bool SnapshotStore::open()
+{
+   if (m_opened) return m_index.isOpen();
+   m_opened = true;
+   QDir().mkpath(m_directory);
+   m_index.setFileName(m_directory + "/" + SNAPSHOT_INDEX_FILE_NAME);
+
+   if (m_index.open(QIODevice::ReadWrite)) {
+      SnapshotIndexHeader header = {};
+      qint64 size = m_index.size();
+      bool valid = size >= (qint64) sizeof(header) && m_index.read((char *) &header, sizeof(header)) == sizeof(header)
+            && header.magic == SNAPSHOT_INDEX_MAGIC && header.version == SNAPSHOT_INDEX_VERSION
+            && header.entrySize == sizeof(SnapshotIndexEntry);
+      if (!valid && size > 0) {
+         qDebug() << m_index.fileName() << "is not a snapshot index this version understands, starting a new one.";
+         m_index.close();
+         QFile::remove(m_index.fileName() + ".old");
+         QFile::rename(m_index.fileName(), m_index.fileName() + ".old");
+         if (!m_index.open(QIODevice::ReadWrite)) return false;
+      }
+      if (!valid) {
+         header = {};
+         header.magic = SNAPSHOT_INDEX_MAGIC;
+         header.version = SNAPSHOT_INDEX_VERSION;
+         header.entrySize = sizeof(SnapshotIndexEntry);
+         m_index.resize(0);
+         m_index.write((const char *) &header, sizeof(header));
+      } else {
+         int count = (int) ((size - sizeof(header)) / sizeof(SnapshotIndexEntry));
+         m_entries.reserve(count);
+         SnapshotIndexEntry entry;
+         for (int i = 0; i < count && m_index.read((char *) &entry, sizeof(entry)) == sizeof(entry); ++i) insert(entry);
+         // A partly written last entry (the program stopped mid write) is dropped.
+         m_index.resize(sizeof(header) + (qint64) m_entries.size() * sizeof(SnapshotIndexEntry));
+      }
+      m_index.seek(m_index.size());
+      m_index.flush();
+   }
+   if (!m_index.isOpen()) qDebug() << "Could not open" << m_index.fileName() << ", snapshots are not checked for duplicates.";
+   else qDebug() << "Snapshot index" << m_index.fileName() << "holds" << m_entries.size() << "snapshots.";
+   return m_index.isOpen();
+}
+
+// Called with m_mutex held.
+void SnapshotStore::insert(const SnapshotIndexEntry & entry)
+{
+   int i = m_entries.size();
+   m_entries.append(entry);
+   for (int b = 0; b < SNAPSHOT_HASH_BANDS; ++b) m_bands[b].insert(band(entry.hash, b), i);
+}
+
+QString SnapshotStore::findDuplicate(quint64 hash) const
+{
+   // Hashes differing in fewer bits than there are bands agree on at least one whole band.
+   for (int b = 0; b < SNAPSHOT_HASH_BANDS; ++b) {
+      for (auto it = m_bands[b].constFind(band(hash, b)); it != m_bands[b].constEnd() && it.key() == band(hash, b); ++it) {
+         const SnapshotIndexEntry & entry = m_entries[it.value()];
+         if (distance(entry.hash, hash) > m_distance) continue;
+         QString path = m_directory + "/" + QString::fromUtf8(entry.file);
+         // Snapshots deleted by hand are still listed, they no longer count.
+         if (QFileInfo::exists(path)) return path;
+      }
+   }
+   for (auto it = m_claims.constBegin(); it != m_claims.constEnd(); ++it)
+      if (distance(it->hash, hash) <= m_distance) return it.key();
+   return QString();
+}
+
+// Called with m_mutex held.
+void SnapshotStore::append(const SnapshotIndexEntry & entry)
+{
+   // Whole entries only, each written and flushed as one so a crash leaves at most a partial last one.
+   m_index.write((const char *) &entry, sizeof(entry));
+   m_index.flush();
+   insert(entry);
+}
+
+SnapshotStore::Outcome SnapshotStore::claim(quint64 hash, const QString & camera, qint64 msTimestamp, const QString & path, QString & original)
+{
+   SnapshotIndexEntry entry;
+   memset(&entry, 0, sizeof(entry));
+   entry.hash = hash;
+   entry.msTimestamp = msTimestamp;
+   QByteArray name = camera.toUtf8(), file = QFileInfo(path).fileName().toUtf8();
+   memcpy(entry.camera, name.constData(), (size_t) qMin(name.size(), (int) sizeof(entry.camera) - 1));
+   // Could not be found again from a cut short name, stored but not listed.
+   if (file.size() >= (int) sizeof(entry.file)) return Store;
+   memcpy(entry.file, file.constData(), (size_t) file.size());
+
+   QMutexLocker lock(&m_mutex);
+   if (!open()) return Store;
+   if (m_mode != Keep && m_distance >= 0) original = findDuplicate(hash);
+   if (!original.isEmpty()) {
+      if (m_mode == Skip) return Skipped;
+      if (link(original, path)) {
+         entry.flags = SNAPSHOT_INDEX_LINK;
+         append(entry);
+         return Linked;
+      }
+   }
+   m_claims.insert(path, entry);
+   return Store;
+}
+
+void SnapshotStore::stored(const QString & path, bool written)
+{
+   QMutexLocker lock(&m_mutex);
+   auto it = m_claims.find(path);
+   if (it == m_claims.end()) return;
+   if (written) append(*it);
+   m_claims.erase(it);
+}
+
+bool SnapshotStore::link(const QString & target, const QString & path)
+{
+   // Relative, both are in the image directory and it may be moved as a whole.
+   return QFile::link(QFileInfo(target).fileName(), path);
+}
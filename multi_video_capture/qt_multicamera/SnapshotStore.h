@@ -0,0 +1,94 @@
+#ifndef SNAPSHOTSTORE_H
+#define SNAPSHOTSTORE_H
+
+#include <QString>
+#include <QFile>
+#include <QMutex>
+#include <QMultiHash>
+#include <QHash>
+#include <QVector>
+#include <opencv2/core.hpp>
+
+// Every snapshot is listed in an append-only index (snapshots.idx in the image
+// directory) with a perceptual hash of the picture, so a new snapshot can be
+// matched against all earlier ones without reading any images. The file is a
+// header followed by fixed size entries in the order they were taken, in host
+// (little endian) byte order like the recording index.
+#define SNAPSHOT_INDEX_FILE_NAME "snapshots.idx"
+#define SNAPSHOT_INDEX_MAGIC 0x53434d51u  // "QMCS"
+#define SNAPSHOT_INDEX_VERSION 1
+#define SNAPSHOT_INDEX_LINK 0x1u          // file is a link to an earlier snapshot of the same picture
+// Hashes are looked up in this many bands, so up to SNAPSHOT_HASH_BANDS - 1 differing bits are found in one lookup per band.
+#define SNAPSHOT_HASH_BANDS 4
+#define SNAPSHOT_MAX_DISTANCE (SNAPSHOT_HASH_BANDS - 1)
+#define DEFAULT_SNAPSHOT_DISTANCE 3
+
+struct SnapshotIndexHeader {
+   quint32 magic;
+   quint32 version;
+   quint32 entrySize;
+   quint32 reserved[5];
+};
+
+struct SnapshotIndexEntry {
+   quint64 hash;          // SnapshotStore::perceptualHash() of the picture
+   qint64 msTimestamp;    // Capture time, milliseconds since the epoch
+   quint32 flags;
+   quint32 reserved;
+   char camera[64];       // UTF-8, NUL terminated
+   char file[168];        // Relative to the image directory, UTF-8, NUL terminated
+};
+
+static_assert(sizeof(SnapshotIndexHeader) == 32, "SnapshotIndexHeader layout is part of the file format");
+static_assert(sizeof(SnapshotIndexEntry) == 256, "SnapshotIndexEntry layout is part of the file format");
+
+// Shared by all streams, safe to use from any thread.
+class SnapshotStore {
+public:
+   // What happens to a snapshot of a picture already stored.
+   enum Mode { Keep, Link, Skip };
+   // What claim() decided for a new snapshot.
+   enum Outcome { Store, Linked, Skipped };
+
+   explicit SnapshotStore(const QString & directory);
+
+   static Mode modeFromString(const QString & mode);
+   // Snapshots within distance differing bits of an earlier one are duplicates, -1 turns matching off.
+   void setDuplicates(Mode mode, int distance);
+   Mode mode() const { return m_mode; }
+
+   // 64 bit difference hash: brightness gradients of a 9x8 grey thumbnail. Survives
+   // scaling, recompression and sensor noise, but not a change in the scene.
+   static quint64 perceptualHash(const cv::Mat & frame);
+   static int distance(quint64 a, quint64 b);
+
+   // Matches a new snapshot, to be stored at path inside the image directory, against the earlier ones
+   // and lists it in the same step, so two snapshots of one picture taken at once are not both stored.
+   // original is the earlier snapshot it matched. Linked: path is now a link to it. Skipped: nothing
+   // is to be stored. Store: the caller writes path, then calls stored(). A snapshot that could not
+   // be linked is stored.
+   Outcome claim(quint64 hash, const QString & camera, qint64 msTimestamp, const QString & path, QString & original);
+   // Ends a Store claim, the snapshot stays listed only if it was written.
+   void stored(const QString & path, bool written);
+
+private:
+   bool open();
+   void insert(const SnapshotIndexEntry & entry);
+   // Called with m_mutex held.
+   QString findDuplicate(quint64 hash) const;
+   void append(const SnapshotIndexEntry & entry);
+   static bool link(const QString & target, const QString & path);
+
+   QString m_directory;
+   Mode m_mode = Link;
+   int m_distance = DEFAULT_SNAPSHOT_DISTANCE;
+
+   QMutex m_mutex;                // Guards everything below
+   bool m_opened = false;
+   QFile m_index;                 // Opened for appending
+   QVector<SnapshotIndexEntry> m_entries;
+   QMultiHash<quint16, int> m_bands[SNAPSHOT_HASH_BANDS];   // Band value to entries
+   QHash<QString, SnapshotIndexEntry> m_claims;              // Being written, by path; they count as existing
+};
+
+#endif // SNAPSHOTSTORE_H
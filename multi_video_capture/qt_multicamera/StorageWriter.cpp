@@ -0,0 +1,426 @@
+#include "StorageWriter.h"
+#include "ThreadPlacement.h"
+#include "TraceRecorder.h"
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QDebug>
+#include <climits>
+#include <cstring>
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define IO_URING_QUEUE_DEPTH 64
+// Start writeback after this much so the kernel never has to flush one huge burst.
+#define WRITEBACK_KICK_BYTES (8 * STANDARD_MB)
+
+StorageWriter::StorageWriter(qint64 maxQueuedBytes, qint64 preallocateChunk, QObject * parent)
+    : QThread(parent), m_maxQueuedBytes(maxQueuedBytes), m_preallocateChunk(preallocateChunk)
+{
+#ifdef HAVE_LIBURING
+   struct io_uring * ring = new struct io_uring;
+   if (io_uring_queue_init(IO_URING_QUEUE_DEPTH, ring, 0) == 0) m_ring = ring;
+   else {
+      qDebug() << "io_uring is not available, writing synchronously.";
+      delete ring;
+   }
+#endif
+   start();
+}
+
+StorageWriter::~StorageWriter()
+{
+   {
+      QMutexLocker lock(&m_mutex);
+      m_stopping = true;
+      m_queued.wakeAll();
+      m_drained.wakeAll();
+   }
+   wait();
+
+   // Anything its owner forgot to close.
+   foreach (int handle, m_files.keys()) closeFile(handle);
+
+#ifdef HAVE_LIBURING
+   if (m_ring) {
+      io_uring_queue_exit((struct io_uring *) m_ring);
+      delete (struct io_uring *) m_ring;
+   }
+#endif
+}
+
+int StorageWriter::open(const QString & path, qint64 preallocateBytes)
+{
+   File * file = new File;
+   file->path = path;
+   file->volume = volumeOf(path);
+   file->preallocateChunk = preallocateBytes > 0 ? preallocateBytes : m_preallocateChunk;
+#ifdef Q_OS_UNIX
+   file->fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   bool opened = file->fd >= 0;
+#else
+   file->qfile = new QFile(path);
+   bool opened = file->qfile->open(QIODevice::WriteOnly | QIODevice::Truncate);
+#endif
+   if (!opened) {
+      qDebug() << "Failed to open" << path << "for writing.";
+      delete file->qfile;
+      delete file;
+      return -1;
+   }
+
+   QMutexLocker lock(&m_mutex);
+   int handle = m_nextHandle++;
+   m_files.insert(handle, file);
+   Volume & volume = m_volumes[file->volume];
+   if (volume.stats.volume.isEmpty()) {
+      volume.stats.volume = file->volume;
+      volume.sinceLastStats.start();
+   }
+   return handle;
+}
+
+QString StorageWriter::volumeOf(const QString & path)
+{
+   QString directory = QFileInfo(path).absolutePath();
+   {
+      QMutexLocker lock(&m_mutex);
+      auto it = m_volumeOfDirectory.constFind(directory);
+      if (it != m_volumeOfDirectory.constEnd()) return it.value();
+   }
+   QString volume = QStorageInfo(directory).rootPath();
+   QMutexLocker lock(&m_mutex);
+   m_volumeOfDirectory.insert(directory, volume);
+   return volume;
+}
+
+bool StorageWriter::append(int handle, const QByteArray & data, bool force)
+{
+   QMutexLocker lock(&m_mutex);
+   File * file = m_files.value(handle);
+   if (!file || file->closing) return false;
+   // Anything larger than the whole queue still goes in once the queue is empty.
+   // The queue is also the recording backlog in the memory budget.
+   while (!force && m_waitWhenFull && m_queuedBytes > 0 && !m_stopping
+          && (m_queuedBytes + data.size() > m_maxQueuedBytes || !MemoryBudget::fits(data.size())))
+      m_drained.wait(&m_mutex);
+   if (!force && !m_waitWhenFull && (m_queuedBytes + data.size() > m_maxQueuedBytes || !MemoryBudget::fits(data.size()))) {
+      m_volumes[file->volume].stats.droppedWrites++;
+      return false;
+   }
+
+   Op op;
+   op.handle = handle;
+   op.offset = file->appendOffset;
+   op.data = data;
+   file->appendOffset += data.size();
+   m_queue.append(op);
+   m_queuedBytes += data.size();
+   m_held.set(m_queuedBytes);
+   m_queued.wakeAll();
+   return true;
+}
+
+void StorageWriter::writeAt(int handle, qint64 offset, const QByteArray & data)
+{
+   QMutexLocker lock(&m_mutex);
+   File * file = m_files.value(handle);
+   if (!file || file->closing) return;
+
+   Op op;
+   op.handle = handle;
+   op.offset = offset;
+   op.data = data;
+   m_queue.append(op);
+   m_queuedBytes += data.size();
+   m_held.set(m_queuedBytes);
+   m_queued.wakeAll();
+}
+
+void StorageWriter::close(int handle)
+{
+   QMutexLocker lock(&m_mutex);
+   File * file = m_files.value(handle);
+   if (!file || file->closing) return;
+   file->closing = true;
+
+   Op op;
+   op.type = Op::Close;
+   op.handle = handle;
+   m_queue.append(op);
+   m_queued.wakeAll();
+}
+
+QList<StorageStats> StorageWriter::stats()
+{
+   QMutexLocker lock(&m_mutex);
+   QList<StorageStats> all;
+   for (auto it = m_volumes.begin(); it != m_volumes.end(); ++it) {
+      Volume & volume = it.value();
+      qint64 msElapsed = volume.sinceLastStats.restart();
+      if (msElapsed > 0)
+         volume.stats.bytesPerSecond = (volume.stats.bytesWritten - volume.bytesAtLastStats) * 1000.0 / msElapsed;
+      volume.bytesAtLastStats = volume.stats.bytesWritten;
+      volume.stats.queuedWrites = 0;
+      volume.stats.queuedBytes = 0;
+      all.append(volume.stats);
+   }
+   // The queue is short, attributing it to volumes on demand is cheaper than keeping counts.
+   foreach (const Op & op, m_queue) {
+      File * file = m_files.value(op.handle);
+      if (!file || op.type != Op::Write) continue;
+      for (StorageStats & stats : all) {
+         if (stats.volume != file->volume) continue;
+         stats.queuedWrites++;
+         stats.queuedBytes += op.data.size();
+      }
+   }
+   if (!all.isEmpty()) all.first().queuedWrites += m_inFlightWrites;
+   return all;
+}
+
+void StorageWriter::run()
+{
+   ThreadPlacement::enter(ThreadPlacement::Storage, "storage");
+   forever {
+      QList<Op> batch;
+      qint64 batchBytes = 0;
+      {
+         QMutexLocker lock(&m_mutex);
+         while (m_queue.isEmpty() && !m_stopping) m_queued.wait(&m_mutex);
+         if (m_queue.isEmpty()) break; // Stopping, and everything is written.
+         batch.swap(m_queue);
+         m_inFlightWrites = batch.size();
+      }
+      for (const Op & op : batch) batchBytes += op.data.size();
+      {
+         TRACE_SCOPE("storage write");
+         writeBatch(batch);
+      }
+
+      QMutexLocker lock(&m_mutex);
+      m_queuedBytes -= batchBytes;
+      m_held.set(m_queuedBytes);
+      m_inFlightWrites = 0;
+      m_drained.wakeAll();
+   }
+   ThreadPlacement::leave();
+}
+
+void StorageWriter::writeBatch(QList<Op> & batch)
+{
+   // Writes are submitted together; a close waits for the writes queued before it.
+   QList<Op *> group;
+   for (Op & op : batch) {
+      if (op.type == Op::Close) {
+         writeGroup(group);
+         closeFile(op.handle);
+         continue;
+      }
+      // The writes of a group complete in any order, so one that overwrites another
+      // (a header patched by writeAt) waits until the earlier one is on disk.
+      if (overlaps(group, op)) writeGroup(group);
+      group.append(&op);
+      if (group.size() == IO_URING_QUEUE_DEPTH) writeGroup(group);
+   }
+   writeGroup(group);
+}
+
+bool StorageWriter::overlaps(const QList<Op *> & group, const Op & op)
+{
+   for (const Op * other : group) {
+      if (other->handle != op.handle) continue;
+      if (op.offset < other->offset + other->data.size() && other->offset < op.offset + op.data.size()) return true;
+   }
+   return false;
+}
+
+void StorageWriter::writeGroup(QList<Op *> & group)
+{
+   if (group.isEmpty()) return;
+
+   QList<File *> files;
+   {
+      QMutexLocker lock(&m_mutex);
+      for (Op * op : group) files.append(m_files.value(op->handle));
+   }
+
+#ifdef HAVE_LIBURING
+   if (m_ring) {
+      struct io_uring * ring = (struct io_uring *) m_ring;
+      int submitted = 0;
+      for (int i = 0; i < group.size(); ++i) {
+         if (!files.at(i)) continue;
+         ensureAllocated(*files.at(i), group.at(i)->offset + group.at(i)->data.size());
+         struct io_uring_sqe * sqe = io_uring_get_sqe(ring);
+         if (!sqe) {
+            writeSynchronously(*group.at(i), *files.at(i));
+            continue;
+         }
+         io_uring_prep_write(sqe, files.at(i)->fd, group.at(i)->data.constData(), (unsigned) group.at(i)->data.size(),
+                             (__u64) group.at(i)->offset);
+         io_uring_sqe_set_data(sqe, (void *)(quintptr) i);
+         submitted++;
+      }
+      io_uring_submit_and_wait(ring, submitted);
+      // Every completion is reaped, even after an error: the buffers belong to the kernel until then.
+      for (int done = 0; done < submitted; ) {
+         struct io_uring_cqe * cqe;
+         int error = io_uring_wait_cqe(ring, &cqe);
+         if (error < 0) {
+            if (error != -EINTR && error != -EAGAIN) {
+               qDebug() << "Waiting for io_uring completions failed:" << strerror(-error);
+               msleep(1);
+            }
+            continue;
+         }
+         int i = (int)(quintptr) io_uring_cqe_get_data(cqe);
+         int result = cqe->res;
+         io_uring_cqe_seen(ring, cqe);
+         done++;
+
+         Op & op = *group.at(i);
+         File & file = *files.at(i);
+         if (result < 0) writeFailed(file, op, -result);
+         int written = qMax(0, result);
+         accountWrite(file, op, written);
+         if (written < op.data.size()) {
+            // Short write or error, finish it the slow way.
+            op.offset += written;
+            op.data = op.data.mid(written);
+            writeSynchronously(op, file);
+         }
+      }
+      group.clear();
+      return;
+   }
+#endif
+
+   for (int i = 0; i < group.size(); ++i) {
+      if (!files.at(i)) continue;
+      ensureAllocated(*files.at(i), group.at(i)->offset + group.at(i)->data.size());
+      writeSynchronously(*group.at(i), *files.at(i));
+   }
+   group.clear();
+}
+
+void StorageWriter::writeSynchronously(Op & op, File & file)
+{
+#ifdef Q_OS_UNIX
+   const char * data = op.data.constData();
+   qint64 left = op.data.size(), offset = op.offset;
+   while (left > 0) {
+      ssize_t written = ::pwrite(file.fd, data, (size_t) left, (off_t) offset);
+      if (written < 0) {
+         if (errno == EINTR) continue;
+         writeFailed(file, op, errno);
+         break;
+      }
+      data += written; left -= written; offset += written;
+   }
+   accountWrite(file, op, op.data.size() - left);
+#else
+   file.qfile->seek(op.offset);
+   accountWrite(file, op, qMax<qint64>(0, file.qfile->write(op.data)));
+#endif
+}
+
+void StorageWriter::ensureAllocated(File & file, qint64 end)
+{
+#ifdef Q_OS_LINUX
+   if (end <= file.allocated) return;
+   qint64 allocate = (end + file.preallocateChunk - 1) / file.preallocateChunk * file.preallocateChunk;
+   // Extents reserved up front keep the file contiguous and the allocator out of the write path. The size is
+   // left alone, so a file still being written (or left by a crash) ends at its last write, not in zeros.
+   if (fallocate(file.fd, FALLOC_FL_KEEP_SIZE, file.allocated, allocate - file.allocated) == 0) file.allocated = allocate;
+   else file.allocated = LLONG_MAX; // Not supported by this filesystem, stop asking.
+#else
+   Q_UNUSED(file); Q_UNUSED(end);
+#endif
+}
+
+void StorageWriter::accountWrite(File & file, const Op & op, qint64 written)
+{
+   file.size = qMax(file.size, op.offset + written);
+   if (written > 0) {
+      // Usually one growing range, a patched header widens it back to the start.
+      if (file.unsynced == 0) {
+         file.unsyncedStart = op.offset;
+         file.unsyncedEnd = op.offset + written;
+      } else {
+         file.unsyncedStart = qMin(file.unsyncedStart, op.offset);
+         file.unsyncedEnd = qMax(file.unsyncedEnd, op.offset + written);
+      }
+      file.unsynced += written;
+   }
+   double msWriteback = -1;
+#ifdef Q_OS_LINUX
+   if (file.unsynced >= WRITEBACK_KICK_BYTES) {
+      // Only starts writeback, but blocks while the device queue is full, which shows a disk falling behind.
+      QElapsedTimer writebackTimer;
+      writebackTimer.start();
+      sync_file_range(file.fd, file.unsyncedStart, file.unsyncedEnd - file.unsyncedStart, SYNC_FILE_RANGE_WRITE);
+      msWriteback = writebackTimer.nsecsElapsed() / 1e6;
+      file.unsynced = 0;
+   }
+#endif
+   QMutexLocker lock(&m_mutex);
+   StorageStats & stats = m_volumes[file.volume].stats;
+   stats.bytesWritten += written;
+   if (msWriteback >= 0) {
+      stats.msLastWriteback = msWriteback;
+      stats.msMaxWriteback = qMax(stats.msMaxWriteback, msWriteback);
+   }
+}
+
+void StorageWriter::writeFailed(File & file, Op & op, int error)
+{
+   op.error = error;
+   qDebug() << "Write of" << op.data.size() << "bytes at" << op.offset << "to" << file.path << "failed:" << strerror(error);
+   QMutexLocker lock(&m_mutex);
+   m_volumes[file.volume].stats.failedWrites++;
+}
+
+void StorageWriter::closeFile(int handle)
+{
+   File * file;
+   {
+      QMutexLocker lock(&m_mutex);
+      file = m_files.take(handle);
+   }
+   if (!file) return;
+
+   QElapsedTimer fsyncTimer;
+#ifdef Q_OS_UNIX
+   // Drop whatever was preallocated past the end.
+#ifdef Q_OS_LINUX
+   if (file->allocated > file->size && file->allocated != LLONG_MAX)
+      fallocate(file->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, file->size, file->allocated - file->size);
+#endif
+   if (ftruncate(file->fd, (off_t) file->size) != 0) qDebug() << "Failed to trim" << file->path;
+   fsyncTimer.start();
+#ifdef Q_OS_LINUX
+   fdatasync(file->fd);
+#else
+   fsync(file->fd);
+#endif
+   double msFsync = fsyncTimer.nsecsElapsed() / 1e6;
+   ::close(file->fd);
+#else
+   fsyncTimer.start();
+   file->qfile->close();
+   double msFsync = fsyncTimer.nsecsElapsed() / 1e6;
+   delete file->qfile;
+#endif
+
+   QMutexLocker lock(&m_mutex);
+   StorageStats & stats = m_volumes[file->volume].stats;
+   stats.msLastFsync = msFsync;
+   stats.msMaxFsync = qMax(stats.msMaxFsync, msFsync);
+   delete file;
+}
@@ -0,0 +1,122 @@
+#ifndef STORAGEWRITER_H
+#define STORAGEWRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QMap>
+#include <QFile>
+#include "MemoryBudget.h"
+
+#define STANDARD_MB ((qint64)1024*1024)
+#define DEFAULT_STORAGE_QUEUE_LIMIT (256 * STANDARD_MB)
+#define DEFAULT_STORAGE_PREALLOCATE (64 * STANDARD_MB)
+
+// Write statistics for one volume (mount point).
+struct StorageStats {
+   QString volume;
+   quint64 bytesWritten = 0;
+   double bytesPerSecond = 0;     // Since the previous call to StorageWriter::stats()
+   int queuedWrites = 0;
+   qint64 queuedBytes = 0;
+   double msLastFsync = 0, msMaxFsync = 0;
+   double msLastWriteback = 0, msMaxWriteback = 0;   // sync_file_range() started every few MB
+   quint64 droppedWrites = 0;     // Refused because the queue was full
+   quint64 failedWrites = 0;      // The disk returned an error, retried once synchronously
+};
+
+// All recording and snapshot files are written through here, on one thread so
+// capture threads never block on the disk. Files are preallocated in large
+// chunks, writes are batched through io_uring when built with liburing (plain
+// pwrite otherwise), writeback is started early so dirty pages do not pile up
+// into one big stall, and throughput is accounted per volume.
+class StorageWriter : public QThread {
+public:
+   explicit StorageWriter(qint64 maxQueuedBytes = DEFAULT_STORAGE_QUEUE_LIMIT,
+                          qint64 preallocateChunk = DEFAULT_STORAGE_PREALLOCATE, QObject * parent = nullptr);
+   ~StorageWriter();
+
+   bool usesIoUring() const { return m_ring != nullptr; }
+   // Make append() wait for room instead of refusing, for offline work where nothing may be dropped.
+   void setWaitWhenFull(bool wait) { QMutexLocker lock(&m_mutex); m_waitWhenFull = wait; }
+
+   // Creates (truncates) the file. preallocateBytes of 0 uses the default chunk. Returns -1 on failure.
+   int open(const QString & path, qint64 preallocateBytes = 0);
+   // Queues data at the end of the file. Without force the write is refused (false) when the queue is full,
+   // or waits for room if setWaitWhenFull().
+   bool append(int handle, const QByteArray & data, bool force = false);
+   // Queues data at an offset already written, e.g. to patch a header.
+   void writeAt(int handle, qint64 offset, const QByteArray & data);
+   // Flushes, syncs and closes the file once everything queued for it is written.
+   void close(int handle);
+
+   // Every volume written to so far.
+   QList<StorageStats> stats();
+
+protected:
+   void run() override;
+
+private:
+   struct Op {
+      enum Type { Write, Close } type = Write;
+      int handle = -1;
+      qint64 offset = 0;
+      QByteArray data;
+      int error = 0;            // errno of the last failed attempt, 0 if none failed
+   };
+   // Callers only touch appendOffset and closing (with the mutex held), the rest belongs to the writer thread.
+   struct File {
+      QString path;
+      QString volume;
+      int fd = -1;
+      QFile * qfile = nullptr;  // Used where there are no POSIX file descriptors
+      bool closing = false;
+      qint64 appendOffset = 0;  // Where the next append goes, moved on when queued
+      qint64 allocated = 0;
+      qint64 size = 0;          // Highest byte actually written
+      qint64 unsynced = 0;      // Bytes written since writeback was last started
+      qint64 unsyncedStart = 0, unsyncedEnd = 0;   // The range they were written to
+      qint64 preallocateChunk = 0;
+   };
+   struct Volume {
+      StorageStats stats;
+      quint64 bytesAtLastStats = 0;
+      QElapsedTimer sinceLastStats;
+   };
+
+   void writeBatch(QList<Op> & batch);
+   void writeGroup(QList<Op *> & group);
+   static bool overlaps(const QList<Op *> & group, const Op & op);
+   void writeSynchronously(Op & op, File & file);
+   void closeFile(int handle);
+   void ensureAllocated(File & file, qint64 end);
+   void accountWrite(File & file, const Op & op, qint64 written);
+   void writeFailed(File & file, Op & op, int error);
+   QString volumeOf(const QString & path);
+
+   qint64 m_maxQueuedBytes;
+   qint64 m_preallocateChunk;
+
+   QMutex m_mutex;                // Guards everything below
+   QWaitCondition m_queued;
+   QWaitCondition m_drained;
+   bool m_waitWhenFull = false;
+   QList<Op> m_queue;
+   qint64 m_queuedBytes = 0;
+   MemoryBudget::Holding m_held{"storage", MemoryBudget::Storage};   // m_queuedBytes, in the memory budget
+   bool m_stopping = false;
+   int m_inFlightWrites = 0;
+   int m_nextHandle = 0;
+   QHash<int, File *> m_files;
+   QMap<QString, Volume> m_volumes;
+   QHash<QString, QString> m_volumeOfDirectory;   // QStorageInfo is slow to make, files share a few directories
+
+   void * m_ring = nullptr;       // struct io_uring when built with liburing
+};
+
+#endif // STORAGEWRITER_H
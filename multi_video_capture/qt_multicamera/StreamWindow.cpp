@@ -0,0 +1,203 @@
+#include "StreamWindow.h"
+#include "QtCompat.h"
+#include "MosaicComposer.h"
+#include "TraceRecorder.h"
+#include <QPainter>
+#include <QFontMetrics>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QResizeEvent>
+#include <algorithm>
+
+// Gap between a label and the edge of its tile.
+#define WINDOW_LABEL_MARGIN 10
+
+WindowRenderer::WindowRenderer(const QStringList & cameras, QObject * parent) : QObject(parent), m_cameras(cameras)
+{
+   foreach (const QString & camera, m_cameras) {
+      Tile & tile = m_tiles[camera];
+      tile.held.reset(new MemoryBudget::Holding(camera, MemoryBudget::View));
+      renderLabel(camera, tile);
+   }
+}
+
+void WindowRenderer::setImage(const QString & camera, const QImage & image)
+{
+   auto it = m_tiles.find(camera);
+   if (it == m_tiles.end()) return;
+   Tile & tile = it.value();
+   // Copied into the tile's own image, holding on to the converter's would make it allocate a new one every frame.
+   if (image.isNull()) tile.image = QImage();
+   else if (tile.image.size() == image.size() && tile.image.format() == image.format() && tile.image.bytesPerLine() == image.bytesPerLine())
+      std::copy_n(image.constBits(), image.sizeInBytes(), tile.image.bits());
+   else tile.image = image.copy();
+   tile.held->set(tile.image.sizeInBytes());
+   if (!image.isNull()) tile.frames++;
+   scheduleCompose();
+}
+
+void WindowRenderer::setSourceStats(const QString & camera, const QString & stats)
+{
+   auto it = m_tiles.find(camera);
+   if (it == m_tiles.end() || it->stats == stats) return;
+   it->stats = stats;
+   renderLabel(camera, it.value());
+   scheduleCompose();
+}
+
+void WindowRenderer::setRecording(const QString & camera, bool recording)
+{
+   auto it = m_tiles.find(camera);
+   if (it == m_tiles.end()) return;
+   it->recording = recording;
+   it->recordingLabel = recording ? renderText(QStringList("REC"), Qt::red) : QImage();
+   scheduleCompose();
+}
+
+void WindowRenderer::setSize(const QSize & size, qreal devicePixelRatio)
+{
+   if (size == m_size && devicePixelRatio == m_devicePixelRatio) return;
+   bool rerender = devicePixelRatio != m_devicePixelRatio;
+   m_size = size;
+   m_devicePixelRatio = devicePixelRatio;
+   if (rerender) {
+      for (auto it = m_tiles.begin(); it != m_tiles.end(); ++it) {
+         renderLabel(it.key(), it.value());
+         if (it->recording) it->recordingLabel = renderText(QStringList("REC"), Qt::red);
+      }
+   }
+   for (int i = 0; i < m_cameras.size(); ++i) emit tileResized(m_cameras.at(i), tileRect(i).size());
+   if (!m_fpsTimer.isActive()) m_fpsTimer.start(1000, this);
+   scheduleCompose();
+}
+
+void WindowRenderer::scheduleCompose()
+{
+   // Images from several converters arriving together are drawn in one go.
+   if (!m_composeTimer.isActive()) m_composeTimer.start(0, this);
+}
+
+void WindowRenderer::timerEvent(QTimerEvent * event)
+{
+   if (event->timerId() == m_composeTimer.timerId()) {
+      m_composeTimer.stop();
+      compose();
+   } else if (event->timerId() == m_fpsTimer.timerId()) {
+      for (auto it = m_tiles.begin(); it != m_tiles.end(); ++it) {
+         QString fps = "FPS[" + QString::number(it->frames) + "]";
+         it->frames = 0;
+         if (fps == it->fps) continue;
+         it->fps = fps;
+         renderLabel(it.key(), it.value());
+      }
+      scheduleCompose();
+   }
+}
+
+QRect WindowRenderer::tileRect(int index) const
+{
+   // The same grid as the main window.
+   int columns = MosaicComposer::columnsFor(m_cameras.size());
+   int rows = (m_cameras.size() + columns - 1) / qMax(1, columns);
+   int width = m_size.width() / qMax(1, columns), height = m_size.height() / qMax(1, rows);
+   return QRect((index % columns) * width, (index / columns) * height, width, height);
+}
+
+QImage WindowRenderer::renderText(const QStringList & lines, const QColor & color) const
+{
+   QFont font("times", 12);
+   QFontMetrics metrics(font);
+   int width = 1;
+   foreach (const QString & line, lines) width = qMax(width, textAdvance(metrics, line) + 1);
+   QImage image(QSize(width, (metrics.height() + 1) * lines.size()) * m_devicePixelRatio, QImage::Format_ARGB32_Premultiplied);
+   image.setDevicePixelRatio(m_devicePixelRatio);
+   image.fill(Qt::transparent);
+   QPainter painter(&image);
+   painter.setFont(font);
+   painter.setPen(color);
+   for (int i = 0; i < lines.size(); ++i) painter.drawText(0, (metrics.height() + 1) * i + metrics.ascent(), lines.at(i));
+   return image;
+}
+
+void WindowRenderer::renderLabel(const QString & camera, Tile & tile)
+{
+   // Bottom up as in the main window's tiles: stats, name, fps.
+   QStringList lines;
+   if (!tile.stats.isEmpty()) lines.append(tile.stats);
+   lines << camera << tile.fps;
+   tile.label = renderText(lines, Qt::white);
+}
+
+void WindowRenderer::compose()
+{
+   if (m_size.isEmpty()) return;
+   TRACE_SCOPE("compose window");
+   QSize pixels = m_size * m_devicePixelRatio;
+   // Draw into whichever canvas the window has let go of.
+   QImage * canvas = m_canvas[0].isDetached() || m_canvas[0].isNull() ? &m_canvas[0] : &m_canvas[1];
+   if (canvas->size() != pixels) {
+      *canvas = QImage(pixels, QImage::Format_RGB32);
+      canvas->setDevicePixelRatio(m_devicePixelRatio);
+   }
+   QPainter painter(canvas);
+   painter.fillRect(QRect(QPoint(0, 0), m_size), Qt::black);
+   for (int i = 0; i < m_cameras.size(); ++i) {
+      const Tile & tile = m_tiles[m_cameras.at(i)];
+      QRect rect = tileRect(i);
+      if (!tile.image.isNull()) {
+         painter.drawImage(rect, tile.image);
+      } else {
+         painter.setPen(Qt::red);
+         painter.drawRect(rect.adjusted(0, 0, -1, -1));
+      }
+      QSize labelSize = tile.label.size() / m_devicePixelRatio;
+      painter.drawImage(QPoint(rect.left() + WINDOW_LABEL_MARGIN, rect.bottom() - WINDOW_LABEL_MARGIN - labelSize.height()), tile.label);
+      if (!tile.recordingLabel.isNull()) {
+         QSize recordingSize = tile.recordingLabel.size() / m_devicePixelRatio;
+         painter.drawImage(QPoint(rect.right() - WINDOW_LABEL_MARGIN - recordingSize.width(), rect.top() + WINDOW_LABEL_MARGIN), tile.recordingLabel);
+      }
+   }
+   painter.end();
+   emit composed(*canvas);
+}
+
+StreamWindow::StreamWindow(const QString & name, WindowRenderer * renderer, QWidget * parent)
+    : QWidget(parent), m_renderer(renderer)
+{
+   setWindowTitle("Multiple Video Streaming Viewer - " + name);
+   setAttribute(Qt::WA_OpaquePaintEvent);
+   connect(m_renderer, &WindowRenderer::composed, this, &StreamWindow::setComposed);
+   resize(1280, 720);
+}
+
+void StreamWindow::showOn(int screen, bool fullScreen)
+{
+   QList<QScreen *> screens = QGuiApplication::screens();
+   if (screen >= 0 && screen < screens.size()) {
+      QRect geometry = screens.at(screen)->availableGeometry();
+      move(geometry.topLeft());
+      resize(geometry.size());
+   }
+   if (fullScreen) showFullScreen();
+   else show();
+}
+
+void StreamWindow::setComposed(const QImage & image)
+{
+   m_image = image;
+   update();
+}
+
+void StreamWindow::paintEvent(QPaintEvent *)
+{
+   TRACE_SCOPE("paint window");
+   QPainter painter(this);
+   if (m_image.isNull()) painter.fillRect(rect(), Qt::black);
+   else painter.drawImage(rect(), m_image);
+}
+
+void StreamWindow::resizeEvent(QResizeEvent * event)
+{
+   QMetaObject::invokeMethod(m_renderer, "setSize", Qt::QueuedConnection,
+                             Q_ARG(QSize, event->size()), Q_ARG(qreal, devicePixelRatioF()));
+}
@@ -0,0 +1,83 @@
+#ifndef STREAMWINDOW_H
+#define STREAMWINDOW_H
+
+#include <QWidget>
+#include <QObject>
+#include <QImage>
+#include <QHash>
+#include <QBasicTimer>
+#include <QStringList>
+#include <QSharedPointer>
+#include "MemoryBudget.h"
+
+// Lays out and paints the tiles of one StreamWindow on a thread of its own. The
+// converters hand it images already at tile size; it draws them, with their
+// labels, into one image the size of the window and hands that to the window,
+// so the gui thread does a single blit per window however many cameras it shows.
+class WindowRenderer : public QObject {
+   Q_OBJECT
+public:
+   explicit WindowRenderer(const QStringList & cameras, QObject * parent = nullptr);
+
+   QStringList cameras() const { return m_cameras; }
+
+   // A null image blanks the tile, e.g. when its stream is removed.
+   Q_SLOT void setImage(const QString & camera, const QImage & image);
+   Q_SLOT void setSourceStats(const QString & camera, const QString & stats);
+   Q_SLOT void setRecording(const QString & camera, bool recording);
+   Q_SLOT void setSize(const QSize & size, qreal devicePixelRatio);
+
+   Q_SIGNAL void composed(const QImage & image);
+   // Logical size of each camera's tile, so its converter and decoder produce no more than that.
+   Q_SIGNAL void tileResized(const QString & camera, const QSize & size);
+
+private:
+   struct Tile {
+      QImage image;
+      QString stats;
+      bool recording = false;
+      int frames = 0;          // Since the last fps update
+      QString fps = "FPS[-]";
+      QImage label;            // Name, fps and stats, rendered when they change
+      QImage recordingLabel;
+      QSharedPointer<MemoryBudget::Holding> held;
+   };
+
+   void timerEvent(QTimerEvent * event) override;
+   void compose();
+   void renderLabel(const QString & camera, Tile & tile);
+   QImage renderText(const QStringList & lines, const QColor & color) const;
+   QRect tileRect(int index) const;
+   void scheduleCompose();
+
+   QStringList m_cameras;
+   QHash<QString, Tile> m_tiles;
+   QSize m_size;
+   qreal m_devicePixelRatio = 1;
+   QImage m_canvas[2];           // One may still be on screen while the other is drawn
+   QBasicTimer m_composeTimer;
+   QBasicTimer m_fpsTimer;
+};
+
+// A top level window showing the tiles its renderer composes. Display only:
+// recording, snapshots and focus stay with the main window.
+class StreamWindow : public QWidget {
+   Q_OBJECT
+public:
+   // renderer lives on its own thread, the window only talks to it through queued calls.
+   StreamWindow(const QString & name, WindowRenderer * renderer, QWidget * parent = nullptr);
+
+   // Screen by its number in QGuiApplication::screens(), -1 leaves it where the window system puts it.
+   void showOn(int screen, bool fullScreen);
+
+   Q_SLOT void setComposed(const QImage & image);
+
+private:
+   void paintEvent(QPaintEvent *) override;
+   void resizeEvent(QResizeEvent *) override;
+
+   WindowRenderer * m_renderer;
+   QImage m_image;
+};
+
+#endif // STREAMWINDOW_H
@@ -0,0 +1,180 @@
+#include "ThreadPlacement.h"
+#include "QtCompat.h"
+#include "TraceRecorder.h"
+#include <QMutex>
+#include <QThread>
+#include <QMap>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <cstring>
+#include <cerrno>
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+struct Entered {
+   QString name;
+   ThreadPlacement::Stage stage;
+#ifdef Q_OS_LINUX
+   pid_t tid;
+   bool haveCpuClock;
+   clockid_t cpuClock;
+#endif
+   qint64 nsCpuAtLastUsage = 0;
+   qint64 nsWallAtLastUsage = 0;
+};
+
+QMutex g_mutex;
+ThreadPlacement::Policy g_stagePolicies[ThreadPlacement::StageCount];
+QMap<QString, ThreadPlacement::Policy> g_namedPolicies;
+QMap<Qt::HANDLE, Entered> g_entered;
+QElapsedTimer g_wall;
+
+#ifdef Q_OS_LINUX
+qint64 cpuNanoseconds(clockid_t clock)
+{
+   struct timespec ts;
+   if (clock_gettime(clock, &ts) != 0) return 0;
+   return (qint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Field 39 of /proc/<pid>/task/<tid>/stat, the CPU the thread last ran on.
+int lastCpuOf(pid_t tid)
+{
+   QFile stat(QString("/proc/self/task/%1/stat").arg(tid));
+   if (!stat.open(QIODevice::ReadOnly)) return -1;
+   QByteArray line = stat.readAll();
+   // The command name can hold spaces, count fields after its closing bracket (field 2).
+   QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+   return fields.size() > 36 ? fields.at(36).toInt() : -1;
+}
+#endif
+
+}
+
+const char * ThreadPlacement::stageName(Stage stage)
+{
+   static const char * names[StageCount] = { "gui", "capture", "convert", "encode", "storage", "serve", "render" };
+   return (stage >= 0 && stage < StageCount) ? names[stage] : "unknown";
+}
+
+QList<int> ThreadPlacement::parseCpuList(const QString & list)
+{
+   QList<int> cpus;
+   foreach (const QString & part, list.split(',', SKIP_EMPTY_PARTS)) {
+      QStringList range = part.trimmed().split('-');
+      bool ok, ok2 = true;
+      int first = range.at(0).toInt(&ok);
+      int last = range.size() > 1 ? range.at(1).toInt(&ok2) : first;
+      if (!ok || !ok2 || first < 0 || last < first) {
+         qDebug() << "Ignoring CPU list entry" << part;
+         continue;
+      }
+      for (int cpu = first; cpu <= last; ++cpu) if (!cpus.contains(cpu)) cpus.append(cpu);
+   }
+   return cpus;
+}
+
+QList<int> ThreadPlacement::numaNodeCpus(int node)
+{
+   QFile cpulist(QString("/sys/devices/system/node/node%1/cpulist").arg(node));
+   if (!cpulist.open(QIODevice::ReadOnly)) {
+      qDebug() << "No NUMA node" << node;
+      return QList<int>();
+   }
+   return parseCpuList(QString::fromLatin1(cpulist.readAll()).trimmed());
+}
+
+void ThreadPlacement::setPolicy(Stage stage, const Policy & policy)
+{
+   QMutexLocker lock(&g_mutex);
+   if (stage >= 0 && stage < StageCount) g_stagePolicies[stage] = policy;
+}
+
+void ThreadPlacement::setPolicy(const QString & name, const Policy & policy)
+{
+   QMutexLocker lock(&g_mutex);
+   g_namedPolicies[name] = policy;
+}
+
+void ThreadPlacement::enter(Stage stage, const QString & name)
+{
+   QMutexLocker lock(&g_mutex);
+   Policy policy = g_namedPolicies.value(name, g_stagePolicies[stage]);
+   if (!g_wall.isValid()) g_wall.start();
+
+   Entered entered;
+   entered.name = name;
+   entered.stage = stage;
+   entered.nsWallAtLastUsage = g_wall.nsecsElapsed();
+#ifdef Q_OS_LINUX
+   entered.tid = (pid_t) syscall(SYS_gettid);
+   entered.haveCpuClock = pthread_getcpuclockid(pthread_self(), &entered.cpuClock) == 0;
+   if (entered.haveCpuClock) entered.nsCpuAtLastUsage = cpuNanoseconds(entered.cpuClock);
+
+   if (!policy.cpus.isEmpty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      foreach (int cpu, policy.cpus) if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+      int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if (error) qDebug() << "Could not pin" << name << "to its CPUs:" << strerror(error);
+   }
+   if (policy.realtimePriority > 0) {
+      struct sched_param param;
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = qBound(sched_get_priority_min(SCHED_FIFO), policy.realtimePriority, sched_get_priority_max(SCHED_FIFO));
+      int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+      // Needs CAP_SYS_NICE or an rtprio limit, the nice value still applies without it.
+      if (error) qDebug() << "Could not make" << name << "real time:" << strerror(error);
+   }
+   // On Linux the nice value is per thread when given the thread id.
+   if (policy.niceSet && setpriority(PRIO_PROCESS, (id_t) entered.tid, policy.nice) != 0)
+      qDebug() << "Could not set nice" << policy.nice << "for" << name << ":" << strerror(errno);
+#else
+   Q_UNUSED(policy);
+#endif
+   g_entered.insert(QThread::currentThreadId(), entered);
+   TraceRecorder::nameThread(name);
+}
+
+void ThreadPlacement::leave()
+{
+   QMutexLocker lock(&g_mutex);
+   g_entered.remove(QThread::currentThreadId());
+}
+
+QList<ThreadPlacement::Usage> ThreadPlacement::usage()
+{
+   QMutexLocker lock(&g_mutex);
+   QList<Usage> all;
+   qint64 nsWall = g_wall.isValid() ? g_wall.nsecsElapsed() : 0;
+   for (auto it = g_entered.begin(); it != g_entered.end(); ++it) {
+      Entered & entered = it.value();
+      Usage usage;
+      usage.name = entered.name;
+      usage.stage = entered.stage;
+      usage.cpuPercent = 0;
+      usage.lastCpu = -1;
+#ifdef Q_OS_LINUX
+      // The thread cannot have exited, it would have had to leave() first.
+      if (entered.haveCpuClock) {
+         qint64 nsCpu = cpuNanoseconds(entered.cpuClock);
+         qint64 nsElapsed = nsWall - entered.nsWallAtLastUsage;
+         if (nsElapsed > 0) usage.cpuPercent = (nsCpu - entered.nsCpuAtLastUsage) * 100.0 / nsElapsed;
+         entered.nsCpuAtLastUsage = nsCpu;
+      }
+      usage.lastCpu = lastCpuOf(entered.tid);
+#endif
+      entered.nsWallAtLastUsage = nsWall;
+      all.append(usage);
+   }
+   return all;
+}
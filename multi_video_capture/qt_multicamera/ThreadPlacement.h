@@ -0,0 +1,47 @@
+#ifndef THREADPLACEMENT_H
+#define THREADPLACEMENT_H
+
+#include <QList>
+#include <QString>
+
+// Where and how urgently each pipeline thread runs. A policy is set per stage
+// (and optionally per named thread, e.g. one camera's capture) before the
+// threads start, then every thread calls enter() on itself as it starts and
+// leave() before it ends. Linux only, elsewhere threads are just accounted.
+class ThreadPlacement {
+public:
+   enum Stage { Gui, Capture, Convert, Encode, Storage, Serve, Render, StageCount };
+
+   struct Policy {
+      QList<int> cpus;             // Empty is any CPU
+      bool niceSet = false;
+      int nice = 0;                // -20 (most favoured) to 19
+      int realtimePriority = 0;    // SCHED_FIFO 1 to 99, 0 leaves the normal scheduler
+   };
+
+   struct Usage {
+      QString name;
+      Stage stage;
+      double cpuPercent;           // Of one CPU, since the previous call to usage()
+      int lastCpu;                 // -1 if not known
+   };
+
+   static const char * stageName(Stage stage);
+   // "0-3,8,10-11" style lists, as in /sys and taskset.
+   static QList<int> parseCpuList(const QString & list);
+   // The CPUs of a NUMA node. Memory a thread touches first is then local to it too.
+   static QList<int> numaNodeCpus(int node);
+
+   static void setPolicy(Stage stage, const Policy & policy);
+   // Overrides the stage policy for the thread entering with this name.
+   static void setPolicy(const QString & name, const Policy & policy);
+
+   // Called on the thread itself.
+   static void enter(Stage stage, const QString & name);
+   static void leave();
+
+   // Every thread that entered and has not left.
+   static QList<Usage> usage();
+};
+
+#endif // THREADPLACEMENT_H
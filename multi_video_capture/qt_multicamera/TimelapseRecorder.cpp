@@ -0,0 +1,111 @@
+#include "TimelapseRecorder.h"
+#include <QDateTime>
+#include <QDir>
+#include <QDebug>
+
+// Frames are scored on a thumbnail this wide, plenty to rank them and cheap for every frame.
+#define TIMELAPSE_SCORE_WIDTH 160
+#define TIMELAPSE_JPEG_QUALITY 90
+
+TimelapseRecorder::Selection TimelapseRecorder::selectionFromString(const QString & name)
+{
+   if (name.compare("sharpest", Qt::CaseInsensitive) == 0) return Sharpest;
+   if (name.compare("changed", Qt::CaseInsensitive) == 0) return MostChanged;
+   return First;
+}
+
+TimelapseRecorder::TimelapseRecorder(StorageWriter * storage, const QString & directory, const QString & name,
+                                     int msInterval, Selection selection, int playbackFramesPerSecond)
+    : m_storage(storage), m_directory(directory), m_name(name), m_msInterval(qMax(1, msInterval)),
+      m_selection(selection), m_playbackFps(qMax(1, playbackFramesPerSecond))
+{
+}
+
+void TimelapseRecorder::addFrame(const cv::Mat & frame, const cv::Mat & jpeg, cv::Size size, qint64 msTimestamp)
+{
+   if (frame.empty()) return;
+   if (m_msWindowStart < 0) m_msWindowStart = msTimestamp;
+
+   // The window is over, keep its best frame and start the next window from this one.
+   if (msTimestamp >= m_msWindowStart + m_msInterval) {
+      writeCandidate();
+      m_msWindowStart += (msTimestamp - m_msWindowStart) / m_msInterval * m_msInterval;
+   }
+
+   if (m_selection == First && m_haveCandidate) return;
+   double frameScore = (m_selection == First) ? 0 : score(frame);
+   if (m_haveCandidate && frameScore <= m_candidateScore) return;
+
+   // Copied, the capture reuses its buffers for the next frame.
+   m_haveCandidate = true;
+   m_candidateScore = frameScore;
+   m_msCandidate = msTimestamp;
+   m_candidateSize = size;
+   frame.copyTo(m_candidateFrame);
+   if (jpeg.empty()) m_candidateJpeg.release();
+   else jpeg.copyTo(m_candidateJpeg);
+   if (m_selection == MostChanged) m_thumbnail.copyTo(m_candidateThumbnail);
+}
+
+double TimelapseRecorder::score(const cv::Mat & frame)
+{
+   int width = qMin(TIMELAPSE_SCORE_WIDTH, frame.cols);
+   cv::Size thumbnailSize(width, qMax(1, frame.rows * width / frame.cols));
+   cv::resize(frame, m_work, thumbnailSize, 0, 0, cv::INTER_AREA);
+   cv::cvtColor(m_work, m_thumbnail, cv::COLOR_BGR2GRAY);
+
+   if (m_selection == Sharpest) {
+      // Variance of the Laplacian, blurred or shaken frames have little edge energy.
+      cv::Laplacian(m_thumbnail, m_work, CV_16S);
+      cv::Scalar mean, deviation;
+      cv::meanStdDev(m_work, mean, deviation);
+      return deviation[0] * deviation[0];
+   }
+
+   // MostChanged, compared with the last frame kept. The first frame kept is simply the first.
+   if (m_keptThumbnail.size() != m_thumbnail.size()) return 0;
+   cv::absdiff(m_thumbnail, m_keptThumbnail, m_work);
+   return cv::mean(m_work)[0];
+}
+
+void TimelapseRecorder::writeCandidate()
+{
+   if (!m_haveCandidate) return;
+   m_haveCandidate = false;
+
+   if (m_writer && (m_writer->isFull() || m_fileSize != m_candidateSize)) close();
+   if (!m_writer && !openFile(m_candidateSize)) return;
+
+   if (!m_candidateJpeg.empty()) {
+      m_writer->writeJpeg(m_candidateJpeg.ptr(), (int) m_candidateJpeg.total(), m_msCandidate);
+   } else {
+      std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, TIMELAPSE_JPEG_QUALITY };
+      if (cv::imencode(".jpg", m_candidateFrame, m_encodeBuffer, params))
+         m_writer->writeJpeg(m_encodeBuffer.data(), (int) m_encodeBuffer.size(), m_msCandidate);
+   }
+   if (m_selection == MostChanged) cv::swap(m_candidateThumbnail, m_keptThumbnail);
+}
+
+bool TimelapseRecorder::openFile(cv::Size size)
+{
+   QDir().mkpath(m_directory);
+   QString fileName = m_directory + "/" + m_name + " " + QDateTime::currentDateTime().toString("ddMMyyyy_HHmmss") + ".AVI";
+   m_writer.reset(new MjpegAviWriter(m_storage));
+   if (!m_writer->open(fileName, size.width, size.height, m_playbackFps)) {
+      qDebug() << "Failed to start timelapse" << fileName;
+      m_writer.reset();
+      return false;
+   }
+   m_fileSize = size;
+   qDebug() << "Timelapse of" << m_name << "to" << fileName;
+   return true;
+}
+
+void TimelapseRecorder::close()
+{
+   // The interval in progress still gets its frame.
+   writeCandidate();
+   if (!m_writer) return;
+   m_writer->close();
+   m_writer.reset();
+}
@@ -0,0 +1,57 @@
+#ifndef TIMELAPSERECORDER_H
+#define TIMELAPSERECORDER_H
+
+#include <QString>
+#include <QScopedPointer>
+#include <opencv2/opencv.hpp>
+#include "MjpegAviWriter.h"
+#include "StorageWriter.h"
+
+#define DEFAULT_TIMELAPSE_PLAYBACK_FPS 10
+
+// Keeps one frame out of every interval and writes those straight into an MJPEG
+// AVI, so a long term archive is a small video rather than a folder of JPEGs to
+// stitch together later. Which frame of the interval is kept can be the first
+// (costs nothing), the sharpest or the one most changed since the last kept.
+// Used from the capture thread, alongside any normal recording.
+class TimelapseRecorder {
+public:
+   enum Selection { First, Sharpest, MostChanged };
+   static Selection selectionFromString(const QString & name);
+
+   TimelapseRecorder(StorageWriter * storage, const QString & directory, const QString & name,
+                     int msInterval, Selection selection, int playbackFramesPerSecond = DEFAULT_TIMELAPSE_PLAYBACK_FPS);
+   ~TimelapseRecorder() { close(); }
+
+   // frame is the decoded frame, jpeg the same frame compressed at full size if the source
+   // provides it (written as is), size the size of the recorded frame.
+   void addFrame(const cv::Mat & frame, const cv::Mat & jpeg, cv::Size size, qint64 msTimestamp);
+   // Writes the frame chosen so far for the current interval and closes the file.
+   void close();
+
+private:
+   double score(const cv::Mat & frame);
+   void writeCandidate();
+   bool openFile(cv::Size size);
+
+   StorageWriter * m_storage;
+   QString m_directory, m_name;
+   qint64 m_msInterval;
+   Selection m_selection;
+   int m_playbackFps;
+
+   qint64 m_msWindowStart = -1;
+   bool m_haveCandidate = false;
+   double m_candidateScore = 0;
+   cv::Mat m_candidateFrame, m_candidateJpeg;
+   cv::Size m_candidateSize;
+   qint64 m_msCandidate = 0;
+
+   cv::Mat m_thumbnail, m_keptThumbnail, m_work;
+   cv::Mat m_candidateThumbnail;
+   std::vector<uchar> m_encodeBuffer;
+   QScopedPointer<MjpegAviWriter> m_writer;
+   cv::Size m_fileSize;
+};
+
+#endif // TIMELAPSERECORDER_H
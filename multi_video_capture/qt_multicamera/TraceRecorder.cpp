@@ -0,0 +1,193 @@
+#include "TraceRecorder.h"
+#include <QMutex>
+#include <QList>
+#include <QFile>
+#include <QThread>
+#include <QCoreApplication>
+#include <QDebug>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <vector>
+
+// A thread capturing several cameras records a few hundred events a second, this leaves room to spare.
+#define TRACE_EVENTS_PER_THREAD_SECOND 1024
+#define TRACE_MIN_EVENTS_PER_THREAD 16384
+
+namespace {
+
+struct Event {
+   const char * name;
+   qint64 startNs;
+   qint64 durationNs;      // -1 for an instant event
+};
+
+struct ThreadBuffer {
+   QString name;
+   quintptr tid;
+   std::atomic<quint64> written{0};
+   quint64 writtenAtStart = 0;           // Under g_mutex, to count what this trace overwrote
+   std::atomic<bool> alive{true};
+   std::vector<Event> events;
+};
+
+std::atomic<int> g_eventsPerThread{TRACE_MIN_EVENTS_PER_THREAD};
+std::atomic<bool> g_enabled{false};
+std::atomic<qint64> g_startNs{0};
+QMutex g_mutex;                       // Guards g_buffers, never taken while recording an event
+QList<ThreadBuffer *> g_buffers;
+
+// Lets the buffer outlive its thread until the next start(), so a trace still shows streams that were removed.
+struct ThreadSlot {
+   ThreadBuffer * buffer = nullptr;
+   QString name;
+   ~ThreadSlot() { if (buffer) buffer->alive = false; }
+};
+thread_local ThreadSlot t_slot;
+
+ThreadBuffer * threadBuffer()
+{
+   if (t_slot.buffer) return t_slot.buffer;
+   ThreadBuffer * buffer = new ThreadBuffer;
+   buffer->events.resize((size_t) g_eventsPerThread.load());
+   buffer->tid = (quintptr) QThread::currentThreadId();
+   buffer->name = t_slot.name;
+   if (buffer->name.isEmpty())
+      buffer->name = QThread::currentThread() == QCoreApplication::instance()->thread() ? QString("gui") : QString("thread %1").arg(buffer->tid);
+   QMutexLocker lock(&g_mutex);
+   g_buffers.append(buffer);
+   t_slot.buffer = buffer;
+   return buffer;
+}
+
+void record(const char * name, qint64 startNs, qint64 durationNs)
+{
+   // Only this thread writes its buffer.
+   ThreadBuffer * buffer = threadBuffer();
+   quint64 at = buffer->written.load(std::memory_order_relaxed);
+   buffer->events[at % buffer->events.size()] = { name, startNs, durationNs };
+   buffer->written.store(at + 1, std::memory_order_release);
+}
+
+QByteArray jsonString(const QString & text)
+{
+   QByteArray escaped = text.toUtf8();
+   escaped.replace('\\', "\\\\").replace('"', "\\\"");
+   return '"' + escaped + '"';
+}
+
+}
+
+void TraceRecorder::setEventsPerThread(int events)
+{
+   // Rings are made when their thread first records, so this is only safe before then.
+   QMutexLocker lock(&g_mutex);
+   if (!g_buffers.isEmpty()) {
+      qDebug() << "Trace buffers are already made, keeping" << g_eventsPerThread.load() << "events per thread.";
+      return;
+   }
+   g_eventsPerThread = qMax(1, events);
+}
+
+int TraceRecorder::eventsForSeconds(int seconds)
+{
+   if (seconds <= 0) return TRACE_MIN_EVENTS_PER_THREAD;
+   return (int) qBound<qint64>(TRACE_MIN_EVENTS_PER_THREAD, (qint64) seconds * TRACE_EVENTS_PER_THREAD_SECOND, INT_MAX / 2);
+}
+
+void TraceRecorder::start()
+{
+   QMutexLocker lock(&g_mutex);
+   // Buffers of threads that have ended are dropped, live ones are reused from where they are.
+   for (int i = g_buffers.size() - 1; i >= 0; --i) {
+      if (g_buffers.at(i)->alive) {
+         g_buffers.at(i)->writtenAtStart = g_buffers.at(i)->written.load(std::memory_order_acquire);
+         continue;
+      }
+      delete g_buffers.takeAt(i);
+   }
+   g_startNs = TraceRecorder::nowNs();
+   g_enabled = true;
+}
+
+void TraceRecorder::stop()
+{
+   g_enabled = false;
+}
+
+bool TraceRecorder::isEnabled()
+{
+   return g_enabled.load(std::memory_order_relaxed);
+}
+
+void TraceRecorder::nameThread(const QString & name)
+{
+   t_slot.name = name;
+   if (t_slot.buffer) {
+      QMutexLocker lock(&g_mutex);
+      t_slot.buffer->name = name;
+   }
+}
+
+qint64 TraceRecorder::nowNs()
+{
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TraceRecorder::complete(const char * name, qint64 startNs, qint64 endNs)
+{
+   record(name, startNs, endNs - startNs);
+}
+
+void TraceRecorder::instant(const char * name)
+{
+   record(name, nowNs(), -1);
+}
+
+bool TraceRecorder::write(const QString & path)
+{
+   QFile file(path);
+   if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qDebug() << "Cannot write trace" << path << file.errorString();
+      return false;
+   }
+   qint64 startNs = g_startNs;
+   qint64 pid = QCoreApplication::applicationPid();
+   QByteArray json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+   bool first = true;
+   auto add = [&json, &first](const QByteArray & event) {
+      if (!first) json += ",\n";
+      json += event;
+      first = false;
+   };
+
+   QMutexLocker lock(&g_mutex);
+   foreach (ThreadBuffer * buffer, g_buffers) {
+      add(QString("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%1,\"tid\":%2,\"args\":{\"name\":")
+             .arg(pid).arg(buffer->tid).toUtf8() + jsonString(buffer->name) + "}}");
+      // A thread still recording may overwrite the oldest events as they are read, which only loses those.
+      quint64 written = buffer->written.load(std::memory_order_acquire);
+      quint64 capacity = buffer->events.size();
+      quint64 from = written > capacity ? written - capacity : 0;
+      if (from > buffer->writtenAtStart)
+         qDebug() << "Trace of" << buffer->name << "lost its oldest" << from - buffer->writtenAtStart
+                  << "events, the ring holds" << capacity << "(trace_events_per_thread).";
+      for (quint64 i = from; i < written; ++i) {
+         Event event = buffer->events[i % capacity];
+         if (event.startNs < startNs) continue;
+         // Chrome traces count in microseconds.
+         QByteArray common = QString("\"pid\":%1,\"tid\":%2,\"ts\":%3,\"name\":").arg(pid).arg(buffer->tid)
+                                .arg((event.startNs - startNs) / 1000.0, 0, 'f', 3).toUtf8() + jsonString(QString::fromLatin1(event.name));
+         if (event.durationNs < 0) add("{\"ph\":\"i\",\"s\":\"t\"," + common + "}");
+         else add("{\"ph\":\"X\"," + common + QString(",\"dur\":%1}").arg(event.durationNs / 1000.0, 0, 'f', 3).toUtf8());
+      }
+   }
+   lock.unlock();
+
+   json += "\n]}\n";
+   if (file.write(json) != json.size()) {
+      qDebug() << "Cannot write trace" << path << file.errorString();
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,50 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include <QString>
+
+// Timeline of what each pipeline thread was doing, written as a Chrome trace
+// (chrome://tracing, or ui.perfetto.dev) to see which stage ran late when a
+// stream stutters. Every thread records into a ring of its own, so recording
+// an event takes no lock and costs two clock reads; when tracing is off it is
+// a single relaxed load. Event names must be string literals, they are kept
+// as pointers. A ring that fills overwrites its oldest events, write() logs
+// how many each thread lost.
+class TraceRecorder {
+public:
+   // Size of every thread's ring, from before the first start() on. eventsForSeconds() sizes
+   // it for a trace of that length.
+   static void setEventsPerThread(int events);
+   static int eventsForSeconds(int seconds);
+
+   // Forgets anything recorded before and starts recording.
+   static void start();
+   static void stop();
+   static bool isEnabled();
+
+   // Writes what was recorded since start(), false if the file could not be written.
+   static bool write(const QString & path);
+
+   // The name the calling thread is shown with, e.g. the camera it captures.
+   static void nameThread(const QString & name);
+
+   static qint64 nowNs();
+   static void complete(const char * name, qint64 startNs, qint64 endNs);
+   static void instant(const char * name);
+};
+
+// Records the enclosing block as one event.
+class TraceScope {
+   const char * m_name;
+   qint64 m_startNs;
+public:
+   explicit TraceScope(const char * name) : m_name(name), m_startNs(TraceRecorder::isEnabled() ? TraceRecorder::nowNs() : -1) {}
+   ~TraceScope() { if (m_startNs >= 0) TraceRecorder::complete(m_name, m_startNs, TraceRecorder::nowNs()); }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_INSTANT(name) do { if (TraceRecorder::isEnabled()) TraceRecorder::instant(name); } while (0)
+
+#endif // TRACERECORDER_H
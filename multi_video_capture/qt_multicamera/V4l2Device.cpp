@@ -0,0 +1,175 @@
+#include "V4l2Device.h"
+#include <QDebug>
+#include <cstring>
+#include <cerrno>
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#endif
+
+// Enough for the driver to keep filling while one frame is being processed.
+#define V4L2_BUFFER_COUNT 4
+
+#ifdef Q_OS_LINUX
+
+int V4l2Device::xioctl(unsigned long request, void * arg)
+{
+   int result;
+   do result = ioctl(m_fd, request, arg); while (result == -1 && errno == EINTR);
+   return result;
+}
+
+bool V4l2Device::setFormat(quint32 pixelFormat)
+{
+   struct v4l2_format format;
+   memset(&format, 0, sizeof(format));
+   format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+   if (xioctl(VIDIOC_G_FMT, &format) == -1) return false;
+   // Keep the size the camera is set to, as the OpenCV path does.
+   format.fmt.pix.pixelformat = pixelFormat;
+   format.fmt.pix.field = V4L2_FIELD_ANY;
+   if (xioctl(VIDIOC_S_FMT, &format) == -1 || format.fmt.pix.pixelformat != pixelFormat) return false;
+   m_width = (int) format.fmt.pix.width;
+   m_height = (int) format.fmt.pix.height;
+   m_bytesPerLine = (int) format.fmt.pix.bytesperline;
+   m_mjpeg = pixelFormat == V4L2_PIX_FMT_MJPEG;
+   return true;
+}
+
+bool V4l2Device::open(int index, bool preferMjpeg)
+{
+   close();
+   QByteArray path = "/dev/video" + QByteArray::number(index);
+   m_fd = ::open(path.constData(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+   if (m_fd < 0) {
+      qDebug() << "Cannot open" << path << strerror(errno);
+      return false;
+   }
+
+   struct v4l2_capability capability;
+   memset(&capability, 0, sizeof(capability));
+   quint32 caps = 0;
+   if (xioctl(VIDIOC_QUERYCAP, &capability) == 0)
+      caps = (capability.capabilities & V4L2_CAP_DEVICE_CAPS) ? capability.device_caps : capability.capabilities;
+   if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+      qDebug() << path << "is not a streaming capture device.";
+      close();
+      return false;
+   }
+
+   if (!(preferMjpeg && setFormat(V4L2_PIX_FMT_MJPEG)) && !setFormat(V4L2_PIX_FMT_YUYV)) {
+      qDebug() << path << "offers neither MJPEG nor YUYV.";
+      close();
+      return false;
+   }
+
+   struct v4l2_requestbuffers request;
+   memset(&request, 0, sizeof(request));
+   request.count = V4L2_BUFFER_COUNT;
+   request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+   request.memory = V4L2_MEMORY_MMAP;
+   if (xioctl(VIDIOC_REQBUFS, &request) == -1 || request.count < 2) {
+      qDebug() << path << "has no memory mapped buffers.";
+      close();
+      return false;
+   }
+
+   for (quint32 i = 0; i < request.count; ++i) {
+      struct v4l2_buffer buffer;
+      memset(&buffer, 0, sizeof(buffer));
+      buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      buffer.memory = V4L2_MEMORY_MMAP;
+      buffer.index = i;
+      if (xioctl(VIDIOC_QUERYBUF, &buffer) == -1) {
+         close();
+         return false;
+      }
+      Mapping mapping;
+      mapping.length = buffer.length;
+      mapping.start = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buffer.m.offset);
+      if (mapping.start == MAP_FAILED) {
+         close();
+         return false;
+      }
+      m_buffers.append(mapping);
+      if (xioctl(VIDIOC_QBUF, &buffer) == -1) {
+         close();
+         return false;
+      }
+   }
+
+   int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+   if (xioctl(VIDIOC_STREAMON, &type) == -1) {
+      qDebug() << "Cannot start streaming" << path << strerror(errno);
+      close();
+      return false;
+   }
+   m_streaming = true;
+   m_failed = false;
+   qDebug() << "Streaming" << path << m_width << "x" << m_height << (m_mjpeg ? "MJPEG" : "YUYV");
+   return true;
+}
+
+void V4l2Device::close()
+{
+   if (m_fd < 0) return;
+   if (m_streaming) {
+      int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      xioctl(VIDIOC_STREAMOFF, &type);
+      m_streaming = false;
+   }
+   foreach (const Mapping & mapping, m_buffers) munmap(mapping.start, mapping.length);
+   m_buffers.clear();
+   ::close(m_fd);
+   m_fd = -1;
+}
+
+bool V4l2Device::dequeue(Buffer & buffer)
+{
+   if (m_fd < 0 || m_failed) return false;
+   struct v4l2_buffer v4l2Buffer;
+   memset(&v4l2Buffer, 0, sizeof(v4l2Buffer));
+   v4l2Buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+   v4l2Buffer.memory = V4L2_MEMORY_MMAP;
+   if (xioctl(VIDIOC_DQBUF, &v4l2Buffer) == -1) {
+      if (errno != EAGAIN) {
+         qDebug() << "Camera stopped:" << strerror(errno);
+         m_failed = true;
+      }
+      return false;
+   }
+   if ((int) v4l2Buffer.index >= m_buffers.size()) return false;
+   buffer.index = (int) v4l2Buffer.index;
+   buffer.data = (const uchar *) m_buffers.at(buffer.index).start;
+   buffer.bytesUsed = (int) v4l2Buffer.bytesused;
+   buffer.sequence = v4l2Buffer.sequence;
+   buffer.usTimestamp = (qint64) v4l2Buffer.timestamp.tv_sec * 1000000 + v4l2Buffer.timestamp.tv_usec;
+   // A frame the driver flagged as corrupt is handed back straight away.
+   if (v4l2Buffer.flags & V4L2_BUF_FLAG_ERROR) {
+      requeue(buffer);
+      return false;
+   }
+   return true;
+}
+
+void V4l2Device::requeue(const Buffer & buffer)
+{
+   struct v4l2_buffer v4l2Buffer;
+   memset(&v4l2Buffer, 0, sizeof(v4l2Buffer));
+   v4l2Buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+   v4l2Buffer.memory = V4L2_MEMORY_MMAP;
+   v4l2Buffer.index = (quint32) buffer.index;
+   if (xioctl(VIDIOC_QBUF, &v4l2Buffer) == -1) m_failed = true;
+}
+
+#else
+
+bool V4l2Device::open(int, bool) { return false; }
+void V4l2Device::close() {}
+bool V4l2Device::dequeue(Buffer &) { return false; }
+void V4l2Device::requeue(const Buffer &) {}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef V4L2DEVICE_H
+#define V4L2DEVICE_H
+
+#include <QtGlobal>
+#include <QVector>
+
+// A V4L2 camera opened non-blocking with memory mapped buffers, so it can be
+// waited on with epoll alongside many others instead of blocking a thread in
+// read(). Frames come as MJPEG when the camera offers it (and it is asked
+// for), YUYV otherwise. Linux only, open() fails elsewhere.
+class V4l2Device {
+public:
+   struct Buffer {
+      const uchar * data = nullptr;
+      int bytesUsed = 0;
+      int index = -1;
+      quint32 sequence = 0;    // The driver's frame counter
+      qint64 usTimestamp = 0;  // When the driver captured it
+   };
+
+   ~V4l2Device() { close(); }
+
+   bool open(int index, bool preferMjpeg);
+   void close();
+
+   int fd() const { return m_fd; }
+   bool isMjpeg() const { return m_mjpeg; }
+   int width() const { return m_width; }
+   int height() const { return m_height; }
+   int bytesPerLine() const { return m_bytesPerLine; }
+   // The device went away or stopped streaming.
+   bool failed() const { return m_failed; }
+
+   // Takes the oldest filled buffer, false if none is ready. It must be requeued once done with.
+   bool dequeue(Buffer & buffer);
+   void requeue(const Buffer & buffer);
+
+private:
+   int xioctl(unsigned long request, void * arg);
+   bool setFormat(quint32 pixelFormat);
+
+   struct Mapping {
+      void * start;
+      size_t length;
+   };
+
+   int m_fd = -1;
+   bool m_mjpeg = false;
+   bool m_streaming = false;
+   bool m_failed = false;
+   int m_width = 0, m_height = 0, m_bytesPerLine = 0;
+   QVector<Mapping> m_buffers;
+};
+
+#endif // V4L2DEVICE_H
@@ -1,4 +1,4 @@
-QT = widgets
+QT = widgets network
 CONFIG += c++14
 DEFINES += \
   QT_DEPRECATED_WARNINGS \
@@ -6,6 +6,29 @@ DEFINES += \
   QT_RESTRICTED_CAST_FROM_ASCII
 TEMPLATE = app
 SOURCES = main.cpp \
+    NetworkSource.cpp \
+    MjpegAviWriter.cpp \
+    FrameBus.cpp \
+    MosaicComposer.cpp \
+    PreviewServer.cpp \
+    StorageWriter.cpp \
+    RecordingIndex.cpp \
+    ReviewPlayer.cpp \
+    MosaicRecorder.cpp \
+    TimelapseRecorder.cpp \
+    ThreadPlacement.cpp \
+    V4l2Device.cpp \
+    CaptureReactor.cpp \
+    TraceRecorder.cpp \
+    RawFrameFile.cpp \
+    MemoryBudget.cpp \
+    FrameShare.cpp \
+    OverlayLayers.cpp \
+    FrameChecksum.cpp \
+    SnapshotStore.cpp \
+    StreamWindow.cpp \
+    NodeSource.cpp \
+    LensCorrection.cpp \
     src-cpp-properties/Properties.cpp \
     src-cpp-properties/PropertiesParser.cpp \
     src-cpp-properties/PropertiesUtils.cpp
@@ -13,7 +36,13 @@ SOURCES = main.cpp \
 linux {
 INCLUDEPATH += /usr/local/lib
 INCLUDEPATH += /usr/local/include/opencv4
-LIBS += -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_videoio
+LIBS += -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_videoio -lopencv_imgcodecs -lopencv_calib3d
+LIBS += -lrt
+# Batch the recording writes through io_uring when liburing is installed, otherwise plain pwrite is used.
+packagesExist(liburing) {
+  DEFINES += HAVE_LIBURING
+  LIBS += -luring
+}
 }
 
 windows{
@@ -25,7 +54,8 @@ LIBS += -L C:/development/opencv/build/bin/ \
         -lopencv_imgproc410 \
         -lopencv_highgui410 \
         -lopencv_videoio410 \
-        -lopencv_imgcodecs410
+        -lopencv_imgcodecs410 \
+        -lopencv_calib3d410
 }
 
 macx {
@@ -34,6 +64,31 @@ macx {
 }
 
 HEADERS += \
+    QtCompat.h \
+    NetworkSource.h \
+    MjpegAviWriter.h \
+    FrameBus.h \
+    MosaicComposer.h \
+    PreviewServer.h \
+    StorageWriter.h \
+    RecordingIndex.h \
+    ReviewPlayer.h \
+    MosaicRecorder.h \
+    TimelapseRecorder.h \
+    ThreadPlacement.h \
+    V4l2Device.h \
+    CaptureReactor.h \
+    TraceRecorder.h \
+    RawFrameFile.h \
+    MemoryBudget.h \
+    FrameShare.h \
+    OverlayLayers.h \
+    FrameChecksum.h \
+    SnapshotStore.h \
+    StreamWindow.h \
+    NodeSource.h \
+    NodeProtocol.h \
+    LensCorrection.h \
     include-cpp-properties/Properties.h \
     include-cpp-properties/PropertiesException.h \
     include-cpp-properties/PropertiesParser.h \
@@ -7,6 +7,28 @@
 #include <algorithm>
 #include <opencv2/opencv.hpp>
 #include "include-cpp-properties/PropertiesParser.h"
+#include "NetworkSource.h"
+#include "NodeSource.h"
+#include "MjpegAviWriter.h"
+#include "FrameBus.h"
+#include "PreviewServer.h"
+#include "StorageWriter.h"
+#include "ReviewPlayer.h"
+#include "MosaicRecorder.h"
+#include "TimelapseRecorder.h"
+#include "ThreadPlacement.h"
+#include "V4l2Device.h"
+#include "CaptureReactor.h"
+#include "TraceRecorder.h"
+#include "RawFrameFile.h"
+#include "MemoryBudget.h"
+#include "OverlayLayers.h"
+#include "FrameChecksum.h"
+#include "SnapshotStore.h"
+#include "StreamWindow.h"
+#include "LensCorrection.h"
+#include "FrameShare.h"
+#include "QtCompat.h"
 #include <QtMath>
 #include <QGridLayout>
 #include <QWidget>
@@ -26,10 +48,28 @@
 #define VIDEO_FILE_FRAMES_PER_SECOND 30
 #define CAPTURED_IMAGES_DIRECTORY_PATH "captured/images"
 #define JPEG_FILE_EXTENSION "JPEG"
-#define MJPG_FILE_EXTENSION "MP4"
+#define MJPG_FILE_EXTENSION "AVI"
 #define CAPTURED_VIDEO_DIRECTORY_PATH "captured/videos"
+#define CAPTURED_TIMELAPSE_DIRECTORY_PATH "captured/timelapse"
+#define CAPTURED_TRACES_DIRECTORY_PATH "captured/traces"
+#define CAPTURED_RAW_DIRECTORY_PATH "captured/raw"
+#define CAPTURED_CALIBRATION_DIRECTORY_PATH "captured/calibration"
 #define STANDARD_KB 1024
 #define DISK_SPACE_STOP_RECORDING_LIMIT ((qint64)STANDARD_KB*STANDARD_KB*STANDARD_KB*2)
+#define MS_NETWORK_FRAME_WAIT 100
+#define VIDEO_RECORDING_FRAMES_PER_SECOND 10
+#define RECORDING_JPEG_QUALITY 90
+// A recorded frame is flagged as motion in the index when this share of a small
+// grey thumbnail changed by more than MOTION_PIXEL_THRESHOLD grey levels.
+#define MOTION_THUMBNAIL_WIDTH 32
+#define MOTION_THUMBNAIL_HEIGHT 24
+#define MOTION_PIXEL_THRESHOLD 24
+#define MOTION_CHANGED_PERCENT 2
+// Focus mode, double click a tile to show it large and the others as thumbnails.
+#define FOCUS_THUMBNAIL_SIZE QSize(240, 180)
+#define FOCUS_ZOOM_STEP 1.25
+#define FOCUS_MAX_ZOOM 16.0
+#define DEFAULT_FOCUS_THUMBNAIL_FPS 2
 
 
 Q_DECLARE_METATYPE(cv::Mat)
@@ -47,28 +87,158 @@ struct AddressTracker {
    }
 };
 
+// Snapshots are encoded and stored on a pool of their own. Qt 5 pools have no thread start hook,
+// so each pool thread places itself as the encode stage with the first snapshot it runs, and
+// leaves again when the pool lets the thread go.
+static QThreadPool * snapshotPool()
+{
+   static QThreadPool pool;
+   return &pool;
+}
+
+static void placeSnapshotThread()
+{
+   struct Placed {
+      Placed() { ThreadPlacement::enter(ThreadPlacement::Encode, "snapshot"); }
+      ~Placed() { ThreadPlacement::leave(); }
+   };
+   thread_local Placed placed;
+   Q_UNUSED(placed);
+}
+
 class Capture : public QObject {
    Q_OBJECT
    Q_PROPERTY(cv::Mat frame READ frame NOTIFY frameReady USER true)
    cv::Mat m_frame;
    QBasicTimer m_captureTimer;
    QScopedPointer<cv::VideoCapture> m_videoCapture;
-   QScopedPointer<cv::VideoWriter> m_videoWriter;
+   QScopedPointer<MjpegAviWriter> m_videoWriter;
+   QScopedPointer<NetworkSource> m_networkSource;
+   // A camera of another instance, recorded there: recording and snapshots are asked of the node.
+   QScopedPointer<NodeSource> m_nodeSource;
+   bool m_nodeRecording = false;
+   QString m_nodeStats;
+   QBasicTimer m_statsTimer;
+   int m_msNetworkLatency = DEFAULT_NETWORK_LATENCY_MS;
+   int m_networkJitterFrames = DEFAULT_NETWORK_JITTER_FRAMES;
    int m_cap_api_preference = cv::CAP_ANY;
    AddressTracker m_track;
    int m_msFrameInterval = 0; // Blocking calls to camera mean this is irrelevant. however, for videos this can be too fast and need interval
+   bool m_paced = true;       // False reads files as fast as they decode
+   quint64 m_framesRead = 0;
+   // MJPEG sources hand us the compressed frame (m_jpeg) and the preview (m_frame) is decoded
+   // straight to about the tile size using the JPEG decoder's 1/2, 1/4 or 1/8 DCT scaling.
+   bool m_scaledDecode = true;
+   bool m_compressedSource = false;
+   cv::Mat m_jpeg;
+   cv::Size m_nativeSize;
+   QSize m_previewSize;
+   int m_decodeFlags = cv::IMREAD_COLOR;
+   std::vector<uchar> m_encodeBuffer;
+   // Optionally every frame is also published to shared memory for other processes.
+   QScopedPointer<FrameBusWriter> m_frameBus;
+   bool m_frameBusEnabled = false;
+   int m_frameBusSlots = FRAMEBUS_DEFAULT_SLOTS;
+   StorageWriter * m_storage = nullptr; // Shared by all streams, all files are written through it
+   SnapshotStore * m_snapshots = nullptr; // Shared by all streams, finds snapshots already taken
+   qint64 m_msCaptureTime = 0;          // Wall clock time m_frame was captured
+   QScopedPointer<TimelapseRecorder> m_timelapse;
+   int m_msTimelapseInterval = 0;       // 0 is no timelapse
+   TimelapseRecorder::Selection m_timelapseSelection = TimelapseRecorder::First;
+   cv::Mat m_motionThumbnail, m_motionPrevious, m_motionDifference;
+   // With a reactor webcams are read straight from V4L2 when they have a frame, not polled on the timer.
+   CaptureReactor * m_reactor = nullptr;
+   QScopedPointer<V4l2Device> m_v4l2;
+   bool m_sourceEnded = false;          // A file ran out or the camera went away
+   MemoryBudget::Holding m_held;        // The current frame(s)
+   QList<QSharedPointer<FrameShare>> m_shares; // Copies for the preview server and mosaic recorder
+   MemoryBudget::Holding m_frameBusHeld;
+   // Raw frame files replay the frames they hold, at the pace they were captured unless told otherwise.
+   QScopedPointer<RawFrameReader> m_rawReader;
+   int m_rawNext = 0;
+   qint64 m_msReplayStart = 0;
+   bool m_rawOriginalTiming = true;
+   // Recording can instead keep the frames as delivered, for replaying later.
+   bool m_rawRecording = false;
+   QScopedPointer<RawFrameWriter> m_rawWriter;
+   // Slow sources repeat frames, those are counted and go no further than here.
+   bool m_skipDuplicates = true;
+   bool m_duplicate = false;            // The frame just read is the same as the one before
+   bool m_haveChecksum = false;         // The fields below are of the frame before
+   quint64 m_lastChecksum = 0;
+   quint32 m_lastSequence = 0;          // V4L2 numbers and stamps its frames, no checksum needed
+   qint64 m_usLastTimestamp = 0;
+   quint64 m_duplicateFrames = 0;
+   // Recordings and snapshots can be undistorted at full size, shared with snapshots still being stored.
+   QString m_calibration;
+   bool m_undistortRecording = false;
+   QSharedPointer<LensCorrection> m_lens;
+   bool m_lensPrepared = false;
+   cv::Mat m_recordFrame, m_corrected;
    bool m_delayed_start = false;
    bool m_pausedRecording = false;
 public:
    Capture(QObject *parent = {}) : QObject(parent) { }
+   // Must be set before the capture is started.
+   void setStorageWriter(StorageWriter * storage) { m_storage = storage; }
+   // Frames are copied into it while its consumer wants them. Set before capture starts.
+   void addFrameShare(const QSharedPointer<FrameShare> & share) { m_shares.append(share); }
+   // Must be set before the capture is started, without one every snapshot is stored.
+   void setSnapshotStore(SnapshotStore * snapshots) { m_snapshots = snapshots; }
+   // Must be set before the capture is started, the capture has to live on the reactor's thread.
+   void setReactor(CaptureReactor * reactor) { m_reactor = reactor; }
    ~Capture() { qDebug() << __FUNCTION__ << "reallocations" << m_track.reallocs; }
    Q_SIGNAL void started();
    Q_SIGNAL void cameraNamed(QString);
+   Q_SIGNAL void sourceStatsChanged(QString);
+   // A file source has been read to the end (or could not be opened), any recording is closed.
+   Q_SIGNAL void endOfStream(quint64 frames);
+   // Applies to the next start() of a network URL.
+   Q_SLOT void setNetworkOptions(int msLatency, int jitterFrames) {
+       m_msNetworkLatency = msLatency;
+       m_networkJitterFrames = jitterFrames;
+   }
+   // Applies to the next start().
+   Q_SLOT void setScaledDecode(bool enabled) { m_scaledDecode = enabled; }
+   // Applies to the next start() of a file.
+   Q_SLOT void setPaced(bool paced) { m_paced = paced; }
+   // Applies to the next start() of a raw frame file, false replays it as fast as it can be read.
+   Q_SLOT void setRawReplayTiming(bool original) { m_rawOriginalTiming = original; }
+   // Applies to the next recording started.
+   Q_SLOT void setRawRecording(bool raw) { m_rawRecording = raw; }
+   // Applies to the next start().
+   Q_SLOT void setSkipDuplicates(bool skip) { m_skipDuplicates = skip; }
+   // Applies to the next start(), recording true undistorts what is recorded and snapshots with the calibration.
+   Q_SLOT void setLensCorrection(QString calibration, bool recording) {
+       m_calibration = calibration;
+       m_undistortRecording = recording;
+   }
+   // Keep one frame every msInterval in a timelapse video, 0 to stop. selection is first, sharpest or changed.
+   Q_SLOT void setTimelapse(int msInterval, QString selection) {
+       m_timelapse.reset();
+       m_msTimelapseInterval = msInterval;
+       m_timelapseSelection = TimelapseRecorder::selectionFromString(selection);
+   }
+   Q_SLOT void setFrameBus(bool enabled, int slots) {
+       m_frameBusEnabled = enabled;
+       m_frameBusSlots = slots;
+       m_frameBus.reset();
+       m_frameBusHeld.set(0);
+   }
+   // The size the frame will be displayed at, lets MJPEG sources decode no larger than needed.
+   Q_SLOT void setPreviewSize(const QSize & size) {
+       m_previewSize = size;
+       if (m_nodeSource) m_nodeSource->setPreviewWidth(size.width());
+       updateDecodeScale();
+   }
    Q_SLOT void start(int cam = {}, QString camName = "NoName", bool recordVideo = false) {
 //       qDebug() << "Camera " << cam << ".";
        m_captureName = QString::number(cam);
        m_cameraName = camName;
        m_recordVideo = recordVideo;
+       m_sourceEnded = false;
+       m_held.setOwner(m_cameraName, MemoryBudget::Capture);
+       m_frameBusHeld.setOwner(m_cameraName, MemoryBudget::FrameBus);
        m_cap_api_preference = cv::CAP_V4L2;
        m_msFrameInterval = 0;
        m_captureTimer.start(m_msFrameInterval, this);
@@ -79,8 +249,14 @@ public:
        m_captureName = camUrl;
        m_cameraName = camName;
        m_recordVideo = recordVideo;
+       m_sourceEnded = false;
+       m_held.setOwner(m_cameraName, MemoryBudget::Capture);
+       m_frameBusHeld.setOwner(m_cameraName, MemoryBudget::FrameBus);
        m_cap_api_preference = cv::CAP_ANY;
-       m_msFrameInterval = MS_ONE_SECOND / VIDEO_FILE_FRAMES_PER_SECOND;
+       m_framesRead = 0;
+       // Network streams are paced by the jitter buffer, files by the timer.
+       bool live = NetworkSource::isNetworkUrl(camUrl) || NodeSource::isNodeUrl(camUrl);
+       m_msFrameInterval = (live || !m_paced) ? 0 : MS_ONE_SECOND / VIDEO_FILE_FRAMES_PER_SECOND;
        m_captureTimer.start(m_msFrameInterval, this);
        emit cameraNamed(m_cameraName);
    }
@@ -88,6 +264,28 @@ public:
        bool isWebcam = false;
        bool ok = false;
        int camnum = m_captureName.toInt(&isWebcam);
+       if (NetworkSource::isNetworkUrl(m_captureName)) {
+           // Connecting (and reconnecting) happens on the source's own thread.
+           m_networkSource.reset(new NetworkSource(m_captureName, m_msNetworkLatency, m_networkJitterFrames));
+           m_networkSource->setBudgetOwner(m_cameraName);
+           m_networkSource->setSkipDuplicates(m_skipDuplicates);
+           m_networkSource->start();
+           qDebug() << "Started network stream " << QUrl(m_captureName).toString(QUrl::RemoveUserInfo) << ".";
+           emit started();
+           return true;
+       }
+       if (NodeSource::isNodeUrl(m_captureName)) {
+           // Frames arrive as JPEGs already at about the tile size.
+           m_nodeSource.reset(new NodeSource(m_captureName));
+           m_nodeSource->setPreviewWidth(m_previewSize.width());
+           m_nodeSource->start();
+           m_compressedSource = true;
+           qDebug() << "Started node stream " << m_captureName << ".";
+           emit started();
+           return true;
+       }
+       if (isWebcam && m_reactor) return startReactorCamera(camnum);
+       if (RawFrameReader::isRawUrl(m_captureName)) return startRawReplay();
        if (!m_videoCapture)
        {
            if (isWebcam)
@@ -97,67 +295,212 @@ public:
         }
        if (m_videoCapture->isOpened()) {
           qDebug() << "Started playing video file " << m_captureName << ".";
+          m_compressedSource = m_scaledDecode && requestCompressedFrames(isWebcam);
           emit started();
           ok = true;
        } else {
          m_captureTimer.stop();
          ok = false;
          qDebug() << "Failed to start playing video file " << m_captureName << ".";
+         emit endOfStream(0);
      }
      return ok;
    }
-   Q_SLOT void stop() { stopRecording(); m_captureTimer.stop(); }
+   bool startReactorCamera(int camnum) {
+       m_v4l2.reset(new V4l2Device);
+       if (!m_v4l2->open(camnum, m_scaledDecode) || !m_reactor->add(m_v4l2->fd(), [this]() { handle_capture(); })) {
+           m_v4l2.reset();
+           m_captureTimer.stop();
+           qDebug() << "Failed to start camera " << m_captureName << ".";
+           emit endOfStream(0);
+           return false;
+       }
+       // From here on the reactor calls handle_capture() whenever the camera has a frame.
+       m_captureTimer.stop();
+       m_compressedSource = m_v4l2->isMjpeg();
+       m_nativeSize = cv::Size(m_v4l2->width(), m_v4l2->height());
+       updateDecodeScale();
+       emit started();
+       return true;
+   }
+   bool startRawReplay() {
+       QString path = RawFrameReader::pathFromUrl(m_captureName);
+       m_rawReader.reset(new RawFrameReader);
+       if (!m_rawReader->open(path)) {
+           m_rawReader.reset();
+           m_captureTimer.stop();
+           qDebug() << "Failed to replay raw frames from " << path << ".";
+           emit endOfStream(0);
+           return false;
+       }
+       qDebug() << "Replaying" << m_rawReader->count() << "raw frames from" << path << (m_paced && m_rawOriginalTiming ? "as captured." : "unthrottled.");
+       m_rawNext = 0;
+       m_msReplayStart = QDateTime::currentMSecsSinceEpoch();
+       emit started();
+       return true;
+   }
+   Q_SLOT void stop() {
+       // Whatever the node is recording carries on, only this viewer stops watching.
+       m_nodeSource.reset();
+       if (m_nodeRecording) {
+           m_nodeRecording = false;
+           emit recordingStopped();
+       }
+       m_nodeStats.clear();
+       stopRecording();
+       m_timelapse.reset();
+       m_captureTimer.stop();
+       m_statsTimer.stop();
+       // Release the device/file so a later start() can open a different URL.
+       m_networkSource.reset();
+       if (m_v4l2) m_reactor->remove(m_v4l2->fd());
+       QMutexLocker lock(&frameMutex);
+       m_videoCapture.reset();
+       m_v4l2.reset();
+       m_rawReader.reset();
+       m_sourceEnded = false;
+       m_delayed_start = false;
+       m_compressedSource = false;
+       m_jpeg.release();
+       m_frameBus.reset();
+       m_frameBusHeld.set(0);
+       m_lens.reset();
+       m_recordFrame.release();
+       m_corrected.release();
+   }
 
    Q_SLOT void snapshot() {
-       QtConcurrent::run([this]() {
+       if (m_nodeSource) {
+           m_nodeSource->sendCommand(NODE_COMMAND_SNAPSHOT);
+           return;
+       }
+       // Each snapshot in flight holds a copy of the frame, they are refused rather than pile up.
+       // The copy is taken here and the work below only uses its own values, as the stream
+       // may be stopped and deleted (a hot reload) while the snapshot is still being stored.
+       QString owner = m_cameraName;
+       if (!m_storage) {
+           qDebug() << "Snapshot of" << owner << "skipped, there is no storage writer.";
+           return;
+       }
+       QMutexLocker lock(&frameMutex);
+       if (m_frame.empty() || m_frame.type() != CV_8UC3) {
+           qDebug() << "Snapshot of" << owner << "skipped, there is no BGR frame yet.";
+           return;
+       }
+       qint64 bytes = matBytes(m_frame) + matBytes(m_jpeg) + (qint64) m_nativeSize.area() * 3;
+       if (!MemoryBudget::reserve(owner, MemoryBudget::Snapshot, bytes)) {
+           qDebug() << "Snapshot of" << m_cameraName << "skipped, the memory budget is used up.";
+           return;
+       }
+       cv::Mat capturedFrame = m_frame.clone();
+       cv::Mat jpeg = m_jpeg.clone();
+       qint64 msCaptureTime = m_msCaptureTime;
+       QSharedPointer<LensCorrection> lens = m_lens;
+       lock.unlock();
+       QString stem = pathForCapture(CAPTURED_IMAGES_DIRECTORY_PATH, fileNameSuggestion());
+       StorageWriter * storage = m_storage;
+       SnapshotStore * snapshots = m_snapshots;
+       QtConcurrent::run(snapshotPool(), [owner, bytes, capturedFrame, jpeg, msCaptureTime, lens, stem, storage, snapshots]() mutable {
+            placeSnapshotThread();
+            struct Release { QString owner; qint64 bytes; ~Release() { MemoryBudget::release(owner, MemoryBudget::Snapshot, bytes); } } release{owner, bytes};
             // Code in this block will run in another thread. We detach the storing image
             // so as not to block ongoing video if its slow to store in the filesystem.
+            TRACE_SCOPE("snapshot");
+
+            // Hashed on the preview, before the full frame is decoded or anything is encoded. The hash
+            // in the name keeps two different snapshots taken within a second from overwriting each other.
+            quint64 hash = SnapshotStore::perceptualHash(capturedFrame);
+            QString fileName = stem + QString(" %1.").arg(hash, 16, 16, QChar('0')) + JPEG_FILE_EXTENSION;
+            // Listed from here on, or taken out again if it never gets stored.
+            struct Claim { SnapshotStore * snapshots; QString path; bool written; ~Claim() { if (snapshots) snapshots->stored(path, written); } } claim{nullptr, fileName, false};
+            if (snapshots) {
+                QString original;
+                if (snapshots->claim(hash, owner, msCaptureTime, fileName, original) != SnapshotStore::Store) {
+                    qDebug() << "Snapshot of" << owner << "is the same as" << original << ", not stored again.";
+                    return;
+                }
+                claim.snapshots = snapshots;
+                if (!original.isEmpty()) qDebug() << "Snapshot of" << owner << "could not be linked to" << original << ", storing it.";
+            }
 
-            QString path(CAPTURED_IMAGES_DIRECTORY_PATH);
-            QFile file;
-            openFileForCapture(file, path, fileNameSuggestion() + "." + JPEG_FILE_EXTENSION);
-            if (!file.isOpen()) {
-                qDebug() << "Filed to capture " << file.fileName();
+            // The preview of a compressed source may be scaled down, store the full frame.
+            if (!jpeg.empty()) capturedFrame = cv::imdecode(jpeg, cv::IMREAD_COLOR);
+            if (capturedFrame.empty()) {
+                qDebug() << "Snapshot of" << owner << "not stored, its frame could not be decoded.";
                 return;
             }
-
-            Q_ASSERT(this->m_frame.type() == CV_8UC3);
-
-            this->frameMutex.lock();
-            cv::Mat capturedFrame = this->m_frame.clone();
-            this->frameMutex.unlock();
+            if (lens) {
+                cv::Mat corrected;
+                lens->apply(capturedFrame, corrected);
+                capturedFrame = corrected;
+            }
 
             int w = capturedFrame.cols , h = capturedFrame.rows ;
             QImage image = QImage(w, h, QImage::Format_RGB888);
             cv::Mat mat(h, w, CV_8UC3, image.bits(), image.bytesPerLine());
             cv::resize(capturedFrame, mat, mat.size(), 0, 0, cv::INTER_AREA);
             cv::cvtColor(mat, mat, cv::COLOR_BGR2RGB);
-            image.save(&file,JPEG_FILE_EXTENSION);
+
+            QByteArray encoded;
+            QBuffer buffer(&encoded);
+            buffer.open(QIODevice::WriteOnly);
+            image.save(&buffer,JPEG_FILE_EXTENSION);
+            int handle = storage->open(fileName, encoded.size());
+            if (handle < 0) {
+                qDebug() << "Filed to capture " << fileName;
+                return;
+            }
+            storage->append(handle, encoded, true);
+            storage->close(handle);
+            claim.written = true;
        });
    }
 
    Q_SLOT void startRecording() {
+       // The node says when it has started, with the next frame.
+       if (m_nodeSource) {
+           m_nodeSource->sendCommand(NODE_COMMAND_RECORD);
+           return;
+       }
        // If we are recording video then nothing more to do
        if (!m_pausedRecording && !m_videoWriter.isNull() && m_videoWriter->isOpened()) return;
-
-       QString path(CAPTURED_VIDEO_DIRECTORY_PATH);
-       QFile file;
-       openFileForCapture(file, path, fileNameSuggestion() + "." + MJPG_FILE_EXTENSION);
-       if (!file.isOpen()) {
-           qDebug() << "Filed to capture " << file.fileName();
+       if (!m_pausedRecording && !m_rawWriter.isNull()) return;
+
+       if (m_rawRecording) {
+           QString fileName = pathForCapture(CAPTURED_RAW_DIRECTORY_PATH, fileNameSuggestion() + "." + RAW_FRAME_EXTENSION);
+           m_rawWriter.reset(new RawFrameWriter(m_storage));
+           if (!m_rawWriter->open(fileName)) {
+               qDebug() << "Filed to capture " << fileName;
+               m_rawWriter.reset();
+               emit recordingStopped();
+               return;
+           }
+           emit recordingStarted();
+           return;
+       }
+       QString fileName = pathForCapture(CAPTURED_VIDEO_DIRECTORY_PATH, fileNameSuggestion() + "." + MJPG_FILE_EXTENSION);
+       cv::Size size = recordingSize();
+       m_videoWriter.reset(new MjpegAviWriter(m_storage));
+       if (!m_videoWriter->open(fileName, size.width, size.height, VIDEO_RECORDING_FRAMES_PER_SECOND)) {
+           qDebug() << "Filed to capture " << fileName;
+           m_videoWriter.reset();
            emit recordingStopped();
            return;
        }
-       file.close();
-       m_videoWriter.reset(new cv::VideoWriter(file.fileName().toStdString(),cv::VideoWriter::fourcc('M','J','P','G'),10, cv::Size(m_frame.cols,m_frame.rows)));
        emit recordingStarted();
    }
 
    Q_SLOT void stopRecording() {
+       if (m_nodeSource) {
+           m_nodeSource->sendCommand(NODE_COMMAND_STOP);
+           return;
+       }
        // Simply check if we are actually recording.
-       if (m_videoWriter.isNull()) return;
+       if (m_videoWriter.isNull() && m_rawWriter.isNull()) return;
 
-       m_videoWriter->release(); m_videoWriter.reset(); emit recordingStopped();
+       if (m_videoWriter) { m_videoWriter->close(); m_videoWriter.reset(); }
+       if (m_rawWriter) { m_rawWriter->close(); m_rawWriter.reset(); }
+       emit recordingStopped();
    }
 
    Q_SLOT void pauseRecording() {m_pausedRecording = true;}
@@ -167,8 +510,9 @@ public:
 
    Q_SIGNAL void frameReady(const cv::Mat &);
    cv::Mat frame() const { return m_frame; }
+   static qint64 matBytes(const cv::Mat & mat) { return (qint64) (mat.total() * mat.elemSize()); }
 private:
-   void openFileForCapture(QFile & file, const QString & path, const QString & filename)
+   QString pathForCapture(const QString & path, const QString & filename)
    {
        QDir dir; // Initialize to the desired dir if 'path' is relative
                  // By default the program's working directory "." is used.
@@ -177,33 +521,385 @@ private:
        if (!dir.exists(path))
            dir.mkpath(path); // You can check the success if needed
 
-       file.setFileName(path + "/" + filename);
-       file.open(QIODevice::WriteOnly); // Or QIODevice::ReadWrite
+       return path + "/" + filename;
    }
 
+   // Compressed sources are recorded as they come, not at the size of the preview.
+   cv::Size recordingSize() const { return m_compressedSource ? m_nativeSize : m_frame.size(); }
+
    QString fileNameSuggestion() {
        return m_cameraName + " " + QDateTime::currentDateTime().toString("ddMMyyyy_HHmmss");
    }
    void timerEvent(QTimerEvent * ev) {
       if (ev->timerId() == m_captureTimer.timerId()) handle_capture();
+      else if (ev->timerId() == m_statsTimer.timerId()) handle_stats();
    }
 
-   void handle_capture() {
-      if (!m_delayed_start) m_delayed_start = postponed_camera_start();
-      frameMutex.lock();
-      if (!m_videoCapture->read(m_frame)) { // Blocks until a new frame is ready
+   void handle_stats() {
+      if (m_nodeSource) {
+         NodeStats stats = m_nodeSource->stats();
+         emit sourceStatsChanged(QString("NODE[late %1 missed %2%3]%4").arg(stats.late).arg(stats.missed)
+                                 .arg(stats.connected ? QString() : QString(" connecting"))
+                                 .arg(m_nodeStats.isEmpty() ? QString() : " " + m_nodeStats));
+         return;
+      }
+      if (!m_networkSource) {
+         if (m_duplicateFrames) emit sourceStatsChanged(QString("DUP[%1]").arg(m_duplicateFrames));
+         return;
+      }
+      JitterStats stats = m_networkSource->stats();
+      quint64 duplicates = stats.duplicates + m_duplicateFrames;
+      emit sourceStatsChanged(QString("NET[buf %1 late %2 lost %3%4%5]").arg(stats.depth).arg(stats.late).arg(stats.lost)
+                              .arg(duplicates ? QString(" dup %1").arg(duplicates) : QString())
+                              .arg(m_networkSource->isOpened() ? QString() : QString(" connecting")));
+   }
+
+   // Blocks until a new frame is ready, false means there is nothing to process this time round.
+   bool read_frame() {
+      if (m_networkSource) {
+         cv::Mat frame;
+         qint64 msTimestamp;
+         quint64 sequence;
+         if (!m_networkSource->takeFrame(frame, msTimestamp, sequence, MS_NETWORK_FRAME_WAIT)) return false; // Nothing due yet, keep polling.
+         QMutexLocker lock(&frameMutex);
+         m_frame = frame;
+         // Frames leave the jitter buffer about one target latency after they arrived.
+         m_msCaptureTime = QDateTime::currentMSecsSinceEpoch() - m_msNetworkLatency;
+         return true;
+      }
+      if (m_nodeSource) return readNodeFrame();
+
+      QMutexLocker lock(&frameMutex);
+      if (m_v4l2) return readV4l2Frame();
+      if (m_rawReader) return readRawFrame();
+      m_msCaptureTime = QDateTime::currentMSecsSinceEpoch();
+      if (!m_videoCapture->read(m_compressedSource ? m_jpeg : m_frame)) {
+         m_captureTimer.stop();
+         m_sourceEnded = true;
+         return false;
+      }
+      if (m_compressedSource) return decodeCompressedFrame();
+      return true;
+   }
+
+   // Blocks up to MS_NETWORK_FRAME_WAIT for the node's next frame.
+   bool readNodeFrame() {
+      NodeFrame frame;
+      if (!m_nodeSource->takeFrame(frame, MS_NETWORK_FRAME_WAIT)) return false;
+      m_nodeStats = frame.stats;
+      bool recording = frame.header.flags & NODE_FLAG_RECORDING;
+      if (recording != m_nodeRecording) {
+         m_nodeRecording = recording;
+         if (recording) emit recordingStarted();
+         else emit recordingStopped();
+      }
+      QMutexLocker lock(&frameMutex);
+      // The node's time, so snapshots and timelapses taken here line up with its recordings.
+      m_msCaptureTime = frame.header.msTimestamp;
+      cv::Size size((int) frame.header.width, (int) frame.header.height);
+      if (m_nativeSize != size) {
+         m_nativeSize = size;
+         updateDecodeScale();
+      }
+      cv::Mat(1, frame.jpeg.size(), CV_8UC1, (void *) frame.jpeg.constData()).copyTo(m_jpeg);
+      return decodeCompressedFrame();
+   }
+
+   // Called with frameMutex held. Never blocks, the device is non-blocking.
+   bool readV4l2Frame() {
+      V4l2Device::Buffer buffer;
+      if (!m_v4l2->dequeue(buffer)) {
+         if (m_v4l2->failed()) {
+            m_reactor->remove(m_v4l2->fd());
+            m_sourceEnded = true;
+         }
+         return false;
+      }
+      m_msCaptureTime = QDateTime::currentMSecsSinceEpoch();
+      // The driver says whether this is a new frame, a repeat needs neither copying nor decoding.
+      if (m_skipDuplicates) {
+         m_duplicate = m_haveChecksum && buffer.sequence == m_lastSequence && buffer.usTimestamp == m_usLastTimestamp && !m_frame.empty();
+         m_lastSequence = buffer.sequence;
+         m_usLastTimestamp = buffer.usTimestamp;
+         m_haveChecksum = true;
+         if (m_duplicate) {
+            m_v4l2->requeue(buffer);
+            return true;
+         }
+      }
+      if (m_compressedSource) {
+         // Copied out so the buffer goes straight back to the driver.
+         m_jpeg.create(1, buffer.bytesUsed, CV_8UC1);
+         memcpy(m_jpeg.data, buffer.data, (size_t) buffer.bytesUsed);
+         m_v4l2->requeue(buffer);
+         return decodeCompressedFrame();
+      }
+      cv::Mat yuyv(m_v4l2->height(), m_v4l2->width(), CV_8UC2, (void *) buffer.data, (size_t) m_v4l2->bytesPerLine());
+      cv::cvtColor(yuyv, m_frame, cv::COLOR_YUV2BGR_YUYV);
+      m_v4l2->requeue(buffer);
+      return true;
+   }
+
+   // Called with frameMutex held. The frame is copied out of the mapping, consumers may keep it after the file is closed.
+   bool readRawFrame() {
+      if (m_rawNext >= m_rawReader->count()) {
          m_captureTimer.stop();
+         m_sourceEnded = true;
+         return false;
+      }
+      RawFrame raw = m_rawReader->at(m_rawNext++);
+      const RawFrameHeader & header = *raw.header;
+      cv::Size size((int) header.width, (int) header.height);
+      m_compressedSource = header.format == RAW_FRAME_FORMAT_MJPEG;
+      if (m_nativeSize != size) {
+         m_nativeSize = size;
+         updateDecodeScale();
+      }
+      // The original capture time, so anything recorded from a replay lines up with the original.
+      m_msCaptureTime = header.msTimestamp;
+
+      // Sleep on the timer until the next frame is due, measured from the first so errors do not add up.
+      if (m_paced && m_rawOriginalTiming && m_rawNext < m_rawReader->count()) {
+         qint64 msDue = m_msReplayStart + m_rawReader->at(m_rawNext).header->msTimestamp - m_rawReader->at(0).header->msTimestamp;
+         m_captureTimer.start((int) qBound<qint64>(0, msDue - QDateTime::currentMSecsSinceEpoch(), MS_ONE_SECOND * 60), this);
+      } else if (m_msFrameInterval) {
+         m_captureTimer.start(0, this);
+      }
+
+      if (m_compressedSource) {
+         cv::Mat(1, (int) header.size, CV_8UC1, (void *) raw.data).copyTo(m_jpeg);
+         return decodeCompressedFrame();
+      }
+      // Otherwise BGR24, the reader only hands out frames whose pixels are all in the file.
+      cv::Mat(size, CV_8UC3, (void *) raw.data, header.stride).copyTo(m_frame);
+      return true;
+   }
+
+   // Ask the backend for the MJPEG bitstream instead of decoded BGR frames.
+   bool requestCompressedFrames(bool isWebcam) {
+      m_nativeSize = cv::Size((int) m_videoCapture->get(cv::CAP_PROP_FRAME_WIDTH), (int) m_videoCapture->get(cv::CAP_PROP_FRAME_HEIGHT));
+      int mjpg = cv::VideoWriter::fourcc('M','J','P','G');
+      if (isWebcam) {
+         m_videoCapture->set(cv::CAP_PROP_FOURCC, mjpg);
+         if ((int) m_videoCapture->get(cv::CAP_PROP_FOURCC) != mjpg) return false;
+         m_nativeSize = cv::Size((int) m_videoCapture->get(cv::CAP_PROP_FRAME_WIDTH), (int) m_videoCapture->get(cv::CAP_PROP_FRAME_HEIGHT));
+         if (!m_videoCapture->set(cv::CAP_PROP_CONVERT_RGB, 0)) return false;
+      } else {
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 2)
+         if ((int) m_videoCapture->get(cv::CAP_PROP_FOURCC) != mjpg) return false;
+         // Raw packets from FFmpeg, for MJPEG each one is a complete JPEG image.
+         if (!m_videoCapture->set(cv::CAP_PROP_FORMAT, -1)) return false;
+#else
+         return false;
+#endif
+      }
+      qDebug() << "Decoding" << m_captureName << "MJPEG at preview size.";
+      updateDecodeScale();
+      return true;
+   }
+
+   void updateDecodeScale() {
+      // The same JPEG now decodes to a different size, it is not a duplicate of the last decode.
+      m_haveChecksum = false;
+      m_decodeFlags = cv::IMREAD_COLOR;
+      if (m_previewSize.isEmpty() || m_nativeSize.area() == 0) return;
+      static const int reduced[][2] = { {8, cv::IMREAD_REDUCED_COLOR_8}, {4, cv::IMREAD_REDUCED_COLOR_4}, {2, cv::IMREAD_REDUCED_COLOR_2} };
+      for (const auto & r : reduced) {
+         // Never decode smaller than the tile, the converter only ever scales down.
+         if (m_nativeSize.width / r[0] >= m_previewSize.width() && m_nativeSize.height / r[0] >= m_previewSize.height()) {
+            m_decodeFlags = r[1];
+            return;
+         }
+      }
+   }
+
+   // Called with frameMutex held.
+   bool decodeCompressedFrame() {
+      // Anything that is not a single row of bytes was decoded by the backend after all.
+      if (m_jpeg.rows != 1 || m_jpeg.type() != CV_8UC1) {
+         qDebug() << "Backend did not deliver compressed frames for" << m_captureName << ", decoding normally.";
+         m_compressedSource = false;
+         m_frame = m_jpeg;
+         m_jpeg.release();
+         return !m_frame.empty();
+      }
+      if (m_skipDuplicates && !m_v4l2) {
+         // The same bytes decode to the picture m_frame already holds.
+         quint64 checksum = FrameChecksum::ofBytes(m_jpeg.ptr(), m_jpeg.total());
+         m_duplicate = m_haveChecksum && checksum == m_lastChecksum && !m_frame.empty();
+         m_lastChecksum = checksum;
+         m_haveChecksum = true;
+         if (m_duplicate) return true;
+      }
+      cv::imdecode(m_jpeg, m_decodeFlags, &m_frame);
+      return !m_frame.empty();
+   }
+
+   // Decoded frames are compared on every pixel. Compressed ones were checked before decoding, and
+   // V4L2 frames by the driver's sequence and timestamp, so no frame is dropped on a partial match.
+   bool isDuplicateFrame() {
+      if (!m_skipDuplicates) return false;
+      if (!m_compressedSource && !m_v4l2) {
+         quint64 checksum = FrameChecksum::ofFrame(m_frame);
+         m_duplicate = m_haveChecksum && checksum == m_lastChecksum;
+         m_lastChecksum = checksum;
+         m_haveChecksum = true;
+      }
+      bool duplicate = m_duplicate;
+      m_duplicate = false;
+      return duplicate;
+   }
+
+   // Compressed sources publish the JPEG as is, so consumers only pay for decoding if they want it.
+   void publishFrame() {
+      const cv::Mat & frame = m_compressedSource ? m_jpeg : m_frame;
+      cv::Size size = m_compressedSource ? m_nativeSize : m_frame.size();
+      if (!m_frameBus) {
+         // Room for a full size BGR frame, which also bounds a JPEG of it.
+         qint64 busBytes = (qint64) size.area() * 3 * m_frameBusSlots;
+         if (!MemoryBudget::fits(busBytes)) {
+            qDebug() << "Not publishing" << m_cameraName << "on the frame bus, it would go over the memory budget.";
+            m_frameBusEnabled = false;
+            return;
+         }
+         m_frameBus.reset(new FrameBusWriter);
+         m_frameBusHeld.set(busBytes);
+         if (!m_frameBus->create(m_cameraName.toStdString(), (uint64_t) size.area() * 3, m_frameBusSlots)) {
+            qDebug() << "Failed to create frame bus for" << m_cameraName << ", not publishing.";
+            m_frameBusEnabled = false;
+            m_frameBus.reset();
+            m_frameBusHeld.set(0);
+            return;
+         }
+         qDebug() << "Publishing" << m_cameraName << "on" << QString::fromStdString(FrameBusReader::segmentName(m_cameraName.toStdString()));
+      }
+      if (!frame.isContinuous()) return;
+      // When the frame was captured, not when it got here, like the recordings.
+      int64_t timestampNs = (int64_t) m_msCaptureTime * 1000000;
+      m_frameBus->publish(frame.data, frame.total() * frame.elemSize(),
+                          m_compressedSource ? FRAMEBUS_FORMAT_MJPEG : FRAMEBUS_FORMAT_BGR24,
+                          size.width, size.height, m_compressedSource ? 0 : (uint32_t) frame.step[0], timestampNs);
+   }
+
+   // Cheap enough for every recorded frame, it only looks at a tiny grey thumbnail.
+   bool detectMotion() {
+      if (m_frame.empty()) return false;
+      cv::resize(m_frame, m_motionThumbnail, cv::Size(MOTION_THUMBNAIL_WIDTH, MOTION_THUMBNAIL_HEIGHT), 0, 0, cv::INTER_AREA);
+      cv::cvtColor(m_motionThumbnail, m_motionThumbnail, cv::COLOR_BGR2GRAY);
+      bool motion = false;
+      if (m_motionPrevious.size() == m_motionThumbnail.size()) {
+         cv::absdiff(m_motionThumbnail, m_motionPrevious, m_motionDifference);
+         int changed = cv::countNonZero(m_motionDifference > MOTION_PIXEL_THRESHOLD);
+         motion = changed * 100 > (int) m_motionDifference.total() * MOTION_CHANGED_PERCENT;
+      }
+      cv::swap(m_motionThumbnail, m_motionPrevious);
+      return motion;
+   }
+
+   void recordRawFrame() {
+      if (m_compressedSource) {
+         m_rawWriter->writeFrame(RAW_FRAME_FORMAT_MJPEG, m_nativeSize.width, m_nativeSize.height, 0, m_jpeg.ptr(), (int) m_jpeg.total(), m_msCaptureTime);
+         return;
+      }
+      if (m_frame.type() != CV_8UC3 || m_frame.empty()) return;
+      int size = (int) (m_frame.step[0] * (m_frame.rows - 1) + m_frame.cols * m_frame.elemSize());
+      m_rawWriter->writeFrame(RAW_FRAME_FORMAT_BGR24, m_frame.cols, m_frame.rows, (int) m_frame.step[0], m_frame.data, size, m_msCaptureTime);
+   }
+
+   void recordFrame() {
+      TRACE_SCOPE("record");
+      quint32 flags = detectMotion() ? RECORDING_INDEX_MOTION : 0;
+      static const std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, RECORDING_JPEG_QUALITY };
+      if (m_lens) {
+         // Undistorted in full, so a compressed source is decoded and encoded again.
+         const cv::Mat * frame = &m_frame;
+         if (m_compressedSource) {
+            cv::imdecode(m_jpeg, cv::IMREAD_COLOR, &m_recordFrame);
+            frame = &m_recordFrame;
+         }
+         m_lens->apply(*frame, m_corrected);
+         if (cv::imencode(".jpg", m_corrected, m_encodeBuffer, params))
+            m_videoWriter->writeJpeg(m_encodeBuffer.data(), (int) m_encodeBuffer.size(), m_msCaptureTime, flags);
          return;
       }
-      frameMutex.unlock();
+      if (m_compressedSource) {
+         m_videoWriter->writeJpeg(m_jpeg.ptr(), (int) m_jpeg.total(), m_msCaptureTime, flags);
+         return;
+      }
+      if (cv::imencode(".jpg", m_frame, m_encodeBuffer, params))
+         m_videoWriter->writeJpeg(m_encodeBuffer.data(), (int) m_encodeBuffer.size(), m_msCaptureTime, flags);
+   }
+
+   void handle_capture() {
+      TRACE_SCOPE("capture");
+      if (!m_delayed_start) {
+         m_delayed_start = postponed_camera_start();
+         if (!m_delayed_start) return;
+         m_duplicateFrames = 0;
+         m_haveChecksum = false;
+         m_statsTimer.start(MS_ONE_SECOND, this);
+         // A node records its own cameras, undistorted there if it is configured to.
+         QSharedPointer<LensCorrection> lens;
+         if (m_undistortRecording && !m_calibration.isEmpty() && !m_nodeSource) {
+            lens.reset(new LensCorrection(m_cameraName, MemoryBudget::Capture));
+            lens->setCacheDirectory(CAPTURED_CALIBRATION_DIRECTORY_PATH);
+            if (!lens->load(m_calibration)) lens.reset();
+         }
+         QMutexLocker lock(&frameMutex);
+         m_lens = lens;
+         m_lensPrepared = false;
+      }
+      if (!read_frame()) {
+         if (m_sourceEnded) {
+            stopRecording();
+            emit endOfStream(m_framesRead);
+         }
+         return;
+      }
+      m_framesRead++;
+      // A repeat is not published, recorded, converted or painted again.
+      if (isDuplicateFrame()) {
+         m_duplicateFrames++;
+         TRACE_INSTANT("duplicate frame");
+         return;
+      }
+      m_held.set(matBytes(m_frame) + matBytes(m_jpeg));
+      // The full size tables are made, or read from disk, with the first frame rather than when recording starts.
+      if (m_lens && !m_lensPrepared) {
+         m_lens->prepare(recordingSize());
+         m_lensPrepared = true;
+      }
+      // Asked to record from the start, which needs the first frame for its size.
+      if (m_recordVideo && m_videoWriter.isNull() && m_rawWriter.isNull()) {
+         m_recordVideo = false;
+         startRecording();
+      }
 
 //      qDebug() << "Captured Image [cols,rows] = [" << m_frame.cols << ", " << m_frame.rows << "]";
       m_track.track(m_frame);
 
+      if (m_frameBusEnabled) publishFrame();
+
+      // A node's frames arrive scaled to the tile, the node keeps its own timelapse at full size.
+      if (m_msTimelapseInterval > 0 && !m_nodeSource) {
+         if (!m_timelapse) m_timelapse.reset(new TimelapseRecorder(m_storage, CAPTURED_TIMELAPSE_DIRECTORY_PATH, m_cameraName,
+                                                                   m_msTimelapseInterval, m_timelapseSelection));
+         m_timelapse->addFrame(m_frame, m_jpeg, m_compressedSource ? m_nativeSize : m_frame.size(), m_msCaptureTime);
+      }
+
       // If we are recording video then do it...
-      if (!m_pausedRecording && !m_videoWriter.isNull() && m_videoWriter->isOpened()) m_videoWriter->write(m_frame);
+      if (!m_pausedRecording && !m_videoWriter.isNull() && m_videoWriter->isOpened()) {
+         if (m_videoWriter->isFull()) { stopRecording(); startRecording(); }
+         if (!m_videoWriter.isNull()) recordFrame();
+      }
+      if (!m_pausedRecording && !m_rawWriter.isNull()) recordRawFrame();
 
       emit frameReady(m_frame);
+      foreach (const QSharedPointer<FrameShare> & share, m_shares) {
+         if (!share->wanted()) continue;
+         cv::Size fullSize = m_nativeSize.area() > 0 ? m_nativeSize : m_frame.size();
+         share->offer(m_frame, m_msCaptureTime, QSize(fullSize.width, fullSize.height));
+      }
    }
    QMutex frameMutex; // To gaurd m_frame
    // URL and name of the camera
@@ -220,23 +916,65 @@ class Converter : public QObject {
    cv::Mat m_frame;
    QImage m_image;
    bool m_processAll = false;
+   QSize m_targetSize;
+   QRectF m_region = QRectF(0, 0, 1, 1);   // The part of the frame shown, as fractions of it
+   int m_msMinInterval = 0;                // Thumbnails are converted less often
+   QElapsedTimer m_sinceProcessed;
    AddressTracker m_track;
+   MemoryBudget::Holding m_held;
+   QString m_budgetOwner;
+   QScopedPointer<LensCorrection> m_lens;   // Undistorts what is shown
+   cv::Mat m_scaled, m_undistorted;
    void queue(const cv::Mat &frame) {
-      if (!m_frame.empty()) qDebug() << "Converter dropped frame!";
+      if (!m_frame.empty()) {
+         qDebug() << "Converter dropped frame!";
+         TRACE_INSTANT("converter dropped frame");
+      }
       m_frame = frame;
       if (! m_converterTimer.isActive()) m_converterTimer.start(0, this);
    }
-   void process(const cv::Mat &frame) {
-      Q_ASSERT(frame.type() == CV_8UC3);
+   void process(const cv::Mat &fullFrame) {
+      TRACE_SCOPE("convert");
+      Q_ASSERT(fullFrame.type() == CV_8UC3);
+      m_sinceProcessed.start();
+      // Zoomed in only the visible part is converted, at the size of the tile.
+      cv::Mat frame = fullFrame;
+      bool zoomed = m_region != QRectF(0, 0, 1, 1) && !fullFrame.empty();
+      if (zoomed) {
+         // Cut from the corrected frame, at the size it was decoded at, so the tables depend on that size only and not on the region.
+         if (m_lens) {
+            m_lens->apply(fullFrame, m_undistorted);
+            frame = m_undistorted;
+         }
+         cv::Rect roi(qRound(m_region.x() * frame.cols), qRound(m_region.y() * frame.rows),
+                      qMax(1, qRound(m_region.width() * frame.cols)), qMax(1, qRound(m_region.height() * frame.rows)));
+         frame = frame(roi & cv::Rect(0, 0, frame.cols, frame.rows));
+      }
 //       int w = frame.cols / 3.0, h = frame.rows / 3.0; // This was found to be wrong for Colour supplied camera. Needs checking out further
       int w = frame.cols , h = frame.rows ;
+      // Scale down to the tile here, off the gui thread. Anything smaller is left for the viewer to stretch.
+      if (!m_targetSize.isEmpty() && m_targetSize.width() <= w && m_targetSize.height() <= h) {
+         w = m_targetSize.width();
+         h = m_targetSize.height();
+      }
       if (m_image.size() != QSize{w,h})
       {
          m_image = QImage(w, h, QImage::Format_RGB888);
+         m_held.set(m_image.sizeInBytes());
 //        qDebug() << "Converter frame Size [" << w << ", " << h << "] and Image Size ["<< m_image.size() << "]";
       }
       cv::Mat mat(h, w, CV_8UC3, m_image.bits(), m_image.bytesPerLine());
-      cv::resize(frame, mat, mat.size(), 0, 0, cv::INTER_AREA);
+      if (m_lens && !zoomed && !frame.empty()) {
+         // Corrected at the size of the tile, scaling down first costs far less than remapping the full frame.
+         if (frame.size() == mat.size()) {
+            m_lens->apply(frame, mat);
+         } else {
+            cv::resize(frame, m_scaled, mat.size(), 0, 0, cv::INTER_AREA);
+            m_lens->apply(m_scaled, mat);
+         }
+      } else {
+         cv::resize(frame, mat, mat.size(), 0, 0, cv::INTER_AREA);
+      }
       cv::cvtColor(mat, mat, cv::COLOR_BGR2RGB);
       emit imageReady(m_image);
    }
@@ -252,9 +990,28 @@ public:
    ~Converter() { qDebug() << __FUNCTION__ << "reallocations" << m_track.reallocs; }
    bool processAll() const { return m_processAll; }
    void setProcessAll(bool all) { m_processAll = all; }
+   // The stream its image is accounted to in the memory budget, before it is moved to its thread.
+   void setBudgetOwner(const QString & owner) {
+      m_budgetOwner = owner;
+      m_held.setOwner(owner, MemoryBudget::Convert);
+   }
+   Q_SLOT void setTargetSize(const QSize & size) { m_targetSize = size; }
+   Q_SLOT void setRegion(const QRectF & region) { m_region = region; }
+   // Undistort with this calibration file, empty shows frames as captured.
+   Q_SLOT void setLensCorrection(const QString & calibration) {
+      m_lens.reset();
+      m_scaled.release();
+      m_undistorted.release();
+      if (calibration.isEmpty()) return;
+      m_lens.reset(new LensCorrection(m_budgetOwner, MemoryBudget::Convert));
+      if (!m_lens->load(calibration)) m_lens.reset();
+   }
+   // 0 converts every frame it can.
+   Q_SLOT void setMaxFramesPerSecond(int fps) { m_msMinInterval = fps > 0 ? MS_ONE_SECOND / fps : 0; }
    Q_SIGNAL void imageReady(const QImage &);
    QImage image() const { return m_image; }
    Q_SLOT void processFrame(const cv::Mat &frame) {
+      if (m_msMinInterval && m_sinceProcessed.isValid() && m_sinceProcessed.elapsed() < m_msMinInterval) return;
       if (m_processAll) process(frame); else queue(frame);
    }
 };
@@ -267,9 +1024,19 @@ class ImageViewer : public QWidget {
    AddressTracker m_track;
    QBasicTimer m_fpsTimer;
    QString m_cameraName = "Unknown";
+   QString m_sourceStats;
    QWidget * m_toolbar = nullptr;
+   MemoryBudget::Holding m_held;
+   // In focus the tile can be zoomed (wheel) and panned (drag), the converter only converts what is visible.
+   bool m_focused = false;
+   double m_zoom = 1;
+   QPointF m_center = QPointF(0.5, 0.5);
+   QPoint m_dragFrom;
+   // Text over the frame, each re-rendered only when it changes.
+   enum { NameLayer, FpsLayer, StatsLayer, ZoomLayer, RecordingLayer };
+   OverlayLayers m_overlay{QFont("times", 12)};
    void paintEvent(QPaintEvent *) {
-
+       TRACE_SCOPE("paint");
        QPainter p(this);
 
       if (!m_img.isNull()) {
@@ -289,14 +1056,8 @@ class ImageViewer : public QWidget {
           p.drawLine((QLine(width() -1,0,0, height()-1)));
       }
 
-      QString fontType = "times";
-      p.setFont(QFont(fontType,12));
-      QFontMetrics fm(fontType);
-      int pixelsHigh = fm.height() + 1;
-      QPen tpen(QColor(255,255,255,255));
-      p.setPen(tpen);
-      p.drawText(10, height()-pixelsHigh * 2, m_cameraName);
-      p.drawText(10, height()-pixelsHigh * 1, m_measuredFps);
+      m_overlay.setSize(size(), devicePixelRatioF());
+      m_overlay.paint(p);
    }
 public:
    ImageViewer(QWidget * parent = nullptr) : QWidget(parent) {
@@ -305,6 +1066,14 @@ public:
 
        showToolbar();
        setMinimumSize(m_toolbar->size() * 2);
+
+       m_overlay.setLayer(NameLayer, OverlayLayers::BottomLeft, 2);
+       m_overlay.setLayer(FpsLayer, OverlayLayers::BottomLeft, 1);
+       m_overlay.setLayer(StatsLayer, OverlayLayers::BottomLeft, 3);
+       m_overlay.setLayer(ZoomLayer, OverlayLayers::TopLeft, 1);
+       m_overlay.setLayer(RecordingLayer, OverlayLayers::TopRight, 1, Qt::red);
+       m_overlay.setText(NameLayer, m_cameraName);
+       m_overlay.setText(FpsLayer, m_measuredFps);
     }
 
    ~ImageViewer() { qDebug() << __FUNCTION__ << "reallocations" << m_track.reallocs; }
@@ -312,16 +1081,44 @@ public:
 
    Q_SLOT void setCameraName(const QString camName) {
        m_cameraName = camName;
+       m_held.setOwner(m_cameraName, MemoryBudget::View);
+       m_overlay.setText(NameLayer, m_cameraName);
+   }
+
+   Q_SLOT void setSourceStats(const QString stats) {
+       m_sourceStats = stats;
+       m_overlay.setText(StatsLayer, m_sourceStats);
+   }
+
+   // Leaving focus shows the whole frame again.
+   void setFocused(bool focused) {
+       m_focused = focused;
+       if (focused) return;
+       m_zoom = 1;
+       m_center = QPointF(0.5, 0.5);
+       emitRegion();
+   }
+
+   // A thumbnail has no toolbar and stays small.
+   void setThumbnail(bool thumbnail) {
+       m_toolbar->setVisible(!thumbnail);
+       setMinimumSize(thumbnail ? FOCUS_THUMBNAIL_SIZE / 2 : m_toolbar->size() * 2);
+       setMaximumSize(thumbnail ? FOCUS_THUMBNAIL_SIZE : QSize(QWIDGETSIZE_MAX, QWIDGETSIZE_MAX));
    }
 
    Q_SLOT void setImage(const QImage &img) {
       m_fps++;
-      if (!painted) qDebug() << "Viewer dropped frame!";
+      if (!painted) {
+         qDebug() << "Viewer dropped frame!";
+         TRACE_INSTANT("viewer dropped frame");
+      }
       if (m_img.size() == img.size() && m_img.format() == img.format()
           && m_img.bytesPerLine() == img.bytesPerLine())
          std::copy_n(img.bits(), img.sizeInBytes(), m_img.bits());
-      else
+      else {
          m_img = img.copy();
+         m_held.set(m_img.sizeInBytes());
+      }
       painted = false;
 //      if (m_img.size() != size()) setFixedSize(m_img.size());
       m_track.track(m_img);
@@ -335,13 +1132,23 @@ public:
    Q_SIGNAL void takeSnapshotImage();
    Q_SIGNAL void stopRecording();
 
+   Q_SIGNAL void tileResized(const QSize &);
+   // The frame size that would show the visible region pixel for pixel, so the source decodes no larger.
+   Q_SIGNAL void sourceSizeNeeded(const QSize &);
+   Q_SIGNAL void regionChanged(const QRectF &);
+   Q_SIGNAL void focusToggled();
+
    Q_SIGNAL void buttonRecordingStarted();
    Q_SIGNAL void buttonRecordingStopped();
 
    Q_SLOT void recordingStarted() {
+        m_overlay.setText(RecordingLayer, "REC");
+        update();
         emit buttonRecordingStarted();
    }
    Q_SLOT void recordingStopped() {
+        m_overlay.setText(RecordingLayer, QString());
+        update();
         emit buttonRecordingStopped();
    }
 
@@ -360,6 +1167,48 @@ private:
        QSize toolbarSize = m_toolbar->size();
        QSize windowSize = event->size();
        m_toolbar->move(windowSize.width() - toolbarSize.width(), windowSize.height() - toolbarSize.height());
+       emit tileResized(windowSize);
+       emit sourceSizeNeeded(QSize(qRound(windowSize.width() * m_zoom), qRound(windowSize.height() * m_zoom)));
+   }
+
+   QRectF region() const {
+       double size = 1.0 / m_zoom;
+       return QRectF(m_center.x() - size / 2, m_center.y() - size / 2, size, size);
+   }
+
+   void emitRegion() {
+       // Keep the region inside the frame.
+       double half = 0.5 / m_zoom;
+       m_center = QPointF(qBound(half, m_center.x(), 1 - half), qBound(half, m_center.y(), 1 - half));
+       emit regionChanged(region());
+       emit sourceSizeNeeded(QSize(qRound(width() * m_zoom), qRound(height() * m_zoom)));
+       m_overlay.setText(ZoomLayer, m_zoom > 1 ? QString("x%1").arg(m_zoom, 0, 'f', 1) : QString());
+       update();
+   }
+
+   void mouseDoubleClickEvent(QMouseEvent *) { emit focusToggled(); }
+
+   void wheelEvent(QWheelEvent * event) {
+       if (!m_focused) return;
+       // Zoom about the point under the cursor, so it stays where it is.
+       QPointF position = wheelPosition(event);
+       QPointF at(position.x() / qMax(1, width()), position.y() / qMax(1, height()));
+       QRectF before = region();
+       QPointF pointed(before.x() + at.x() * before.width(), before.y() + at.y() * before.height());
+       m_zoom = qBound(1.0, m_zoom * (event->angleDelta().y() > 0 ? FOCUS_ZOOM_STEP : 1 / FOCUS_ZOOM_STEP), FOCUS_MAX_ZOOM);
+       double size = 1.0 / m_zoom;
+       m_center = QPointF(pointed.x() - at.x() * size + size / 2, pointed.y() - at.y() * size + size / 2);
+       emitRegion();
+   }
+
+   void mousePressEvent(QMouseEvent * event) { m_dragFrom = event->pos(); }
+
+   void mouseMoveEvent(QMouseEvent * event) {
+       if (!m_focused || m_zoom <= 1 || !(event->buttons() & Qt::LeftButton)) return;
+       QPoint moved = event->pos() - m_dragFrom;
+       m_dragFrom = event->pos();
+       m_center -= QPointF(moved.x() / (m_zoom * qMax(1, width())), moved.y() / (m_zoom * qMax(1, height())));
+       emitRegion();
    }
 
    void showToolbar()
@@ -425,6 +1274,7 @@ private:
        else forceUpdate = false;
 
        m_measuredFps = "FPS[" + QString::number(m_fps) + "]";
+       m_overlay.setText(FpsLayer, m_measuredFps);
        m_fps = 0;
 
        if (forceUpdate) update();
@@ -435,7 +1285,22 @@ private:
    QString m_measuredFps = "FPS[-]";
 };
 
-class Thread final : public QThread { public: ~Thread() { quit(); wait(); } };
+// Runs under the placement policy of its stage once place()d.
+class Thread final : public QThread {
+   bool m_placed = false;
+   ThreadPlacement::Stage m_stage = ThreadPlacement::Gui;
+   QString m_name;
+public:
+   ~Thread() { quit(); wait(); }
+   // Before start().
+   void place(ThreadPlacement::Stage stage, const QString & name) { m_placed = true; m_stage = stage; m_name = name; }
+protected:
+   void run() override {
+      if (m_placed) ThreadPlacement::enter(m_stage, m_name);
+      QThread::run();
+      if (m_placed) ThreadPlacement::leave();
+   }
+};
 
 class VideoStreamInstance {
 public:
@@ -450,75 +1315,376 @@ public:
 #define PROPKEY_CAMERAS_PROPERTY "cameras"
 #define PROPKEY_FULLSCREEN "full_screen"
 #define PROPKEY_RECORD_VIDEO_CAMERA_LIST_PROPERTY "recordVideoFromCamera"
+#define DEFAULT_VIDEO_PROPERTIES_PATH "../qt_multicamera/videoProperties.ini"
+#define MS_RELOAD_SETTLE_INTERVAL 500
+#define PROPKEY_NETWORK_LATENCY_MS "network_latency_ms"
+#define PROPKEY_NETWORK_JITTER_FRAMES "network_jitter_frames"
+#define PROPKEY_CAMERA_LATENCY_MS ".latency_ms"
+#define PROPKEY_CAMERA_JITTER_FRAMES ".jitter_frames"
+#define PROPKEY_SCALED_DECODE "scaled_decode"
+#define PROPKEY_CAMERA_SCALED_DECODE ".scaled_decode"
+#define PROPKEY_FRAME_BUS "frame_bus"
+#define PROPKEY_CAMERA_FRAME_BUS ".frame_bus"
+#define PROPKEY_FRAME_BUS_SLOTS "frame_bus_slots"
+#define PROPKEY_CAMERA_FRAME_BUS_SLOTS ".frame_bus_slots"
+#define PROPKEY_TIMELAPSE_INTERVAL_S "timelapse_interval_s"
+#define PROPKEY_CAMERA_TIMELAPSE_INTERVAL_S ".timelapse_interval_s"
+#define PROPKEY_TIMELAPSE_SELECT "timelapse_select"
+#define PROPKEY_CAMERA_TIMELAPSE_SELECT ".timelapse_select"
+#define PROPKEY_RECORD_FORMAT "record_format"
+#define PROPKEY_CAMERA_RECORD_FORMAT ".record_format"
+#define PROPKEY_RAW_REPLAY_TIMING "raw_replay_timing"
+#define PROPKEY_FOCUS_THUMBNAIL_FPS "focus_thumbnail_fps"
+#define PROPKEY_CAMERA_RAW_REPLAY_TIMING ".raw_replay_timing"
+#define PROPKEY_SKIP_DUPLICATES "skip_duplicates"
+#define PROPKEY_SNAPSHOT_DUPLICATES "snapshot_duplicates"
+#define PROPKEY_WINDOWS "windows"
+#define PROPKEY_WINDOW_CAMERAS ".cameras"
+#define PROPKEY_WINDOW_SCREEN ".screen"
+#define PROPKEY_WINDOW_FULLSCREEN ".full_screen"
+#define PROPKEY_HEADLESS "headless"
+#define PROPKEY_SNAPSHOT_HASH_DISTANCE "snapshot_hash_distance"
+#define PROPKEY_CAMERA_SKIP_DUPLICATES ".skip_duplicates"
+#define PROPKEY_CAMERA_CALIBRATION ".calibration"
+#define PROPKEY_CAMERA_UNDISTORT ".undistort"
+#define PROPKEY_PLACEMENT_CPUS "cpus"
+#define PROPKEY_PLACEMENT_NUMA_NODE "numa_node"
+#define PROPKEY_PLACEMENT_NICE "nice"
+#define PROPKEY_PLACEMENT_REALTIME_PRIORITY "realtime_priority"
+#define PROPKEY_THREAD_REPORT_S "thread_report_s"
+#define PROPKEY_REACTOR_THREADS "reactor_threads"
+#define MAX_REACTOR_THREADS 64
+#define PROPKEY_TRACE_SECONDS "trace_seconds"
+#define DEFAULT_TRACE_SECONDS 30
+// 0 sizes each thread's trace ring from trace_seconds.
+#define PROPKEY_TRACE_EVENTS_PER_THREAD "trace_events_per_thread"
+#define DEFAULT_THREAD_REPORT_S 30
+#define PROPKEY_MEMORY_BUDGET_MB "memory_budget_mb"
+#define PROPKEY_MEMORY_REPORT_S "memory_report_s"
+#define DEFAULT_MEMORY_REPORT_S 30
+#define PROPKEY_STORAGE_QUEUE_MB "storage_queue_mb"
+#define PROPKEY_STORAGE_PREALLOCATE_MB "storage_preallocate_mb"
+#define PROPKEY_HTTP_PORT "http_port"
+#define PROPKEY_HTTP_ADDRESS "http_address"
+#define PROPKEY_HTTP_TOKEN "http_token"
+#define PROPKEY_HTTP_QUALITY "http_quality"
+#define PROPKEY_HTTP_MOSAIC_FPS "http_mosaic_fps"
+#define PROPKEY_HTTP_MOSAIC_TILE_WIDTH "http_mosaic_tile_width"
+#define PROPKEY_RECORD_MODE "record_mode"
+#define PROPKEY_MOSAIC_RECORD_FPS "mosaic_record_fps"
+#define PROPKEY_MOSAIC_RECORD_TILE_WIDTH "mosaic_record_tile_width"
+#define PROPKEY_MOSAIC_RECORD_QUALITY "mosaic_record_quality"
+
+// The key as a whole number, the default if it is not set or not a number.
+static int intProperty(const cppproperties::Properties & p, const char * key, int defaultValue) {
+    bool ok;
+    int value = QString::fromStdString(p.GetProperty(key, "")).trimmed().toInt(&ok);
+    return ok ? value : defaultValue;
+}
 
-int main(int argc, char *argv[])
-{
-    qDebug() << "------------------------------------------";
-    qDebug().noquote() << "Qt Version:: " << qVersion();
-    qDebug() << "------------------------------------------";
-    qDebug().noquote() << QString::fromStdString(cv::getBuildInformation());
-    qDebug() << "------------------------------------------";
+// "true" or "1" is true, anything else set is false.
+static bool boolProperty(const cppproperties::Properties & p, const char * key, bool defaultValue) {
+    QString value = QString::fromStdString(p.GetProperty(key, "")).trimmed();
+    if (value.isEmpty()) return defaultValue;
+    return value.compare("true", Qt::CaseInsensitive) == 0 || value == "1";
+}
 
-    qRegisterMetaType<cv::Mat>();
-   QApplication app(argc, argv);
+// Reads "<camera><suffix>", falling back to the global key and then the default.
+static int cameraIntProperty(const cppproperties::Properties & p, const QString & camera, const char * suffix,
+                             const char * globalKey, int defaultValue) {
+    bool ok;
+    int value = intProperty(p, globalKey, defaultValue);
+    int cameraValue = QString::fromStdString(p.GetProperty((camera + QString::fromLatin1(suffix)).toStdString(), "")).trimmed().toInt(&ok);
+    return ok ? cameraValue : value;
+}
 
-   // Load the ini file that notifies what video streams to use.
-   cppproperties::PropertiesParser propParser = cppproperties::PropertiesParser();
-   cppproperties::Properties p = propParser.Read("../qt_multicamera/videoProperties.ini");
+// As cameraIntProperty(), for true/false keys.
+static bool cameraBoolProperty(const cppproperties::Properties & p, const QString & camera, const char * suffix,
+                               const char * globalKey, bool defaultValue) {
+    QString value = QString::fromStdString(p.GetProperty((camera + QString::fromLatin1(suffix)).toStdString(), p.GetProperty(globalKey, ""))).trimmed();
+    if (value.isEmpty()) return defaultValue;
+    return value.compare("true", Qt::CaseInsensitive) == 0 || value == "1";
+}
 
-   QString cameraList = QString::fromStdString(p.GetProperty(PROPKEY_CAMERAS_PROPERTY));
-   QStringList camera_list = cameraList.split((","));
+// "<prefix>cpus", "<prefix>numa_node", "<prefix>nice" and "<prefix>realtime_priority", false if none are set.
+static bool placementPolicy(const cppproperties::Properties & p, const QString & prefix, ThreadPlacement::Policy & policy) {
+    auto property = [&p, &prefix](const char * suffix) {
+        return QString::fromStdString(p.GetProperty((prefix + QString::fromLatin1(suffix)).toStdString(), "")).trimmed();
+    };
+    QString cpus = property(PROPKEY_PLACEMENT_CPUS), node = property(PROPKEY_PLACEMENT_NUMA_NODE);
+    QString nice = property(PROPKEY_PLACEMENT_NICE), realtime = property(PROPKEY_PLACEMENT_REALTIME_PRIORITY);
+    if (cpus.isEmpty() && node.isEmpty() && nice.isEmpty() && realtime.isEmpty()) return false;
+
+    policy.cpus = ThreadPlacement::parseCpuList(cpus);
+    if (!node.isEmpty()) {
+        QList<int> nodeCpus = ThreadPlacement::numaNodeCpus(node.toInt());
+        if (policy.cpus.isEmpty()) policy.cpus = nodeCpus;
+        else foreach (int cpu, QList<int>(policy.cpus)) if (!nodeCpus.contains(cpu)) policy.cpus.removeAll(cpu);
+    }
+    policy.niceSet = !nice.isEmpty();
+    policy.nice = qBound(-20, nice.toInt(), 19);
+    policy.realtimePriority = qMax(0, realtime.toInt());
+    return true;
+}
 
-   QString recordVideoRequest = QString::fromStdString(p.GetProperty(PROPKEY_RECORD_VIDEO_CAMERA_LIST_PROPERTY));
-   QStringList recordVideoRequestCameraList = recordVideoRequest.split((","));
+// Everything from the ini file that a running stream depends on.
+struct StreamSettings {
+    QString url;
+    int msNetworkLatency = DEFAULT_NETWORK_LATENCY_MS;
+    int networkJitterFrames = DEFAULT_NETWORK_JITTER_FRAMES;
+    bool scaledDecode = true;
+    bool frameBus = false;
+    int frameBusSlots = FRAMEBUS_DEFAULT_SLOTS;
+    int msTimelapseInterval = 0;
+    QString timelapseSelect;
+    bool rawRecording = false;
+    bool rawOriginalTiming = true;
+    bool skipDuplicates = true;
+    QString calibration;                // Empty is no lens correction
+    QString undistort;                  // display, record or both
+
+    static StreamSettings fromProperties(const cppproperties::Properties & p, const QString & camera) {
+        StreamSettings settings;
+        settings.url = QString::fromStdString(p.GetProperty(camera.toStdString(), "")).trimmed();
+        settings.msNetworkLatency = cameraIntProperty(p, camera, PROPKEY_CAMERA_LATENCY_MS, PROPKEY_NETWORK_LATENCY_MS, DEFAULT_NETWORK_LATENCY_MS);
+        settings.networkJitterFrames = cameraIntProperty(p, camera, PROPKEY_CAMERA_JITTER_FRAMES, PROPKEY_NETWORK_JITTER_FRAMES, DEFAULT_NETWORK_JITTER_FRAMES);
+        settings.scaledDecode = cameraBoolProperty(p, camera, PROPKEY_CAMERA_SCALED_DECODE, PROPKEY_SCALED_DECODE, true);
+        settings.frameBus = cameraBoolProperty(p, camera, PROPKEY_CAMERA_FRAME_BUS, PROPKEY_FRAME_BUS, false);
+        settings.skipDuplicates = cameraBoolProperty(p, camera, PROPKEY_CAMERA_SKIP_DUPLICATES, PROPKEY_SKIP_DUPLICATES, true);
+        settings.frameBusSlots = qMax(2, cameraIntProperty(p, camera, PROPKEY_CAMERA_FRAME_BUS_SLOTS, PROPKEY_FRAME_BUS_SLOTS, FRAMEBUS_DEFAULT_SLOTS));
+        settings.msTimelapseInterval = qMax(0, cameraIntProperty(p, camera, PROPKEY_CAMERA_TIMELAPSE_INTERVAL_S, PROPKEY_TIMELAPSE_INTERVAL_S, 0)) * MS_ONE_SECOND;
+        settings.timelapseSelect = QString::fromStdString(p.GetProperty((camera + PROPKEY_CAMERA_TIMELAPSE_SELECT).toStdString(),
+                                                                        p.GetProperty(PROPKEY_TIMELAPSE_SELECT, "first"))).trimmed();
+        auto text = [&p, &camera](const char * suffix, const char * globalKey, const char * defaultValue) {
+            return QString::fromStdString(p.GetProperty((camera + QString::fromLatin1(suffix)).toStdString(), p.GetProperty(globalKey, defaultValue))).trimmed().toLower();
+        };
+        settings.rawRecording = text(PROPKEY_CAMERA_RECORD_FORMAT, PROPKEY_RECORD_FORMAT, "mjpeg") == "raw";
+        settings.rawOriginalTiming = text(PROPKEY_CAMERA_RAW_REPLAY_TIMING, PROPKEY_RAW_REPLAY_TIMING, "original") != "unthrottled";
+        // Per camera only, a calibration belongs to one lens.
+        settings.calibration = QString::fromStdString(p.GetProperty((camera + PROPKEY_CAMERA_CALIBRATION).toStdString(), "")).trimmed();
+        settings.undistort = QString::fromStdString(p.GetProperty((camera + PROPKEY_CAMERA_UNDISTORT).toStdString(), "display")).trimmed().toLower();
+        return settings;
+    }
+    bool operator==(const StreamSettings & other) const {
+        return url == other.url && msNetworkLatency == other.msNetworkLatency && networkJitterFrames == other.networkJitterFrames
+            && scaledDecode == other.scaledDecode && frameBus == other.frameBus && frameBusSlots == other.frameBusSlots
+            && msTimelapseInterval == other.msTimelapseInterval && timelapseSelect == other.timelapseSelect
+            && rawRecording == other.rawRecording && rawOriginalTiming == other.rawOriginalTiming
+            && skipDuplicates == other.skipDuplicates && calibration == other.calibration && undistort == other.undistort;
+    }
+    bool operator!=(const StreamSettings & other) const { return !(*this == other); }
+};
 
-   // Calculate the size of the grid required to display evenly
-   int numStreams = camera_list.size();
-   float root = qSqrt(numStreams);
-   int gridSizeY = numStreams / (int) root;
-   int gridSizeX = numStreams / (int) gridSizeY;
-   gridSizeX += (int) numStreams % (gridSizeX * gridSizeY);
-//   qDebug() << "--------------------------------";
-//   qDebug() << "gridX = " << gridSizeX << ", gridY = " << gridSizeY << ".";
-//   qDebug() << "--------------------------------";
+// Owns every running stream and the grid they are shown in. The set of streams
+// can be changed while running, only the streams whose camera entry changed are
+// touched so the others keep capturing and recording.
+class StreamWall : public QObject {
+   Q_OBJECT
+   QGridLayout * m_grid;
+   QWidget * m_container;
+   QStringList m_order;                          // Camera names in display order
+   QMap<QString, VideoStreamInstance *> m_streams;
+   QMap<QString, StreamSettings> m_settings;     // Camera name -> settings currently running
+   QFileSystemWatcher m_watcher;
+   QTimer m_reloadTimer;
+   QString m_propertiesPath;
+   PreviewServer * m_previewServer = nullptr;
+   MosaicRecorder * m_mosaicRecorder = nullptr;
+   bool m_recordCameras = true;                  // Record ALL records each camera as well as, or instead of, the mosaic
+   StorageWriter * m_storage;
+   SnapshotStore * m_snapshots = nullptr;
+   QList<CaptureReactor *> m_reactors;           // Shared capture threads for webcams, none means a thread per camera
+   QString m_focused;                            // The camera shown large, empty when all are equal
+   int m_thumbnailFps = DEFAULT_FOCUS_THUMBNAIL_FPS;
+   QMap<QString, CaptureReactor *> m_reactorOf;  // Camera name -> reactor its capture lives on
+   QMap<QString, WindowRenderer *> m_rendererOf; // Camera name -> window it is shown in instead of the grid
+   QMap<QString, QSize> m_windowTileSize;        // Camera name -> size of its tile in that window
+   bool m_headless = false;                      // A capture node, nothing is shown
+public:
+   StreamWall(QWidget * container, QGridLayout * grid, StorageWriter * storage, QObject * parent = nullptr)
+       : QObject(parent), m_grid(grid), m_container(container), m_storage(storage) {
+       // Editors often write the file more than once, so let it settle before reloading.
+       m_reloadTimer.setSingleShot(true);
+       m_reloadTimer.setInterval(MS_RELOAD_SETTLE_INTERVAL);
+       connect(&m_reloadTimer, &QTimer::timeout, this, &StreamWall::reload);
+       connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &StreamWall::propertiesChanged);
+   }
+   ~StreamWall() { foreach (const QString & camera, m_order) removeStream(camera); }
+
+   // Streams added from now on also feed the server, which runs in its own thread.
+   void setPreviewServer(PreviewServer * server) { m_previewServer = server; }
+   // Likewise the mosaic recorder, set before any stream is added.
+   void setMosaicRecorder(MosaicRecorder * recorder, bool recordCameras) {
+       m_mosaicRecorder = recorder;
+       m_recordCameras = recordCameras;
+   }
+   // Webcams added from now on are captured on the least busy of these, each on its own running thread.
+   void setCaptureReactors(const QList<CaptureReactor *> & reactors) { m_reactors = reactors; }
+   // Set before any stream is added.
+   void setSnapshotStore(SnapshotStore * snapshots) { m_snapshots = snapshots; }
+   // Set before any stream is added.
+   void setHeadless(bool headless) { m_headless = headless; }
+   // How often the other streams are refreshed while one is in focus.
+   void setThumbnailFramesPerSecond(int fps) { m_thumbnailFps = qMax(1, fps); }
+   // Cameras these list are shown in their window instead of the grid, set before any stream is added.
+   // A camera listed by more than one window goes to the first.
+   void setWindowRenderers(const QList<WindowRenderer *> & renderers) {
+       foreach (WindowRenderer * renderer, renderers) {
+           foreach (const QString & camera, renderer->cameras())
+               if (!m_rendererOf.contains(camera)) m_rendererOf[camera] = renderer;
+           connect(renderer, &WindowRenderer::tileResized, this, &StreamWall::windowTileResized);
+       }
+   }
 
-  // For now one window and display all video stream widgets within it
-  QMainWindow viewingWindow;
-  viewingWindow.setWindowTitle("Multiple Video Streaming Viewer");
-  viewingWindow.setSizePolicy(QSizePolicy::Expanding,QSizePolicy::Expanding);
+   void watch(const QString & propertiesPath) {
+       m_propertiesPath = propertiesPath;
+       m_watcher.addPath(m_propertiesPath);
+   }
 
-  // Make sure we can put the video streams in a grid
-  QGridLayout * viewingGrid = new QGridLayout();
+   // Bring the running streams in line with the cameras listed in the properties.
+   void apply(const cppproperties::Properties & p) {
+       QStringList cameras;
+       QMap<QString, StreamSettings> settings;
+       foreach (QString camera, QString::fromStdString(p.GetProperty(PROPKEY_CAMERAS_PROPERTY, "")).split(",")) {
+           camera = camera.trimmed();
+           if (camera.isEmpty() || cameras.contains(camera)) continue;
+           cameras.append(camera);
+           settings[camera] = StreamSettings::fromProperties(p, camera);
+           ThreadPlacement::Policy policy;
+           if (placementPolicy(p, camera + ".", policy)) ThreadPlacement::setPolicy(camera, policy);
+       }
 
-  QWidget* widget = new QWidget(&viewingWindow);
-  widget->setLayout(viewingGrid);
-  viewingWindow.setCentralWidget(widget);
-  viewingWindow.setSizePolicy(QSizePolicy::Expanding,QSizePolicy::Expanding);
+       QStringList previousOrder = m_order;
+       foreach (const QString & camera, previousOrder)
+           if (!cameras.contains(camera)) removeStream(camera);
 
-  viewingWindow.setVisible(true);
-  viewingWindow.show();
+       bool replaced = false;
+       foreach (const QString & camera, cameras) {
+           if (!m_streams.contains(camera)) addStream(camera, settings[camera]);
+           else if (m_settings[camera] != settings[camera]) replaced = restartStream(camera, settings[camera]) || replaced;
+       }
 
-   int row = 0, col = 0;
-   QList<VideoStreamInstance *> streamList;
-   QString camera;
-   foreach (camera, camera_list)
-   {
-       camera = camera.trimmed();
+       m_order = cameras;
+       if (!m_streams.contains(m_focused)) m_focused.clear();
+       applyFocus();
+       if (replaced || previousOrder != cameras) reflow();
+       if (previousOrder != cameras) {
+           if (m_previewServer) QMetaObject::invokeMethod(m_previewServer, "setStreams", Qt::QueuedConnection, Q_ARG(QStringList, m_order));
+           if (m_mosaicRecorder) QMetaObject::invokeMethod(m_mosaicRecorder, "setStreams", Qt::QueuedConnection, Q_ARG(QStringList, m_order));
+       }
+   }
+
+   Q_SLOT void recordAll() {
+       if (m_recordCameras) foreach (VideoStreamInstance * vStream, m_streams) vStream->view.recordPressed();
+       if (m_mosaicRecorder) QMetaObject::invokeMethod(m_mosaicRecorder, "start", Qt::QueuedConnection);
+   }
+   Q_SLOT void stopAll() {
+       foreach (VideoStreamInstance * vStream, m_streams) vStream->view.stopPressed();
+       if (m_mosaicRecorder) QMetaObject::invokeMethod(m_mosaicRecorder, "stop", Qt::QueuedConnection);
+   }
+   // A viewer using this instance as a node asked for something, as if the camera's button was pressed.
+   Q_SLOT void nodeCommand(const QString & camera, const QString & command) {
+       VideoStreamInstance * vStream = m_streams.value(camera);
+       if (!vStream) return;
+       qDebug() << "Viewer asked for" << command << "on" << camera;
+       if (command == NODE_COMMAND_RECORD) vStream->view.recordPressed();
+       else if (command == NODE_COMMAND_STOP) vStream->view.stopPressed();
+       else if (command == NODE_COMMAND_SNAPSHOT) vStream->view.snapshotPressed();
+   }
+
+private:
+   Q_SLOT void propertiesChanged(const QString & path) {
+       // Saving by rename replaces the file and drops it from the watcher, so watch it again.
+       if (!m_watcher.files().contains(path) && QFile::exists(path)) m_watcher.addPath(path);
+       m_reloadTimer.start();
+   }
+
+   Q_SLOT void reload() {
+       if (!m_watcher.files().contains(m_propertiesPath) && QFile::exists(m_propertiesPath)) m_watcher.addPath(m_propertiesPath);
+       try {
+           cppproperties::Properties p = cppproperties::PropertiesParser::Read(m_propertiesPath.toStdString());
+           qDebug() << "Reloading" << m_propertiesPath;
+           apply(p);
+       } catch (const cppproperties::PropertiesException & e) {
+           // Keep what is running rather than tear the wall down over a half written file.
+           qDebug() << "Ignoring properties change:" << e.what();
+       }
+   }
+
+   bool usesReactor(const StreamSettings & settings) const {
+       bool isWebcam;
+       settings.url.toInt(&isWebcam);
+       return isWebcam && !m_reactors.isEmpty();
+   }
+
+   CaptureReactor * leastBusyReactor() const {
+       CaptureReactor * best = m_reactors.first();
+       foreach (CaptureReactor * reactor, m_reactors)
+           if (m_reactorOf.values().count(reactor) < m_reactorOf.values().count(best)) best = reactor;
+       return best;
+   }
 
-       VideoStreamInstance * vStream = new VideoStreamInstance(widget);
+   void addStream(const QString & camera, const StreamSettings & settings) {
+       VideoStreamInstance * vStream = new VideoStreamInstance(m_container);
+       vStream->capture.setStorageWriter(m_storage);
+       vStream->capture.setSnapshotStore(m_snapshots);
 
-       // Everything runs at the same priority as the gui, so it won't supply useless frames.
+       // Placement (CPUs, priority) comes from the capture and convert policies, by default
+       // everything runs at the same priority as the gui, so it won't supply useless frames.
        vStream->converter.setProcessAll(false);
-       vStream->captureThread.start();
+       vStream->converter.setBudgetOwner(camera);
+       vStream->converterThread.place(ThreadPlacement::Convert, camera + " convert");
        vStream->converterThread.start();
-       vStream->capture.moveToThread(&vStream->captureThread);
+       if (usesReactor(settings)) {
+           // The capture thread is left unstarted, the reactor's thread runs this camera with others.
+           CaptureReactor * reactor = leastBusyReactor();
+           m_reactorOf[camera] = reactor;
+           vStream->capture.setReactor(reactor);
+           vStream->capture.moveToThread(reactor->thread());
+       } else {
+           vStream->captureThread.place(ThreadPlacement::Capture, camera);
+           vStream->captureThread.start();
+           vStream->capture.moveToThread(&vStream->captureThread);
+       }
        vStream->converter.moveToThread(&vStream->converterThread);
 
-       // Set up basic relationship between capture -> converter -> imageViewer.
-       QObject::connect(&vStream->capture, &Capture::frameReady, &vStream->converter, &Converter::processFrame);
+       // Set up basic relationship between capture -> converter -> imageViewer. Headless nothing is shown, so nothing is converted.
+       if (!m_headless) QObject::connect(&vStream->capture, &Capture::frameReady, &vStream->converter, &Converter::processFrame);
        QObject::connect(&vStream->capture, &Capture::cameraNamed, &vStream->view, &ImageViewer::setCameraName);
-       QObject::connect(&vStream->converter, &Converter::imageReady, &vStream->view, &ImageViewer::setImage);
+       if (WindowRenderer * renderer = m_rendererOf.value(camera)) {
+           // Painted by the window's render thread, the tile in the grid is never shown or fed.
+           vStream->view.hide();
+           QObject::connect(&vStream->converter, &Converter::imageReady, renderer, [renderer, camera](const QImage & image) { renderer->setImage(camera, image); });
+           QObject::connect(&vStream->capture, &Capture::sourceStatsChanged, renderer, [renderer, camera](const QString & stats) { renderer->setSourceStats(camera, stats); });
+           QObject::connect(&vStream->capture, &Capture::recordingStarted, renderer, [renderer, camera]() { renderer->setRecording(camera, true); });
+           QObject::connect(&vStream->capture, &Capture::recordingStopped, renderer, [renderer, camera]() { renderer->setRecording(camera, false); });
+           if (m_windowTileSize.contains(camera)) setTileSize(vStream, m_windowTileSize[camera]);
+       } else {
+           QObject::connect(&vStream->capture, &Capture::sourceStatsChanged, &vStream->view, &ImageViewer::setSourceStats);
+           QObject::connect(&vStream->converter, &Converter::imageReady, &vStream->view, &ImageViewer::setImage);
+           QObject::connect(&vStream->view, &ImageViewer::tileResized, &vStream->converter, &Converter::setTargetSize);
+           QObject::connect(&vStream->view, &ImageViewer::sourceSizeNeeded, &vStream->capture, &Capture::setPreviewSize);
+           QObject::connect(&vStream->view, &ImageViewer::regionChanged, &vStream->converter, &Converter::setRegion);
+           QObject::connect(&vStream->view, &ImageViewer::focusToggled, this, [this, camera]() { toggleFocus(camera); });
+       }
        QObject::connect(&vStream->capture, &Capture::started, [](){ qDebug() << "Capture started."; });
+       if (m_previewServer) {
+           PreviewServer * server = m_previewServer;
+           QSharedPointer<FrameShare> share(new FrameShare(camera));
+           vStream->capture.addFrameShare(share);
+           QMetaObject::invokeMethod(server, [server, camera, share]() { server->addShare(camera, share); }, Qt::QueuedConnection);
+           // Sent along with the frames to viewers using this instance as a node.
+           QObject::connect(&vStream->capture, &Capture::sourceStatsChanged, server, [server, camera](const QString & stats) { server->setSourceStats(camera, stats); });
+           QObject::connect(&vStream->capture, &Capture::recordingStarted, server, [server, camera]() { server->setRecording(camera, true); });
+           QObject::connect(&vStream->capture, &Capture::recordingStopped, server, [server, camera]() { server->setRecording(camera, false); });
+       }
+       if (m_mosaicRecorder) {
+           MosaicRecorder * recorder = m_mosaicRecorder;
+           QSharedPointer<FrameShare> share(new FrameShare(camera, FrameShare::Sample));
+           vStream->capture.addFrameShare(share);
+           QMetaObject::invokeMethod(recorder, [recorder, camera, share]() { recorder->addShare(camera, share); }, Qt::QueuedConnection);
+           QObject::connect(&vStream->view, &ImageViewer::tileResized, recorder, &MosaicRecorder::setGridTileSize);
+       }
 
        // Set up recording and snapshot relationship between capture -> imageViewer.
        QObject::connect(&vStream->view, &ImageViewer::startRecording, &vStream->capture, &Capture::startRecording);
@@ -527,25 +1693,433 @@ int main(int argc, char *argv[])
        QObject::connect(&vStream->capture, &Capture::recordingStarted, &vStream->view, &ImageViewer::recordingStarted);
        QObject::connect(&vStream->capture, &Capture::recordingStopped, &vStream->view, &ImageViewer::recordingStopped);
 
+       m_streams[camera] = vStream;
+       startCapture(vStream, camera, settings);
+   }
+
+   // True if the stream had to be replaced, which takes its tile out of the grid.
+   bool restartStream(const QString & camera, const StreamSettings & settings) {
+       qDebug() << "Reconfiguring" << camera << "to" << settings.url;
+       if (usesReactor(settings) != m_reactorOf.contains(camera)) {
+           // Moving between a reactor and a thread of its own needs a new stream.
+           QStringList order = m_order;
+           removeStream(camera);
+           addStream(camera, settings);
+           m_order = order;
+           return true;
+       }
+       VideoStreamInstance * vStream = m_streams[camera];
+       QMetaObject::invokeMethod(&vStream->capture, "stop", Qt::BlockingQueuedConnection);
+       vStream->view.setSourceStats(QString());
+       if (WindowRenderer * renderer = m_rendererOf.value(camera))
+           QMetaObject::invokeMethod(renderer, "setSourceStats", Qt::QueuedConnection, Q_ARG(QString, camera), Q_ARG(QString, QString()));
+       startCapture(vStream, camera, settings);
+       return false;
+   }
+
+   void removeStream(const QString & camera) {
+       VideoStreamInstance * vStream = m_streams.take(camera);
+       if (!vStream) return;
+       qDebug() << "Removing" << camera;
+       m_settings.remove(camera);
+       m_order.removeAll(camera);
+       if (m_focused == camera) m_focused.clear();
+       m_grid->removeWidget(&vStream->view);
+       // Stop in the capture thread so any recording is closed cleanly before the threads go.
+       QMetaObject::invokeMethod(&vStream->capture, "stop", Qt::BlockingQueuedConnection);
+       if (WindowRenderer * renderer = m_rendererOf.value(camera)) {
+           QMetaObject::invokeMethod(renderer, "setImage", Qt::QueuedConnection, Q_ARG(QString, camera), Q_ARG(QImage, QImage()));
+           QMetaObject::invokeMethod(renderer, "setSourceStats", Qt::QueuedConnection, Q_ARG(QString, camera), Q_ARG(QString, QString()));
+           QMetaObject::invokeMethod(renderer, "setRecording", Qt::QueuedConnection, Q_ARG(QString, camera), Q_ARG(bool, false));
+       }
+       if (m_reactorOf.remove(camera)) {
+           // Only the thread an object lives on may move it, bring it back here to delete it.
+           Capture * capture = &vStream->capture;
+           QThread * here = QThread::currentThread();
+           QMetaObject::invokeMethod(capture, [capture, here]() { capture->moveToThread(here); }, Qt::BlockingQueuedConnection);
+       }
+       delete vStream;
+   }
+
+   void startCapture(VideoStreamInstance * vStream, const QString & camera, const StreamSettings & settings) {
+       m_settings[camera] = settings;
+       QMetaObject::invokeMethod(&vStream->capture, "setNetworkOptions", Qt::QueuedConnection,
+                                 Q_ARG(int, settings.msNetworkLatency), Q_ARG(int, settings.networkJitterFrames));
+       QMetaObject::invokeMethod(&vStream->capture, "setScaledDecode", Qt::QueuedConnection, Q_ARG(bool, settings.scaledDecode));
+       QMetaObject::invokeMethod(&vStream->capture, "setFrameBus", Qt::QueuedConnection, Q_ARG(bool, settings.frameBus), Q_ARG(int, settings.frameBusSlots));
+       QMetaObject::invokeMethod(&vStream->capture, "setTimelapse", Qt::QueuedConnection,
+                                 Q_ARG(int, settings.msTimelapseInterval), Q_ARG(QString, settings.timelapseSelect));
+       QMetaObject::invokeMethod(&vStream->capture, "setRawRecording", Qt::QueuedConnection, Q_ARG(bool, settings.rawRecording));
+       QMetaObject::invokeMethod(&vStream->capture, "setRawReplayTiming", Qt::QueuedConnection, Q_ARG(bool, settings.rawOriginalTiming));
+       QMetaObject::invokeMethod(&vStream->capture, "setSkipDuplicates", Qt::QueuedConnection, Q_ARG(bool, settings.skipDuplicates));
+       // Shown undistorted at the size of the tile, recorded undistorted at full size, or both.
+       bool undistortDisplay = settings.undistort == "display" || settings.undistort == "both";
+       bool undistortRecording = settings.undistort == "record" || settings.undistort == "both";
+       QMetaObject::invokeMethod(&vStream->converter, "setLensCorrection", Qt::QueuedConnection,
+                                 Q_ARG(QString, undistortDisplay ? settings.calibration : QString()));
+       QMetaObject::invokeMethod(&vStream->capture, "setLensCorrection", Qt::QueuedConnection,
+                                 Q_ARG(QString, settings.calibration), Q_ARG(bool, undistortRecording));
+
        // Select the right argument for the capture stream.
-       QString argCamUrl = QString::fromStdString(p.GetProperty(camera.toStdString())).trimmed();
+       const QString & url = settings.url;
        bool isInt;
-       int intCamUrlArg = argCamUrl.toInt(&isInt);
+       int intCamUrlArg = url.toInt(&isInt);
 
        // And start capturing
        if (isInt) QMetaObject::invokeMethod(&vStream->capture, "start", Qt::QueuedConnection, Q_ARG(int, intCamUrlArg),Q_ARG(QString, camera));
-       else QMetaObject::invokeMethod(&vStream->capture, "start", Qt::QueuedConnection, Q_ARG(QString, argCamUrl),Q_ARG(QString, camera));
+       else QMetaObject::invokeMethod(&vStream->capture, "start", Qt::QueuedConnection, Q_ARG(QString, url),Q_ARG(QString, camera));
+   }
 
+   Q_SLOT void windowTileResized(const QString & camera, const QSize & size) {
+       m_windowTileSize[camera] = size;
+       if (m_rendererOf.value(camera) != sender()) return;
+       if (VideoStreamInstance * vStream = m_streams.value(camera)) setTileSize(vStream, size);
+   }
 
-       // Keep a list of each video stream
-       streamList.append(vStream);
+   // What ImageViewer::resizeEvent() tells the pipeline for a tile in the grid.
+   void setTileSize(VideoStreamInstance * vStream, const QSize & size) {
+       QMetaObject::invokeMethod(&vStream->converter, "setTargetSize", Qt::QueuedConnection, Q_ARG(QSize, size));
+       QMetaObject::invokeMethod(&vStream->capture, "setPreviewSize", Qt::QueuedConnection, Q_ARG(QSize, size));
+   }
+
+   // The cameras in display order that are shown in the grid rather than a window of their own.
+   QStringList gridCameras() const {
+       QStringList cameras;
+       foreach (const QString & camera, m_order) if (!m_rendererOf.contains(camera)) cameras.append(camera);
+       return cameras;
+   }
 
-       // Make sure we add the video to the main window widget
-       viewingGrid->addWidget(&vStream->view, row, col, nullptr);
-       col += 1;
-       if (col == gridSizeX) {col = 0; row+=1;}
+   void toggleFocus(const QString & camera) {
+       m_focused = (m_focused == camera) ? QString() : camera;
+       qDebug() << (m_focused.isEmpty() ? "Showing all streams equally." : "Focusing on") << m_focused;
+       applyFocus();
+       reflow();
    }
 
+   // The stream in focus gets every frame, the rest are thumbnails converted a few times a second.
+   void applyFocus() {
+       for (auto it = m_streams.constBegin(); it != m_streams.constEnd(); ++it) {
+           if (m_rendererOf.contains(it.key())) continue;
+           bool thumbnail = !m_focused.isEmpty() && it.key() != m_focused;
+           it.value()->view.setFocused(it.key() == m_focused);
+           it.value()->view.setThumbnail(thumbnail);
+           QMetaObject::invokeMethod(&it.value()->converter, "setMaxFramesPerSecond", Qt::QueuedConnection, Q_ARG(int, thumbnail ? m_thumbnailFps : 0));
+       }
+   }
+
+   // Lay the streams out again in an evenly sized grid, or in focus one large with the rest in a column beside it.
+   void reflow() {
+       foreach (VideoStreamInstance * vStream, m_streams) m_grid->removeWidget(&vStream->view);
+
+       QStringList cameras = gridCameras();
+       m_grid->setColumnStretch(0, m_focused.isEmpty() ? 0 : 1);
+       if (!m_focused.isEmpty()) {
+           QStringList others = cameras;
+           others.removeAll(m_focused);
+           m_grid->addWidget(&m_streams[m_focused]->view, 0, 0, qMax(1, others.size()), 1);
+           for (int row = 0; row < others.size(); ++row) m_grid->addWidget(&m_streams[others.at(row)]->view, row, 1);
+           return;
+       }
+
+       int gridSizeX = MosaicComposer::columnsFor(cameras.size());
+
+       int row = 0, col = 0;
+       foreach (const QString & camera, cameras) {
+           m_grid->addWidget(&m_streams[camera]->view, row, col, nullptr);
+           col += 1;
+           if (col == gridSizeX) {col = 0; row+=1;}
+       }
+   }
+};
+
+#define BATCH_CONVERT_SIZE QSize(320, 240)
+
+// Offline processing: files go through the same capture -> convert -> record
+// stages as on the wall, but as fast as they decode rather than at their frame
+// rate, several files at once each on a thread of its own. The frame rate
+// achieved is reported for every file and for the whole batch.
+class BatchRunner : public QObject {
+   Q_OBJECT
+   // Members are destroyed bottom up, so the thread has stopped before the rest goes.
+   struct Job {
+       QString path;
+       QElapsedTimer elapsed;
+       Capture capture;
+       Converter converter;
+       Thread thread;
+   };
+   QStringList m_pending;
+   QList<Job *> m_running;
+   StorageWriter * m_storage;
+   int m_parallel;
+   bool m_record;
+   QElapsedTimer m_elapsed;
+   quint64 m_frames = 0;
+   int m_files = 0;
+public:
+   BatchRunner(StorageWriter * storage, int parallel, bool record, QObject * parent = nullptr)
+       : QObject(parent), m_storage(storage), m_parallel(qMax(1, parallel)), m_record(record) {}
+   ~BatchRunner() { qDeleteAll(m_running); }
+
+   // The files given, and the videos in any directories given.
+   static QStringList findFiles(const QStringList & paths) {
+       QStringList files;
+       foreach (const QString & path, paths) {
+           if (!QFileInfo(path).isDir()) {
+               files.append(path);
+               continue;
+           }
+           QStringList videos = QStringList() << "*.mp4" << "*.avi" << "*.mkv" << "*.mov" << "*.mjpg" << "*.mjpeg" << "*." RAW_FRAME_EXTENSION;
+           foreach (const QFileInfo & file, QDir(path).entryInfoList(videos, QDir::Files, QDir::Name))
+               files.append(file.filePath());
+       }
+       return files;
+   }
+
+   void run(const QStringList & files) {
+       qDebug() << "Processing" << files.size() << "files," << m_parallel << "at a time" << (m_record ? "and recording." : "without recording.");
+       m_pending = files;
+       m_elapsed.start();
+       startMore();
+   }
+
+   Q_SIGNAL void finished();
+
+private:
+   void startMore() {
+       while (m_running.size() < m_parallel && !m_pending.isEmpty()) {
+           Job * job = new Job;
+           job->path = m_pending.takeFirst();
+           job->capture.setStorageWriter(m_storage);
+           job->converter.setProcessAll(true);
+           job->converter.setBudgetOwner(QFileInfo(job->path).completeBaseName());
+           job->converter.setTargetSize(BATCH_CONVERT_SIZE);
+           job->thread.place(ThreadPlacement::Capture, job->path);
+           job->thread.start();
+           job->capture.moveToThread(&job->thread);
+           job->converter.moveToThread(&job->thread);
+
+           // Same thread, so each frame is converted before the next one is read and nothing queues up.
+           QObject::connect(&job->capture, &Capture::frameReady, &job->converter, &Converter::processFrame, Qt::DirectConnection);
+           QObject::connect(&job->capture, &Capture::endOfStream, this, [this, job](quint64 frames) { finishJob(job, frames); });
+
+           QMetaObject::invokeMethod(&job->capture, "setPaced", Qt::QueuedConnection, Q_ARG(bool, false));
+           QMetaObject::invokeMethod(&job->capture, "setPreviewSize", Qt::QueuedConnection, Q_ARG(QSize, BATCH_CONVERT_SIZE));
+           QMetaObject::invokeMethod(&job->capture, "start", Qt::QueuedConnection, Q_ARG(QString, job->path),
+                                     Q_ARG(QString, QFileInfo(job->path).completeBaseName()), Q_ARG(bool, m_record));
+           job->elapsed.start();
+           m_running.append(job);
+       }
+       if (!m_running.isEmpty()) return;
+
+       double seconds = m_elapsed.nsecsElapsed() / 1e9;
+       qDebug().noquote() << QString("Batch: %1 files, %2 frames in %3 s, %4 fps overall.")
+                             .arg(m_files).arg(m_frames).arg(seconds, 0, 'f', 1).arg(seconds > 0 ? m_frames / seconds : 0.0, 0, 'f', 1);
+       emit finished();
+   }
+
+   void finishJob(Job * job, quint64 frames) {
+       if (!m_running.removeOne(job)) return;
+       double seconds = job->elapsed.nsecsElapsed() / 1e9;
+       qDebug().noquote() << QString("%1: %2 frames in %3 s, %4 fps.")
+                             .arg(job->path).arg(frames).arg(seconds, 0, 'f', 1).arg(seconds > 0 ? frames / seconds : 0.0, 0, 'f', 1);
+       m_frames += frames;
+       m_files++;
+       // Stop in the capture thread so the recording is closed cleanly before the thread goes.
+       QMetaObject::invokeMethod(&job->capture, "stop", Qt::BlockingQueuedConnection);
+       delete job;
+       startMore();
+   }
+};
+
+int main(int argc, char *argv[])
+{
+    qDebug() << "------------------------------------------";
+    qDebug().noquote() << "Qt Version:: " << qVersion();
+    qDebug() << "------------------------------------------";
+    qDebug().noquote() << QString::fromStdString(cv::getBuildInformation());
+    qDebug() << "------------------------------------------";
+
+    qRegisterMetaType<cv::Mat>();
+
+   // "--batch [--jobs N] [--no-record] <file or directory>..." processes files unpaced, without a window.
+   if (argc > 1 && QString::fromLocal8Bit(argv[1]) == "--batch") {
+      QCoreApplication app(argc, argv);
+      QStringList paths;
+      int jobs = QThread::idealThreadCount();
+      bool record = true;
+      QStringList arguments = app.arguments().mid(2);
+      for (int i = 0; i < arguments.size(); ++i) {
+         if (arguments.at(i) == "--jobs" && i + 1 < arguments.size()) jobs = arguments.at(++i).toInt();
+         else if (arguments.at(i) == "--no-record") record = false;
+         else paths.append(arguments.at(i));
+      }
+      QStringList files = BatchRunner::findFiles(paths);
+      if (files.isEmpty()) {
+         qDebug() << "Usage:" << app.arguments().at(0) << "--batch [--jobs N] [--no-record] <file or directory>...";
+         return 1;
+      }
+
+      // Offline nothing is dropped, a full write queue holds the decoders back instead.
+      StorageWriter storageWriter;
+      storageWriter.setWaitWhenFull(true);
+      BatchRunner runner(&storageWriter, jobs, record);
+      QObject::connect(&runner, &BatchRunner::finished, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+      runner.run(files);
+      return app.exec();
+   }
+
+   QApplication app(argc, argv);
+
+   // "--review [recording or directory...]" plays back recordings instead of capturing.
+   if (app.arguments().size() > 1 && app.arguments().at(1) == "--review") {
+      QStringList paths = app.arguments().mid(2);
+      if (paths.isEmpty()) paths.append(CAPTURED_VIDEO_DIRECTORY_PATH);
+      QStringList recordings = ReviewPlayer::findRecordings(paths);
+      if (recordings.isEmpty()) {
+         qDebug() << "No indexed recordings found in" << paths;
+         return 1;
+      }
+      ReviewPlayer player(recordings);
+      player.resize(1280, 800);
+      player.show();
+      return app.exec();
+   }
+
+   // Load the ini file that notifies what video streams to use, optionally given on the command line.
+   QString propertiesPath = (app.arguments().size() > 1) ? app.arguments().at(1) : QString(DEFAULT_VIDEO_PROPERTIES_PATH);
+   cppproperties::PropertiesParser propParser = cppproperties::PropertiesParser();
+   cppproperties::Properties p = propParser.Read(propertiesPath.toStdString());
+   MemoryBudget::setLimit(intProperty(p, PROPKEY_MEMORY_BUDGET_MB, 0) * STANDARD_MB);
+
+  // For now one window and display all video stream widgets within it
+  QMainWindow viewingWindow;
+  viewingWindow.setWindowTitle("Multiple Video Streaming Viewer");
+  viewingWindow.setSizePolicy(QSizePolicy::Expanding,QSizePolicy::Expanding);
+
+  // Make sure we can put the video streams in a grid
+  QGridLayout * viewingGrid = new QGridLayout();
+
+  QWidget* widget = new QWidget(&viewingWindow);
+  widget->setLayout(viewingGrid);
+  viewingWindow.setCentralWidget(widget);
+  viewingWindow.setSizePolicy(QSizePolicy::Expanding,QSizePolicy::Expanding);
+
+  // A headless capture node only records and serves its cameras to viewers, see the README.
+  bool headless = boolProperty(p, PROPKEY_HEADLESS, false);
+  if (!headless) {
+      viewingWindow.setVisible(true);
+      viewingWindow.show();
+  }
+
+   // Thread placement per stage ("capture_cpus = 2-7", "capture_realtime_priority = 10", ...) has to be
+   // known before any of the threads start. Per camera entries ("webCam0.cpus") are read with the cameras.
+   for (int stage = 0; stage < ThreadPlacement::StageCount; ++stage) {
+       ThreadPlacement::Policy policy;
+       QString prefix = QString::fromLatin1(ThreadPlacement::stageName((ThreadPlacement::Stage) stage)) + "_";
+       if (placementPolicy(p, prefix, policy)) ThreadPlacement::setPolicy((ThreadPlacement::Stage) stage, policy);
+   }
+   ThreadPlacement::enter(ThreadPlacement::Gui, "gui");
+
+   // Every recording and snapshot is written through the one storage writer thread.
+   StorageWriter storageWriter(intProperty(p, PROPKEY_STORAGE_QUEUE_MB, DEFAULT_STORAGE_QUEUE_LIMIT / STANDARD_MB) * STANDARD_MB,
+                               intProperty(p, PROPKEY_STORAGE_PREALLOCATE_MB, DEFAULT_STORAGE_PREALLOCATE / STANDARD_MB) * STANDARD_MB);
+   qDebug() << "Storage writes" << (storageWriter.usesIoUring() ? "batched through io_uring." : "are synchronous.");
+   SnapshotStore snapshotStore(CAPTURED_IMAGES_DIRECTORY_PATH);
+   snapshotStore.setDuplicates(SnapshotStore::modeFromString(QString::fromStdString(p.GetProperty(PROPKEY_SNAPSHOT_DUPLICATES, "link")).trimmed()),
+                               intProperty(p, PROPKEY_SNAPSHOT_HASH_DISTANCE, DEFAULT_SNAPSHOT_DISTANCE));
+
+   // Optionally serve the streams over HTTP from a thread of its own.
+   Thread previewThread;
+   int httpPort = intProperty(p, PROPKEY_HTTP_PORT, 0);
+   PreviewServer * previewServer = nullptr;
+   if (httpPort > 0) {
+       previewServer = new PreviewServer;
+       previewServer->setQuality(intProperty(p, PROPKEY_HTTP_QUALITY, DEFAULT_HTTP_JPEG_QUALITY));
+       previewServer->setMosaic(intProperty(p, PROPKEY_HTTP_MOSAIC_FPS, DEFAULT_HTTP_MOSAIC_FPS),
+                                intProperty(p, PROPKEY_HTTP_MOSAIC_TILE_WIDTH, DEFAULT_HTTP_MOSAIC_TILE_WIDTH));
+       previewServer->setToken(QString::fromStdString(p.GetProperty(PROPKEY_HTTP_TOKEN, "")).trimmed());
+       previewServer->moveToThread(&previewThread);
+       QObject::connect(&previewThread, &QThread::finished, previewServer, &QObject::deleteLater);
+       previewThread.place(ThreadPlacement::Serve, "http");
+       previewThread.start();
+       QMetaObject::invokeMethod(previewServer, "listenOn", Qt::QueuedConnection,
+                                 Q_ARG(QString, QString::fromStdString(p.GetProperty(PROPKEY_HTTP_ADDRESS, "")).trimmed()), Q_ARG(int, httpPort));
+   } else if (headless) {
+       qWarning() << "Headless without" << PROPKEY_HTTP_PORT << ", the cameras can only be recorded, not watched.";
+   }
+
+   // Optionally record the whole grid as one video, with one encoder, in a thread of its own.
+   Thread mosaicThread;
+   QString recordMode = QString::fromStdString(p.GetProperty(PROPKEY_RECORD_MODE, "cameras")).trimmed().toLower();
+   MosaicRecorder * mosaicRecorder = nullptr;
+   if (recordMode == "mosaic" || recordMode == "both") {
+       mosaicRecorder = new MosaicRecorder(&storageWriter, CAPTURED_VIDEO_DIRECTORY_PATH);
+       mosaicRecorder->setFramesPerSecond(intProperty(p, PROPKEY_MOSAIC_RECORD_FPS, DEFAULT_MOSAIC_RECORD_FPS));
+       mosaicRecorder->setTileWidth(intProperty(p, PROPKEY_MOSAIC_RECORD_TILE_WIDTH, 0));
+       mosaicRecorder->setQuality(intProperty(p, PROPKEY_MOSAIC_RECORD_QUALITY, DEFAULT_MOSAIC_RECORD_QUALITY));
+       mosaicRecorder->moveToThread(&mosaicThread);
+       QObject::connect(&mosaicThread, &QThread::finished, mosaicRecorder, &QObject::deleteLater);
+       mosaicThread.place(ThreadPlacement::Encode, "mosaic");
+       mosaicThread.start();
+   }
+
+   // Optionally webcams share a few capture threads instead of one each.
+   QList<QSharedPointer<Thread>> reactorThreads;
+   QList<CaptureReactor *> reactors;
+   int reactorCount = qBound(0, intProperty(p, PROPKEY_REACTOR_THREADS, 0), MAX_REACTOR_THREADS);
+   for (int i = 0; i < reactorCount; ++i) {
+       QSharedPointer<Thread> thread(new Thread);
+       CaptureReactor * reactor = new CaptureReactor;
+       reactor->moveToThread(thread.data());
+       QObject::connect(thread.data(), &QThread::finished, reactor, &QObject::deleteLater);
+       thread->place(ThreadPlacement::Capture, QString("reactor %1").arg(i));
+       thread->start();
+       reactorThreads.append(thread);
+       reactors.append(reactor);
+   }
+
+   // Optionally cameras are shown in further windows, e.g. one per monitor, each composed by a render thread of its own.
+   QList<QSharedPointer<Thread>> renderThreads;
+   QList<QSharedPointer<StreamWindow>> streamWindows;
+   QList<WindowRenderer *> renderers;
+   foreach (QString name, QString::fromStdString(p.GetProperty(PROPKEY_WINDOWS, "")).split(",", SKIP_EMPTY_PARTS)) {
+       name = name.trimmed();
+       QStringList cameras;
+       foreach (QString camera, QString::fromStdString(p.GetProperty((name + PROPKEY_WINDOW_CAMERAS).toStdString(), "")).split(",")) {
+           camera = camera.trimmed();
+           if (!camera.isEmpty() && !cameras.contains(camera)) cameras.append(camera);
+       }
+       if (name.isEmpty() || cameras.isEmpty()) continue;
+       ThreadPlacement::Policy policy;
+       if (placementPolicy(p, name + ".", policy)) ThreadPlacement::setPolicy(name, policy);
+       QSharedPointer<Thread> thread(new Thread);
+       WindowRenderer * renderer = new WindowRenderer(cameras);
+       renderer->moveToThread(thread.data());
+       QObject::connect(thread.data(), &QThread::finished, renderer, &QObject::deleteLater);
+       thread->place(ThreadPlacement::Render, name);
+       thread->start();
+       QSharedPointer<StreamWindow> window(new StreamWindow(name, renderer));
+       window->showOn(intProperty(p, (name + PROPKEY_WINDOW_SCREEN).toStdString().c_str(), -1),
+                      cameraBoolProperty(p, name, PROPKEY_WINDOW_FULLSCREEN, PROPKEY_FULLSCREEN, false));
+       renderThreads.append(thread);
+       streamWindows.append(window);
+       renderers.append(renderer);
+   }
+
+   // Start every stream and keep following changes to the ini file.
+   StreamWall wall(widget, viewingGrid, &storageWriter);
+   wall.setPreviewServer(previewServer);
+   wall.setMosaicRecorder(mosaicRecorder, recordMode != "mosaic");
+   wall.setCaptureReactors(reactors);
+   wall.setSnapshotStore(&snapshotStore);
+   wall.setWindowRenderers(renderers);
+   wall.setHeadless(headless);
+   if (previewServer) QObject::connect(previewServer, &PreviewServer::commandReceived, &wall, &StreamWall::nodeCommand);
+   wall.setThumbnailFramesPerSecond(intProperty(p, PROPKEY_FOCUS_THUMBNAIL_FPS, DEFAULT_FOCUS_THUMBNAIL_FPS));
+   wall.apply(p);
+   wall.watch(propertiesPath);
+
    // Check if full screen has been requested when we start running.
    QString fullScreen = QString::fromStdString(p.GetProperty(PROPKEY_FULLSCREEN, ""));
    if (!fullScreen.isEmpty())
@@ -561,26 +2135,57 @@ int main(int argc, char *argv[])
      QAction * actionRecord = toolbar->addAction( QIcon(":/toolbar/icons/record.png"), "Record ALL videos");
      QAction * actionStop = toolbar->addAction( QIcon(":/toolbar/icons/stop.png"), "Stop recording ALL videos");
      toolbar->addSeparator();
+     QAction * actionTrace = toolbar->addAction("Trace");
+     actionTrace->setToolTip("Record a timeline of every pipeline thread, written to " CAPTURED_TRACES_DIRECTORY_PATH " when stopped");
+     actionTrace->setCheckable(true);
+     toolbar->addSeparator();
      QAction *actionQuit = toolbar->addAction(QIcon(":/toolbar/icons/exit.png"),"Quit Application");
 
      QObject::connect( actionQuit, &QAction::triggered, &app, &QApplication::quit);
-     QList<ImageViewer *> viewerList = viewingWindow.findChildren<ImageViewer *>();
-     foreach (ImageViewer * view, viewerList)
-     {
-        QObject::connect( actionRecord, &QAction::triggered, view, &ImageViewer::recordPressed);
-        QObject::connect( actionStop, &QAction::triggered, view, &ImageViewer::stopPressed);
-     }
+     QObject::connect( actionRecord, &QAction::triggered, &wall, &StreamWall::recordAll);
+     QObject::connect( actionStop, &QAction::triggered, &wall, &StreamWall::stopAll);
+
+     // Tracing stops by itself after trace_seconds so a forgotten trace does not wrap round.
+     QTimer * traceTimer = new QTimer(&viewingWindow);
+     traceTimer->setSingleShot(true);
+     int traceSeconds = qMax(0, intProperty(p, PROPKEY_TRACE_SECONDS, DEFAULT_TRACE_SECONDS));
+     traceTimer->setInterval(traceSeconds * MS_ONE_SECOND);
+     int traceEvents = intProperty(p, PROPKEY_TRACE_EVENTS_PER_THREAD, 0);
+     TraceRecorder::setEventsPerThread(traceEvents > 0 ? traceEvents : TraceRecorder::eventsForSeconds(traceSeconds));
+     QObject::connect(traceTimer, &QTimer::timeout, actionTrace, [actionTrace](){ actionTrace->setChecked(false); });
+     QObject::connect(actionTrace, &QAction::toggled, [traceTimer](bool tracing){
+         if (tracing) {
+             TraceRecorder::start();
+             if (traceTimer->interval() > 0) traceTimer->start();
+             return;
+         }
+         traceTimer->stop();
+         TraceRecorder::stop();
+         QDir().mkpath(CAPTURED_TRACES_DIRECTORY_PATH);
+         QString path = QString(CAPTURED_TRACES_DIRECTORY_PATH) + "/trace " + QDateTime::currentDateTime().toString("ddMMyyyy_HHmmss") + ".json";
+         if (TraceRecorder::write(path)) qDebug() << "Trace written to" << path;
+     });
 
      qDebug() << "-----------------------FYI----------------------------------";
-     QStorageInfo storage = QStorageInfo::root();
-     qDebug() << storage.rootPath();
-     if (storage.isReadOnly())
-         qDebug() << "isReadOnly:" << storage.isReadOnly();
-
-     qDebug() << "name:" << storage.name();
-     qDebug() << "fileSystemType:" << storage.fileSystemType();
-     qDebug() << "size:" << storage.bytesTotal()/1000/1000 << "MB";
-     qDebug() << "availableSize:" << storage.bytesAvailable()/1000/1000 << "MB";
+     // Watch the volumes the captures actually go to, which need not be the root file system.
+     QList<QStorageInfo> volumes;
+     foreach (const QString & path, QStringList({CAPTURED_VIDEO_DIRECTORY_PATH, CAPTURED_IMAGES_DIRECTORY_PATH, CAPTURED_TIMELAPSE_DIRECTORY_PATH})) {
+         QDir().mkpath(path);
+         QStorageInfo storage(path);
+         bool known = false;
+         foreach (const QStorageInfo & volume, volumes) known = known || volume.rootPath() == storage.rootPath();
+         if (known) continue;
+         volumes.append(storage);
+
+         qDebug() << path << "is on" << storage.rootPath();
+         if (storage.isReadOnly())
+             qDebug() << "isReadOnly:" << storage.isReadOnly();
+
+         qDebug() << "name:" << storage.name();
+         qDebug() << "fileSystemType:" << storage.fileSystemType();
+         qDebug() << "size:" << storage.bytesTotal()/1000/1000 << "MB";
+         qDebug() << "availableSize:" << storage.bytesAvailable()/1000/1000 << "MB";
+     }
 
      // Use lambda timer to update the status bar with disk space available...
      QStatusBar * statusBar = new QStatusBar();
@@ -588,23 +2193,36 @@ int main(int argc, char *argv[])
 
      QTimer* diskSpaceTimer = new QTimer;
      diskSpaceTimer->setInterval(1000);
-     QObject::connect(diskSpaceTimer, &QTimer::timeout, [&storage, &viewingWindow, &diskSpaceTimer](){
+     QObject::connect(diskSpaceTimer, &QTimer::timeout, [&volumes, &viewingWindow, &diskSpaceTimer, &storageWriter, &wall](){
          static bool toggleVal = false;
-         storage.refresh();
-         qint64 bytesAvailable = storage.bytesAvailable();
-         viewingWindow.statusBar()->showMessage(QString((toggleVal) ? "/":"\\") +
-                                                QString("Storage space availability...") +
-                                                QString::number(bytesAvailable/STANDARD_KB/STANDARD_KB) + "MB/" +
-                                                QString::number(storage.bytesTotal()/STANDARD_KB/STANDARD_KB) + "MB");
+         QList<StorageStats> writeStats = storageWriter.stats();
+         QString message = QString((toggleVal) ? "/":"\\") + QString("Storage space availability...");
+         bool outOfSpace = false;
+         for (QStorageInfo & storage : volumes) {
+             storage.refresh();
+             qint64 bytesAvailable = storage.bytesAvailable();
+             outOfSpace = outOfSpace || bytesAvailable < DISK_SPACE_STOP_RECORDING_LIMIT;
+             message += " " + storage.rootPath() + " " +
+                        QString::number(bytesAvailable/STANDARD_KB/STANDARD_KB) + "MB/" +
+                        QString::number(storage.bytesTotal()/STANDARD_KB/STANDARD_KB) + "MB";
+             foreach (const StorageStats & stats, writeStats) {
+                 if (stats.volume != storage.rootPath()) continue;
+                 message += QString(" write %1MB/s queued %2 (%3MB) fsync %4ms (max %5ms) writeback %6ms (max %7ms)")
+                            .arg(stats.bytesPerSecond / STANDARD_MB, 0, 'f', 1).arg(stats.queuedWrites)
+                            .arg(stats.queuedBytes / STANDARD_MB).arg(stats.msLastFsync, 0, 'f', 1).arg(stats.msMaxFsync, 0, 'f', 1)
+                            .arg(stats.msLastWriteback, 0, 'f', 1).arg(stats.msMaxWriteback, 0, 'f', 1);
+                 if (stats.droppedWrites) message += QString(" dropped %1").arg(stats.droppedWrites);
+                 if (stats.failedWrites) message += QString(" failed %1").arg(stats.failedWrites);
+             }
+         }
+         message += QString(" memory %1MB").arg(MemoryBudget::used() / STANDARD_MB);
+         if (MemoryBudget::limit()) message += QString("/%1MB").arg(MemoryBudget::limit() / STANDARD_MB);
+         viewingWindow.statusBar()->showMessage(message);
 
          // If we run out of space immediately stop
-        if (bytesAvailable < DISK_SPACE_STOP_RECORDING_LIMIT)
+        if (outOfSpace)
         {
-            QList<ImageViewer *> viewerList = viewingWindow.findChildren<ImageViewer *>();
-            foreach (ImageViewer * view, viewerList)
-            {
-               view->stopPressed();
-            }
+            wall.stopAll();
             diskSpaceTimer->stop();
             diskSpaceTimer->deleteLater();
             viewingWindow.statusBar()->showMessage("Disk space ran out, stopped all recording.Exit, fix and restart!");
@@ -615,6 +2233,42 @@ int main(int argc, char *argv[])
      });
      diskSpaceTimer->start(1000);
 
+     // Periodically log how busy each pipeline thread is and where it ran.
+     int threadReportSeconds = intProperty(p, PROPKEY_THREAD_REPORT_S, DEFAULT_THREAD_REPORT_S);
+     if (threadReportSeconds > 0) {
+         QTimer * threadReportTimer = new QTimer(&viewingWindow);
+         QObject::connect(threadReportTimer, &QTimer::timeout, [](){
+             QStringList lines;
+             foreach (const ThreadPlacement::Usage & usage, ThreadPlacement::usage())
+                 lines.append(QString("%1 [%2] %3% cpu %4").arg(usage.name, QString::fromLatin1(ThreadPlacement::stageName(usage.stage)))
+                              .arg(usage.cpuPercent, 0, 'f', 1).arg(usage.lastCpu));
+             qDebug().noquote() << "Threads:" << lines.join(", ");
+         });
+         threadReportTimer->start(threadReportSeconds * MS_ONE_SECOND);
+     }
+
+     // And what memory each stream holds at each stage, with how often the budget turned it down.
+     int memoryReportSeconds = intProperty(p, PROPKEY_MEMORY_REPORT_S, DEFAULT_MEMORY_REPORT_S);
+     if (memoryReportSeconds > 0) {
+         QTimer * memoryReportTimer = new QTimer(&viewingWindow);
+         QObject::connect(memoryReportTimer, &QTimer::timeout, [](){
+             QStringList lines;
+             foreach (const MemoryBudget::Usage & usage, MemoryBudget::usage()) {
+                 QStringList stages;
+                 for (int stage = 0; stage < MemoryBudget::StageCount; ++stage) {
+                     if (usage.bytes[stage] == 0) continue;
+                     stages.append(QString("%1 %2MB").arg(QString::fromLatin1(MemoryBudget::stageName((MemoryBudget::Stage) stage)))
+                                   .arg(usage.bytes[stage] / (double) STANDARD_MB, 0, 'f', 1));
+                 }
+                 lines.append(QString("%1 [%2]").arg(usage.owner, stages.join(" ")) + (usage.refused ? QString(" refused %1").arg(usage.refused) : QString()));
+             }
+             qDebug().noquote() << QString("Memory %1MB of %2:").arg(MemoryBudget::used() / STANDARD_MB)
+                                   .arg(MemoryBudget::limit() ? QString("%1MB").arg(MemoryBudget::limit() / STANDARD_MB) : QString("unlimited"))
+                                << lines.join(", ");
+         });
+         memoryReportTimer->start(memoryReportSeconds * MS_ONE_SECOND);
+     }
+
      qDebug() << "------------------------------------------------------------";
 
    return app.exec();